@@ -6,12 +6,23 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <fmt/core.h>
 #include <memory>
 #include <optional>
 #include <ranges>
 #include <string>
 #include <string_view>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <system_error>
 #include <thread>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 
@@ -57,7 +68,7 @@ replaceAll(
 }
 
 int
-execCmd(const Command& cmd) noexcept {
+execCmd(const Command& cmd) {
   logger::debug("Running `{}`", cmd.toString());
   return cmd.spawn().wait();
 }
@@ -69,12 +80,14 @@ getCmdOutput(const Command& cmd, const size_t retry) {
   int exitCode = EXIT_SUCCESS;
   int waitTime = 1;
   for (size_t i = 0; i < retry; ++i) {
-    const auto [curExitCode, stdOut, stdErr] = cmd.output();
-    static_cast<void>(stdErr);
-    if (curExitCode == EXIT_SUCCESS) {
-      return stdOut;
+    CommandOutput output = cmd.output();
+    if (output.exitCode == EXIT_SUCCESS) {
+      return std::move(output.stdOut);
+    }
+    exitCode = output.exitCode;
+    if (i + 1 == retry) {
+      break;  // Don't wait after the last attempt.
     }
-    exitCode = curExitCode;
 
     // Sleep for an exponential backoff.
     std::this_thread::sleep_for(std::chrono::seconds(waitTime));
@@ -83,53 +96,174 @@ getCmdOutput(const Command& cmd, const size_t retry) {
   throw CabinError("Command `", cmd, "` failed with exit code ", exitCode);
 }
 
+void
+logResourceUsage() {
+  std::vector<CommandUsage> usages = getRecordedUsages();
+  if (usages.empty()) {
+    return;
+  }
+
+  ResourceUsage total;
+  for (const CommandUsage& usage : usages) {
+    total += usage.usage;
+  }
+  logger::debug(
+      "{} commands: {:.2f}s user, {:.2f}s sys, {} MiB peak RSS, {} blocks "
+      "in, {} blocks out",
+      usages.size(), total.userSec, total.sysSec, total.maxRssKiB / 1024,
+      total.inBlocks, total.outBlocks
+  );
+
+  constexpr size_t numHeaviest = 5;
+  const size_t numShown = std::min(numHeaviest, usages.size());
+  std::ranges::partial_sort(
+      usages, usages.begin() + static_cast<std::ptrdiff_t>(numShown),
+      std::ranges::greater{},
+      [](const CommandUsage& usage) { return usage.usage.cpuSec(); }
+  );
+  for (size_t i = 0; i < numShown; ++i) {
+    const auto& [command, usage] = usages[i];
+    logger::debug(
+        "{:.2f}s CPU, {} MiB peak RSS: {}", usage.cpuSec(),
+        usage.maxRssKiB / 1024, command
+    );
+  }
+}
+
+static bool
+isExecutableFile(const fs::path& path) {
+  std::error_code ec;
+  return fs::is_regular_file(path, ec) && access(path.c_str(), X_OK) == 0;
+}
+
+std::optional<fs::path>
+findProgram(const std::string_view name) {
+  if (name.find('/') != std::string_view::npos) {
+    if (isExecutableFile(name)) {
+      return fs::path(name);
+    }
+    return std::nullopt;
+  }
+
+  // Without PATH, posix_spawnp() searches the default path of the system,
+  // e.g., /bin:/usr/bin.
+  std::string defaultPath;
+  const char* path = std::getenv("PATH");
+  if (path == nullptr) {
+    defaultPath.resize(confstr(_CS_PATH, nullptr, 0));
+    if (!defaultPath.empty()) {
+      confstr(_CS_PATH, defaultPath.data(), defaultPath.size());
+      defaultPath.pop_back();  // the terminating null character
+    }
+    path = defaultPath.c_str();
+  }
+
+  std::string_view dirs = path;
+  while (true) {
+    const size_t colon = dirs.find(':');
+    // Unlike execvp(), an empty entry is skipped rather than meaning the
+    // current directory, from which we never run programs.
+    const std::string_view dir = dirs.substr(0, colon);
+    if (!dir.empty()) {
+      const fs::path candidate = fs::path(dir) / name;
+      if (isExecutableFile(candidate)) {
+        return candidate;
+      }
+    }
+    if (colon == std::string_view::npos) {
+      return std::nullopt;
+    }
+    dirs.remove_prefix(colon + 1);
+  }
+}
+
 bool
 commandExists(const std::string_view cmd) noexcept {
-  const int exitCode = Command("which")
-                           .addArg(cmd)
-                           .setStdOutConfig(Command::IOConfig::Null)
-                           .spawn()
-                           .wait();
-  return exitCode == EXIT_SUCCESS;
+  try {
+    return findProgram(cmd).has_value();
+  } catch (const std::exception& e) {
+    logger::debug("{}", e.what());
+    return false;
+  }
 }
 
+std::string
+fileStamp(const fs::path& path) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) == -1) {
+    return "";
+  }
+  std::error_code ec;
+  const auto mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+  return fmt::format("{}:{}", st.st_ino, mtime);
+}
+
+FileLock::FileLock(const fs::path& path)
+    : fd(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) {
+  if (fd == -1) {
+    throw CabinError("failed to open ", path.string(), ": ", strerror(errno));
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+    return;
+  }
+  if (errno == EWOULDBLOCK) {
+    logger::info("Blocking", "waiting for file lock on {}", path.string());
+    int res{};
+    do {
+      res = flock(fd, LOCK_EX);
+    } while (res == -1 && errno == EINTR);
+    if (res == 0) {
+      return;
+    }
+  }
+  const int err = errno;
+  close(fd);
+  throw CabinError("failed to lock ", path.string(), ": ", strerror(err));
+}
+
+FileLock::~FileLock() {
+  if (fd != -1) {
+    close(fd);  // releases the lock
+  }
+}
+
+FileLock::FileLock(FileLock&& other) noexcept
+    : fd(std::exchange(other.fd, -1)) {}
+
 // ref: https://wandbox.org/permlink/zRjT41alOHdwcf00
-static size_t
+size_t
 levDistance(const std::string_view lhs, const std::string_view rhs) {
   const size_t lhsSize = lhs.size();
   const size_t rhsSize = rhs.size();
 
-  // for all i and j, d[i,j] will hold the Levenshtein distance between the
-  // first i characters of s and the first j characters of t
-  std::vector<std::vector<size_t>> dist(
-      lhsSize + 1, std::vector<size_t>(rhsSize + 1)
-  );
-  dist[0][0] = 0;
-
-  // source prefixes can be transformed into empty string by dropping all
-  // characters
-  for (size_t i = 1; i <= lhsSize; ++i) {
-    dist[i][0] = i;
-  }
-
+  // dist[i,j] is the Levenshtein distance between the first i characters of
+  // lhs and the first j characters of rhs.  Only the rows for i - 1 and i
+  // are kept: prev and cur.
+  //
   // target prefixes can be reached from empty source prefix by inserting every
   // character
-  for (size_t j = 1; j <= rhsSize; ++j) {
-    dist[0][j] = j;
+  std::vector<size_t> prev(rhsSize + 1);
+  std::vector<size_t> cur(rhsSize + 1);
+  for (size_t j = 0; j <= rhsSize; ++j) {
+    prev[j] = j;
   }
 
   for (size_t i = 1; i <= lhsSize; ++i) {
+    // source prefixes can be transformed into empty string by dropping all
+    // characters
+    cur[0] = i;
     for (size_t j = 1; j <= rhsSize; ++j) {
       const size_t substCost = lhs[i - 1] == rhs[j - 1] ? 0 : 1;
-      dist[i][j] = std::min({
-          dist[i - 1][j] + 1,             // deletion
-          dist[i][j - 1] + 1,             // insertion
-          dist[i - 1][j - 1] + substCost  // substitution
+      cur[j] = std::min({
+          prev[j] + 1,             // deletion
+          cur[j - 1] + 1,          // insertion
+          prev[j - 1] + substCost  // substitution
       });
     }
+    std::swap(prev, cur);
   }
 
-  return dist[lhsSize][rhsSize];
+  return prev[rhsSize];
 }
 
 static bool
@@ -183,6 +317,7 @@ findSimilarStr(
 #  include "Rustify/Tests.hpp"
 
 #  include <array>
+#  include <fstream>
 #  include <limits>
 
 namespace tests {
@@ -253,6 +388,20 @@ testFindSimilarStr() {
   pass();
 }
 
+static void
+testFnv1aHash() {
+  // NOLINTBEGIN(*-magic-numbers)
+  static_assert(fnv1aHash("") == 0xcbf29ce484222325);
+  static_assert(fnv1aHash("a") == 0xaf63dc4c8601ec8c);
+  static_assert(fnv1aHash("foobar") == 0x85944171f73967e8);
+  // NOLINTEND(*-magic-numbers)
+
+  // Hashing in pieces is the same as hashing at once.
+  assertEq(fnv1aHash("bar", fnv1aHash("foo")), fnv1aHash("foobar"));
+
+  pass();
+}
+
 static void
 testFindSimilarStr2() {
   constexpr std::array<std::string_view, 2> candidates{ "aaab", "aaabc" };
@@ -265,6 +414,71 @@ testFindSimilarStr2() {
   pass();
 }
 
+static void
+testFindProgram() {
+  const std::optional<fs::path> sh = findProgram("sh");
+  assertTrue(sh.has_value());
+  assertEq(findProgram(sh->string()), sh);
+  assertEq(findProgram("cabin-no-such-program"), std::nullopt);
+  assertTrue(commandExists("sh"));
+  assertFalse(commandExists("cabin-no-such-program"));
+
+  // Programs in the current directory are not found through empty entries
+  // of PATH.
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-find-program";
+  fs::create_directories(tmp);
+  const fs::path cwd = fs::current_path();
+  fs::current_path(tmp);
+  std::ofstream("cabin-test-program") << "#!/bin/sh\n";
+  fs::permissions("cabin-test-program", fs::perms::owner_all);
+  const std::string path = std::getenv("PATH");
+  setenv("PATH", (":" + path + "::").c_str(), 1);
+  assertEq(findProgram("cabin-test-program"), std::nullopt);
+  assertEq(findProgram("sh"), sh);
+  setenv("PATH", path.c_str(), 1);
+  fs::current_path(cwd);
+  fs::remove_all(tmp);
+
+  pass();
+}
+
+static void
+testFileLock() {
+  const fs::path path = fs::temp_directory_path() / "cabin-test-lock";
+  fs::remove(path);
+
+  // Another open file description conflicts with the lock, even in the same
+  // process.
+  const auto isLocked = [&path] {
+    const int fd = open(path.c_str(), O_RDWR);
+    const bool locked = flock(fd, LOCK_EX | LOCK_NB) == -1;
+    close(fd);
+    return locked;
+  };
+  const fs::path other = path.string() + "2";
+  {
+    std::vector<FileLock> locks;
+    locks.emplace_back(path);
+    locks.emplace_back(other);  // moves the first one
+    assertTrue(fs::exists(path));
+    assertTrue(isLocked());
+  }
+  assertFalse(isLocked());
+
+  fs::remove(path);
+  fs::remove(other);
+  pass();
+}
+
+static void
+testExecCmdSignaled() {
+  // A killed command did not succeed, e.g., make killed by the OOM killer.
+  assertEq(execCmd(Command("sh").addArgs({ "-c", "kill -9 $$" })), 128 + 9);
+  assertEq(execCmd(Command("sh").addArgs({ "-c", "exit 3" })), 3);
+
+  pass();
+}
+
 }  // namespace tests
 
 int
@@ -273,6 +487,10 @@ main() {
   tests::testLevDistance2();
   tests::testFindSimilarStr();
   tests::testFindSimilarStr2();
+  tests::testFnv1aHash();
+  tests::testFindProgram();
+  tests::testFileLock();
+  tests::testExecCmdSignaled();
 }
 
 #endif
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "Command.hpp"
+#include "Rustify/Aliases.hpp"
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <span>
 #include <string>
@@ -12,9 +15,49 @@ std::string toMacroName(std::string_view name) noexcept;
 std::string
 replaceAll(std::string str, std::string_view from, std::string_view to);
 
-int execCmd(const Command& cmd) noexcept;
+/// 64-bit FNV-1a hash.  Unlike std::hash, the result is stable across
+/// builds, so it can be a part of paths we reuse later.
+constexpr uint64_t
+fnv1aHash(const std::string_view str, uint64_t hash = 0xcbf29ce484222325) {
+  for (const char c : str) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+int execCmd(const Command& cmd);
 std::string getCmdOutput(const Command& cmd, size_t retry = 3);
+/// Where `name` is found in PATH, like `which` does but without spawning it.
+std::optional<fs::path> findProgram(std::string_view name);
 bool commandExists(std::string_view cmd) noexcept;
+/// Tells whether `path` was replaced without reading it, e.g., by a package
+/// upgrade, which gives it a new inode or mtime.  Empty if `path` does not
+/// exist.
+std::string fileStamp(const fs::path& path);
+/// Log what the children waited for so far used in total, and which of
+/// them used the most CPU time, at the debug level.
+void logResourceUsage();
+
+/// An exclusive lock on a file, created if missing, held until destruction.
+/// If another process holds it, we say so and wait for it.  Nothing is
+/// written to the file; it only identifies what is locked.
+class FileLock {
+public:
+  explicit FileLock(const fs::path& path);
+  ~FileLock();
+
+  FileLock(const FileLock&) = delete;
+  FileLock& operator=(const FileLock&) = delete;
+  FileLock(FileLock&& other) noexcept;
+  FileLock& operator=(FileLock&&) = delete;
+
+private:
+  int fd;
+};
+
+/// The Levenshtein distance between `lhs` and `rhs`.
+size_t levDistance(std::string_view lhs, std::string_view rhs);
 
 // ref: https://reviews.llvm.org/differential/changeset/?ref=3315514
 /// Find a similar string in `candidates`.
@@ -7,11 +7,14 @@
 #include "Logger.hpp"
 #include "Manifest.hpp"
 #include "Parallelism.hpp"
+#include "ProcessPool.hpp"
+#include "Sha256.hpp"
 #include "TermColor.hpp"
 
 #include <algorithm>
 #include <array>
 #include <cctype>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -20,9 +23,12 @@
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <nlohmann/json.hpp>
 #include <optional>
 #include <ostream>
 #include <queue>
@@ -31,9 +37,9 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
-#include <tbb/spin_mutex.h>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -62,44 +68,33 @@ operator<<(std::ostream& os, VarType type) {
   return os;
 }
 
-BuildConfig::BuildConfig(const std::string& packageName, const bool isDebug)
-    : packageName{ packageName }, isDebug{ isDebug } {
+BuildConfig::BuildConfig(
+    const std::string& packageName, const bool isDebug,
+    const std::optional<std::string>& revision
+)
+    : packageName{ packageName }, isDebug{ isDebug }, revision{ revision } {
   if (packageName.starts_with("lib")) {
     libName = fmt::format("{}.a", packageName);
   } else {
     libName = fmt::format("lib{}.a", packageName);
   }
+
+  cxx = getToolchain().cxx;
+
   const fs::path projectBasePath = getProjectBasePath();
-  if (isDebug) {
-    outBasePath = projectBasePath / "cabin-out" / "debug";
-  } else {
-    outBasePath = projectBasePath / "cabin-out" / "release";
+  if (!revision.has_value()) {
+    setOutBasePath(projectBasePath / "cabin-out" / modeToString(isDebug));
   }
+  // Otherwise, installDeps() decides where to build once it knows what we
+  // link with.
+  includes.push_back("-I" + (projectBasePath / "include").string());
+}
+
+void
+BuildConfig::setOutBasePath(const fs::path& path) {
+  outBasePath = path;
   buildOutPath = outBasePath / (packageName + ".d");
   unittestOutPath = outBasePath / "unittests";
-
-  if (const char* cxx = std::getenv("CXX")) {
-    this->cxx = cxx;
-  } else {
-    const std::string output = Command("make")
-                                   .addArg("--print-data-base")
-                                   .addArg("--question")
-                                   .addArg("-f")
-                                   .addArg("/dev/null")
-                                   .setStdErrConfig(Command::IOConfig::Null)
-                                   .output()
-                                   .stdOut;
-    std::istringstream iss(output);
-    std::string line;
-
-    while (std::getline(iss, line)) {
-      if (line.starts_with("CXX = ")) {
-        this->cxx = line.substr("CXX = "sv.size());
-        return;
-      }
-    }
-    throw CabinError("failed to get CXX from make");
-  }
 }
 
 // Generally split the string by space character, but it will properly interpret
@@ -384,8 +379,167 @@ BuildConfig::emitCompdb(std::ostream& os) const {
   os << "]\n";
 }
 
-std::string
-BuildConfig::runMM(const std::string& sourceFile, const bool isTest) const {
+// Indexed by BuildPlan::Kind.
+static constexpr std::array<std::string_view, 7> TARGET_KIND_NAMES{
+  "object", "test-object", "library", "binary", "test", "dependency", "other",
+};
+
+void
+BuildConfig::emitBuildPlan(std::ostream& os) const {
+  using Kind = BuildPlan::Kind;
+
+  std::unordered_map<std::string, Kind> outputKinds;
+  if (hasLibraryTarget) {
+    outputKinds.emplace(outBasePath / libName, Kind::Library);
+  }
+  for (const std::string& binName : binNames) {
+    outputKinds.emplace(outBasePath / binName, Kind::Binary);
+  }
+  for (const PackageBuild& packageDep : packageDeps) {
+    outputKinds.emplace(packageDep.targets.front(), Kind::Dependency);
+  }
+  const std::string unittestPrefix = unittestOutPath.string() + '/';
+  const auto getKind = [&](const std::string& target) {
+    if (target.ends_with(".test")) {
+      return Kind::Test;
+    }
+    if (target.ends_with(".o")) {
+      return target.starts_with(unittestPrefix) ? Kind::TestObject
+                                                : Kind::Object;
+    }
+    const auto itr = outputKinds.find(target);
+    return itr != outputKinds.end() ? itr->second : Kind::Other;
+  };
+  const auto isPhony = [this](const std::string& target) {
+    return phony.has_value() && phony->contains(target);
+  };
+
+  // Paths are stored once in a table and referred to by their indices, as
+  // most of them are headers shared by many targets.
+  std::vector<std::string> paths;
+  std::unordered_map<std::string, size_t> pathIdx;
+  const auto intern = [&](const std::string& path) {
+    const auto [itr, inserted] = pathIdx.try_emplace(path, paths.size());
+    if (inserted) {
+      paths.push_back(path);
+    }
+    return itr->second;
+  };
+
+  std::vector<std::string> names;
+  for (const auto& [name, target] : targets) {
+    if (!isPhony(name)) {
+      names.push_back(name);
+    }
+  }
+  std::ranges::sort(names);
+
+  nlohmann::json planTargets = nlohmann::json::array();
+  for (const std::string& name : names) {
+    const Target& target = targets.at(name);
+    const Kind kind = getKind(name);
+
+    std::vector<std::string> deps(target.remDeps.begin(), target.remDeps.end());
+    std::erase_if(deps, isPhony);
+    std::ranges::sort(deps);
+    std::optional<std::string> sourceFile = target.sourceFile;
+    if (sourceFile.has_value()) {
+      deps.insert(deps.begin(), sourceFile.value());
+    } else if (kind == Kind::Test) {
+      for (const std::string& dep : deps) {
+        if (getKind(dep) == Kind::TestObject && targets.contains(dep)) {
+          sourceFile = targets.at(dep).sourceFile;
+          break;
+        }
+      }
+    }
+
+    nlohmann::json planTarget{
+      { "name", intern(name) },
+      { "kind", TARGET_KIND_NAMES[static_cast<size_t>(kind)] },
+    };
+    if (sourceFile.has_value()) {
+      planTarget["source"] = intern(sourceFile.value());
+    }
+    nlohmann::json planDeps = nlohmann::json::array();
+    for (const std::string& dep : deps) {
+      planDeps.push_back(intern(dep));
+    }
+    planTarget["deps"] = std::move(planDeps);
+    planTargets.push_back(std::move(planTarget));
+  }
+
+  const nlohmann::json plan{
+    { "version", BuildPlan::VERSION },
+    { "package", packageName },
+    { "profile", std::string(modeToProfile(isDebug)) },
+    { "paths", paths },
+    { "targets", std::move(planTargets) },
+  };
+  os << plan.dump() << '\n';
+}
+
+BuildPlan
+BuildPlan::load(const fs::path& outBasePath) {
+  const fs::path planPath = outBasePath / FILE_NAME;
+  std::ifstream ifs(planPath);
+  if (!ifs) {
+    throw CabinError("failed to open ", planPath.string());
+  }
+
+  BuildPlan plan;
+  plan.outBasePath = outBasePath;
+  try {
+    const nlohmann::json json = nlohmann::json::parse(ifs);
+    if (json.at("version").get<int>() != VERSION) {
+      throw CabinError("unsupported version");
+    }
+    const std::vector<std::string> paths =
+        json.at("paths").get<std::vector<std::string>>();
+    for (const nlohmann::json& planTarget : json.at("targets")) {
+      Target target;
+      target.name = paths.at(planTarget.at("name").get<size_t>());
+
+      const std::string kind = planTarget.at("kind").get<std::string>();
+      const auto kindItr = std::ranges::find(TARGET_KIND_NAMES, kind);
+      if (kindItr == TARGET_KIND_NAMES.end()) {
+        throw CabinError("unknown kind `", kind, "`");
+      }
+      target.kind =
+          static_cast<Kind>(std::distance(TARGET_KIND_NAMES.begin(), kindItr));
+
+      if (planTarget.contains("source")) {
+        target.sourceFile = paths.at(planTarget["source"].get<size_t>());
+      }
+      for (const nlohmann::json& dep : planTarget.at("deps")) {
+        target.deps.push_back(paths.at(dep.get<size_t>()));
+      }
+      std::string name = target.name;
+      plan.targets.emplace(std::move(name), std::move(target));
+    }
+  } catch (const std::exception& e) {
+    throw CabinError(
+        "invalid build plan ", planPath.string(), ": ", e.what(),
+        "; run `cabin clean` and try again"
+    );
+  }
+  return plan;
+}
+
+std::vector<std::string>
+BuildPlan::getTargets(const Kind kind) const {
+  std::vector<std::string> names;
+  for (const auto& [name, target] : targets) {
+    if (target.kind == kind) {
+      names.push_back(name);
+    }
+  }
+  std::ranges::sort(names);
+  return names;
+}
+
+Command
+BuildConfig::mmCommand(const std::string& sourceFile, const bool isTest) const {
   Command command =
       Command(cxx).addArgs(cxxflags).addArgs(defines).addArgs(includes);
   if (isTest) {
@@ -394,7 +548,47 @@ BuildConfig::runMM(const std::string& sourceFile, const bool isTest) const {
   command.addArg("-MM");
   command.addArg(sourceFile);
   command.setWorkingDirectory(outBasePath);
-  return getCmdOutput(command);
+  return command;
+}
+
+// Submits `cmd` to `pool`, and calls `onSuccess` with its stdout once it
+// exits successfully.  Stdout goes to `onStdOut` instead if given.  Like
+// getCmdOutput(), a failed command is run up to `retry` times in total, but
+// again at once as sleeping would stall the other commands; `onRetry` is
+// called before that to discard what `onStdOut` has received.
+static void
+submitCmd(
+    ProcessPool& pool, const Command& cmd,
+    std::function<void(std::string)> onSuccess, OutputSink onStdOut = nullptr,
+    std::function<void()> onRetry = nullptr, const size_t retry = 3
+) {
+  pool.submit(
+      cmd,
+      [&pool, cmd, onSuccess = std::move(onSuccess), onStdOut,
+       onRetry = std::move(onRetry), retry](CommandOutput output) mutable {
+        if (output.exitCode == EXIT_SUCCESS) {
+          onSuccess(std::move(output.stdOut));
+          return;
+        }
+        if (retry <= 1) {
+          throw CabinError(
+              "Command `", cmd, "` failed with exit code ", output.exitCode
+          );
+        }
+        logger::debug(
+            "Command `{}` failed with exit code {}; retrying", cmd.toString(),
+            output.exitCode
+        );
+        if (onRetry) {
+          onRetry();
+        }
+        submitCmd(
+            pool, cmd, std::move(onSuccess), std::move(onStdOut),
+            std::move(onRetry), retry - 1
+        );
+      },
+      onStdOut
+  );
 }
 
 static std::unordered_set<std::string>
@@ -424,12 +618,20 @@ parseMMOutput(const std::string& mmOutput, std::string& target) {
 }
 
 static bool
-isUpToDate(const std::string_view makefilePath) {
+isUpToDate(
+    const std::string_view makefilePath,
+    const std::vector<fs::path>& extraDeps = {}
+) {
   if (!fs::exists(makefilePath)) {
     return false;
   }
 
   const fs::file_time_type makefileTime = fs::last_write_time(makefilePath);
+  for (const fs::path& extraDep : extraDeps) {
+    if (!fs::exists(extraDep) || fs::last_write_time(extraDep) > makefileTime) {
+      return false;
+    }
+  }
   // Makefile depends on all files in ./src and cabin.toml.
   const fs::path srcDir = getProjectBasePath() / "src";
   for (const auto& entry : fs::recursive_directory_iterator(srcDir)) {
@@ -441,38 +643,64 @@ isUpToDate(const std::string_view makefilePath) {
          <= makefileTime;
 }
 
-bool
-BuildConfig::containsTestCode(const std::string& sourceFile) const {
+void
+BuildConfig::findTestCode(
+    ProcessPool& pool, const std::string& sourceFile,
+    std::function<void()> onFound
+) const {
   std::ifstream ifs(sourceFile);
   std::string line;
   while (std::getline(ifs, line)) {
-    if (line.find("CABIN_TEST") != std::string::npos) {
-      // TODO: Can't we somehow elegantly make the compiler command sharable?
-      Command command(cxx);
-      command.addArg("-E");
-      command.addArgs(cxxflags);
-      command.addArgs(defines);
-      command.addArgs(includes);
-      command.addArg(sourceFile);
-
-      const std::string src = getCmdOutput(command);
-
-      command.addArg("-DCABIN_TEST");
-      const std::string testSrc = getCmdOutput(command);
-
-      // If the source file contains CABIN_TEST, by processing the source
-      // file with -E, we can check if the source file contains CABIN_TEST
-      // or not semantically.  If the source file contains CABIN_TEST, the
-      // test source file should be different from the original source
-      // file.
-      const bool containsTest = src != testSrc;
-      if (containsTest) {
-        logger::trace("Found test code: {}", sourceFile);
-      }
-      return containsTest;
+    if (line.find("CABIN_TEST") == std::string::npos) {
+      continue;
     }
+
+    // TODO: Can't we somehow elegantly make the compiler command sharable?
+    Command command(cxx);
+    command.addArg("-E");
+    command.addArgs(cxxflags);
+    command.addArgs(defines);
+    command.addArgs(includes);
+    command.addArg(sourceFile);
+
+    // If the source file contains CABIN_TEST, by processing the source
+    // file with -E, we can check if the source file contains CABIN_TEST
+    // or not semantically.  If the source file contains CABIN_TEST, the
+    // test source file should be different from the original source
+    // file.  Both run at once; whichever finishes last compares them.
+    // Preprocessed sources can be tens of megabytes, so they are hashed
+    // while being read instead of being kept.
+    struct Preprocessed {
+      std::array<Sha256, 2> hashers;
+      std::array<std::optional<std::string>, 2> digests;
+    };
+    const auto preprocessed = std::make_shared<Preprocessed>();
+    const auto submitPreprocess = [&](const size_t isTest) {
+      submitCmd(
+          pool, command,
+          [preprocessed, isTest, sourceFile, onFound](std::string) {
+            auto& [hashers, digests] = *preprocessed;
+            digests[isTest] = hashers[isTest].hexDigest();
+            if (!digests[0].has_value() || !digests[1].has_value()) {
+              return;
+            }
+            if (digests[0] != digests[1]) {
+              logger::trace("Found test code: {}", sourceFile);
+              onFound();
+            }
+          },
+          [preprocessed, isTest](const std::string_view chunk) {
+            preprocessed->hashers[isTest].update(chunk);
+            return true;
+          },
+          [preprocessed, isTest] { preprocessed->hashers[isTest] = Sha256(); }
+      );
+    };
+    submitPreprocess(0);
+    command.addArg("-DCABIN_TEST");
+    submitPreprocess(1);
+    return;
   }
-  return false;
 }
 
 void
@@ -492,17 +720,17 @@ BuildConfig::defineCompileTarget(
 
 void
 BuildConfig::defineOutputTarget(
-    const std::unordered_set<std::string>& buildObjTargets,
     const std::string& targetInputPath,
     const std::vector<std::string>& commands,
-    const std::string& targetOutputPath
+    const std::string& targetOutputPath,
+    const std::unordered_set<std::string>& extraDeps
 ) {
   // Project binary target.
-  std::unordered_set<std::string> projTargetDeps = { targetInputPath };
+  std::unordered_set<std::string> projTargetDeps = extraDeps;
+  projTargetDeps.insert(targetInputPath);
   collectBinDepObjs(
       projTargetDeps, "",
-      targets.at(targetInputPath).remDeps,  // we don't need sourceFile
-      buildObjTargets
+      targets.at(targetInputPath).remDeps  // we don't need sourceFile
   );
 
   defineTarget(targetOutputPath, commands, projTargetDeps);
@@ -523,22 +751,149 @@ mapHeaderToObj(const fs::path& headerPath, const fs::path& buildOutPath) {
   return (objBaseDir / headerPath.stem()).string() + ".o";
 }
 
-// Recursively collect depending object files for a binary target.
+// Returns the index of the object file corresponding to the header file, if
+// we are building such an object file.
+std::optional<size_t>
+BuildConfig::findObjTarget(const std::string& headerPath) const {
+  if (const auto itr = headerToObjIdx.find(headerPath);
+      itr != headerToObjIdx.end()) {
+    return itr->second;
+  }
+
+  // Only test sources can include a header that no build source includes.
+  const std::string objTarget = mapHeaderToObj(headerPath, buildOutPath);
+  if (const auto itr = objTargetIdx.find(objTarget);
+      itr != objTargetIdx.end()) {
+    return itr->second;
+  }
+  return std::nullopt;
+}
+
+// Compute which object files every object file transitively depends on.
+// An object file depends on another object file if its source includes the
+// header file corresponding to the other object file.  Every binary and test
+// target looks the closure up instead of walking the headers again, which
+// would call mapHeaderToObj (and thus fs::relative) for the same header files
+// over and over.
+void
+BuildConfig::computeObjClosure(
+    const std::unordered_set<std::string>& buildObjTargets
+) {
+  const auto start = std::chrono::steady_clock::now();
+
+  objTargets.assign(buildObjTargets.begin(), buildObjTargets.end());
+  std::ranges::sort(objTargets);
+  objTargetStems.clear();
+  objTargetIdx.clear();
+  for (size_t i = 0; i < objTargets.size(); ++i) {
+    objTargetStems.push_back(fs::path(objTargets[i]).stem().string());
+    objTargetIdx.emplace(objTargets[i], i);
+  }
+
+  // Map every header file to its object file exactly once.
+  std::vector<std::string> headers;
+  std::unordered_set<std::string> seenHeaders;
+  for (const std::string& objTarget : objTargets) {
+    for (const std::string& dep : targets.at(objTarget).remDeps) {
+      if (!HEADER_FILE_EXTS.contains(fs::path(dep).extension())) {
+        continue;
+      }
+      if (seenHeaders.insert(dep).second) {
+        headers.push_back(dep);
+      }
+    }
+  }
+  std::vector<std::optional<size_t>> headerObjs(headers.size());
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, headers.size()),
+      [&](const tbb::blocked_range<size_t>& rng) {
+        for (size_t i = rng.begin(); i != rng.end(); ++i) {
+          const std::string objTarget =
+              mapHeaderToObj(headers[i], buildOutPath);
+          if (const auto itr = objTargetIdx.find(objTarget);
+              itr != objTargetIdx.end()) {
+            headerObjs[i] = itr->second;
+          }
+        }
+      }
+  );
+  headerToObjIdx.clear();
+  for (size_t i = 0; i < headers.size(); ++i) {
+    headerToObjIdx.emplace(headers[i], headerObjs[i]);
+  }
+
+  // Direct dependencies.
+  objTargetGraph.assign(objTargets.size(), {});
+  for (size_t i = 0; i < objTargets.size(); ++i) {
+    for (const std::string& dep : targets.at(objTargets[i]).remDeps) {
+      const auto itr = headerToObjIdx.find(dep);
+      if (itr == headerToObjIdx.end() || !itr->second.has_value()) {
+        continue;
+      }
+      if (itr->second.value() != i) {
+        objTargetGraph[i].push_back(itr->second.value());
+      }
+    }
+  }
+
+  // Transitive dependencies.  The graph may contain cycles (a.cc includes
+  // b.hpp and b.cc includes a.hpp), so we simply search from every node; each
+  // row of the closure is independent of the others.
+  constexpr size_t bitsPerWord = 64;
+  const size_t numWords = (objTargets.size() + bitsPerWord - 1) / bitsPerWord;
+  objTargetClosure.assign(objTargets.size(), std::vector<uint64_t>(numWords));
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, objTargets.size()),
+      [&](const tbb::blocked_range<size_t>& rng) {
+        std::vector<size_t> stack;
+        for (size_t i = rng.begin(); i != rng.end(); ++i) {
+          std::vector<uint64_t>& reached = objTargetClosure[i];
+          reached[i / bitsPerWord] |= uint64_t{ 1 } << (i % bitsPerWord);
+          stack.push_back(i);
+          while (!stack.empty()) {
+            const size_t node = stack.back();
+            stack.pop_back();
+            for (const size_t dep : objTargetGraph[node]) {
+              const uint64_t bit = uint64_t{ 1 } << (dep % bitsPerWord);
+              if (reached[dep / bitsPerWord] & bit) {
+                continue;
+              }
+              reached[dep / bitsPerWord] |= bit;
+              stack.push_back(dep);
+            }
+          }
+        }
+      }
+  );
+
+  const auto end = std::chrono::steady_clock::now();
+  const std::chrono::duration<double, std::milli> elapsed = end - start;
+  logger::trace(
+      "Computed object closure of {} targets ({} headers) in {:.2f}ms",
+      objTargets.size(), headers.size(), elapsed.count()
+  );
+}
+
+// Collect depending object files for a binary target.
 // We know the binary depends on some header files.  We need to find
 // if there is the corresponding object file for the header file.
-// If it is, we should depend on the object file and recursively
-// collect depending object files of the object file.
+// If it is, we should depend on the object file and all object files
+// it transitively depends on, which computeObjClosure has collected.
 //
 // Header files are known via -MM outputs.  Each -MM output is run
 // for each source file.  So, we need objTargetDeps, which is the
 // depending header files for the source file.
 void
-BuildConfig::collectBinDepObjs(  // NOLINT(misc-no-recursion)
+BuildConfig::collectBinDepObjs(
     std::unordered_set<std::string>& deps,
     const std::string_view sourceFileName,
-    const std::unordered_set<std::string>& objTargetDeps,
-    const std::unordered_set<std::string>& buildObjTargets
+    const std::unordered_set<std::string>& objTargetDeps
 ) const {
+  constexpr size_t bitsPerWord = 64;
+  const size_t numWords = (objTargets.size() + bitsPerWord - 1) / bitsPerWord;
+
+  std::vector<size_t> directDeps;
+  std::vector<uint64_t> reached(numWords);
   for (const fs::path headerPath : objTargetDeps) {
     if (sourceFileName == headerPath.stem()) {
       // We shouldn't depend on the original object file (e.g.,
@@ -551,40 +906,243 @@ BuildConfig::collectBinDepObjs(  // NOLINT(misc-no-recursion)
       continue;
     }
 
-    const std::string objTarget = mapHeaderToObj(headerPath, buildOutPath);
-    if (deps.contains(objTarget)) {
-      // We already added this object file.
-      continue;
+    // If the header file does not have the corresponding object file,
+    // we should not depend on any object file.
+    if (const auto objIdx = findObjTarget(headerPath)) {
+      directDeps.push_back(objIdx.value());
+      for (size_t w = 0; w < numWords; ++w) {
+        reached[w] |= objTargetClosure[objIdx.value()][w];
+      }
     }
-    if (!buildObjTargets.contains(objTarget)) {
-      // If the header file is not included in the source file, we
-      // should not depend on the object file corresponding to the
-      // header file.
-      continue;
+  }
+
+  bool reachesOriginal = false;
+  if (!sourceFileName.empty()) {
+    for (size_t i = 0; i < objTargets.size(); ++i) {
+      if ((reached[i / bitsPerWord] >> (i % bitsPerWord)) & 1
+          && objTargetStems[i] == sourceFileName) {
+        reachesOriginal = true;
+        break;
+      }
     }
+  }
+  if (reachesOriginal) {
+    // The original object file is reachable through other object files.
+    // The precomputed closure cannot exclude it, so walk the graph again
+    // while skipping it.
+    std::ranges::fill(reached, 0);
+    std::vector<size_t> stack = directDeps;
+    for (const size_t dep : directDeps) {
+      reached[dep / bitsPerWord] |= uint64_t{ 1 } << (dep % bitsPerWord);
+    }
+    while (!stack.empty()) {
+      const size_t node = stack.back();
+      stack.pop_back();
+      for (const size_t dep : objTargetGraph[node]) {
+        const uint64_t bit = uint64_t{ 1 } << (dep % bitsPerWord);
+        if (reached[dep / bitsPerWord] & bit
+            || objTargetStems[dep] == sourceFileName) {
+          continue;
+        }
+        reached[dep / bitsPerWord] |= bit;
+        stack.push_back(dep);
+      }
+    }
+  }
 
-    deps.insert(objTarget);
-    collectBinDepObjs(
-        deps, sourceFileName,
-        targets.at(objTarget).remDeps,  // we don't need sourceFile
-        buildObjTargets
-    );
+  for (size_t i = 0; i < objTargets.size(); ++i) {
+    if ((reached[i / bitsPerWord] >> (i % bitsPerWord)) & 1) {
+      deps.insert(objTargets[i]);
+    }
   }
 }
 
+std::unordered_set<std::string>
+BuildConfig::getPackageDepArchives() const {
+  std::unordered_set<std::string> archives;
+  for (const PackageBuild& packageDep : packageDeps) {
+    archives.insert(packageDep.targets.front());
+  }
+  return archives;
+}
+
+#ifdef __APPLE__
+static constexpr std::string_view SHARED_LIB_EXT = ".dylib";
+#else
+static constexpr std::string_view SHARED_LIB_EXT = ".so";
+#endif
+
+// Libraries are identified by their paths and stamps rather than by their
+// contents, which can be large.  A `-l` library is looked up in the `-L`
+// directories first, and then in the default ones of the compiler, which
+// the toolchain cache remembers, so nothing is run here.
+std::string
+BuildConfig::hashLinkInputs() const {
+  std::vector<std::string> flags;
+  for (const std::string& lib : libs) {
+    std::ranges::copy(parseEnvFlags(lib), std::back_inserter(flags));
+  }
+  std::ranges::copy(getEnvFlags("LDFLAGS"), std::back_inserter(flags));
+
+  std::vector<fs::path> libDirs;
+  std::vector<std::string> libNames;
+  std::vector<fs::path> files;
+  for (size_t i = 0; i < flags.size(); ++i) {
+    const std::string& flag = flags[i];
+    if (flag == "-L" && i + 1 < flags.size()) {
+      libDirs.emplace_back(flags[++i]);
+    } else if (flag.starts_with("-L")) {
+      libDirs.emplace_back(flag.substr(2));
+    } else if (flag == "-l" && i + 1 < flags.size()) {
+      libNames.push_back(flags[++i]);
+    } else if (flag.starts_with("-l")) {
+      libNames.push_back(flag.substr(2));
+    } else if (!flag.starts_with("-")) {
+      files.emplace_back(flag);
+    }
+  }
+
+  const std::vector<fs::path>& defaultDirs = getToolchain().libraryDirs;
+  libDirs.insert(libDirs.end(), defaultDirs.begin(), defaultDirs.end());
+  for (const std::string& name : libNames) {
+    // -l:libfoo.so.1 names the file itself.
+    const std::vector<std::string> candidates =
+        name.starts_with(":")
+            ? std::vector<std::string>{ name.substr(1) }
+            : std::vector<std::string>{
+                  fmt::format("lib{}{}", name, SHARED_LIB_EXT),
+                  fmt::format("lib{}.a", name),
+              };
+    bool found = false;
+    for (const fs::path& dir : libDirs) {
+      for (const std::string& candidate : candidates) {
+        if (fs::exists(dir / candidate)) {
+          files.push_back(dir / candidate);
+          found = true;
+        }
+      }
+      if (found) {
+        break;
+      }
+    }
+  }
+
+  Sha256 sha;
+  for (const std::string& flag : flags) {
+    sha.update(flag);
+    sha.update(std::string_view("\0", 1));
+  }
+  for (const fs::path& file : files) {
+    sha.update(fmt::format("{} {}", file.string(), fileStamp(file)));
+    sha.update(std::string_view("\0", 1));
+  }
+  return sha.hexDigest();
+}
+
+// The sources of a revision never change, so its build only depends on how
+// we compile it and on what we compile and link it with.  Builds are shared
+// across projects when all of them are the same.
+fs::path
+BuildConfig::getSharedOutBasePath(const std::vector<std::string>& depRevisions
+) const {
+  const Toolchain& toolchain = getToolchain();
+  const Profile& profile = isDebug ? getDevProfile() : getReleaseProfile();
+  std::vector<std::string> profileFlags(
+      profile.cxxflags.begin(), profile.cxxflags.end()
+  );
+  std::ranges::sort(profileFlags);
+
+  const std::vector<std::string> inputs{
+    revision.value(),
+    std::string(modeToString(isDebug)),
+    toolchain.cxxPath.string(),
+    toolchain.compilerKind,
+    toolchain.compilerVersion,
+    toolchain.compilerBuild,
+    fmt::format(
+        "{} {} {} {}", profile.debug.value(), profile.optLevel.value(),
+        profile.lto, fmt::join(profileFlags, " ")
+    ),
+    fmt::format("{}", fmt::join(getEnvFlags("CXXFLAGS"), " ")),
+    fmt::format("{}", fmt::join(getEnvFlags("LDFLAGS"), " ")),
+    // Flags of system dependencies and the archives of path dependencies,
+    // whose directories are the hashes of their own inputs.
+    fmt::format("{}", fmt::join(includes, " ")),
+    fmt::format("{}", fmt::join(libs, " ")),
+    // Header-only git dependencies may be tracking a branch.
+    fmt::format("{}", fmt::join(depRevisions, " ")),
+  };
+  const uint64_t hash = fnv1aHash(fmt::format("{}", fmt::join(inputs, "\n")));
+  return getCacheDir() / "build" / fmt::format("{}-{:016x}", packageName, hash)
+         / modeToString(isDebug);
+}
+
 void
 BuildConfig::installDeps(const bool includeDevDeps) {
   const std::vector<DepMetadata> deps = installDependencies(includeDevDeps);
+  std::vector<std::string> depRevisions;
   for (const DepMetadata& dep : deps) {
+    if (dep.revision.has_value()) {
+      depRevisions.push_back(dep.revision.value());
+    }
     if (!dep.includes.empty()) {
       includes.push_back(replaceAll(dep.includes, "-I", "-isystem"));
     }
+    if (dep.packageRoot.has_value()) {
+      addPackageDep(dep.packageRoot.value(), dep.revision);
+    }
     if (!dep.libs.empty()) {
       libs.push_back(dep.libs);
     }
   }
   logger::trace("INCLUDES: {}", includes);
   logger::trace("LIBS: {}", libs);
+
+  if (revision.has_value()) {
+    setOutBasePath(getSharedOutBasePath(depRevisions));
+  }
+}
+
+// Configure a dependency which is a cabin package.  If it has a library, we
+// build it with its own Makefile and link against the archive.  Git
+// dependencies are built in the cache, keyed by `revision`.
+void
+BuildConfig::addPackageDep(
+    const fs::path& packageRoot, const std::optional<std::string>& revision
+) {
+  const ScopedManifest scopedManifest(packageRoot / "cabin.toml");
+  const BuildConfig depConfig =
+      ::emitMakefile(isDebug, /*includeDevDeps=*/false, revision);
+
+  const auto contains = [this](const fs::path& root) {
+    return std::ranges::any_of(packageDeps, [&root](const PackageBuild& dep) {
+      return dep.root == root;
+    });
+  };
+  // Its dependencies should be built before it.
+  for (const PackageBuild& transDep : depConfig.packageDeps) {
+    if (!contains(transDep.root)) {
+      packageDeps.push_back(transDep);
+    }
+  }
+
+  if (depConfig.hasLibTarget() && !contains(packageRoot)) {
+    PackageBuild packageDep{
+      .name = getPackageName(),
+      .version = getPackageVersion().toString(),
+      .root = packageRoot,
+      .outBasePath = depConfig.outBasePath,
+      .targets = { (depConfig.outBasePath / depConfig.getLibName()).string() },
+      .deps = {},
+    };
+    for (const PackageBuild& transDep : depConfig.packageDeps) {
+      packageDep.deps.push_back(transDep.root);
+    }
+    libs.push_back(packageDep.targets.front());
+    packageDeps.push_back(std::move(packageDep));
+  }
+  // The archive refers to the libraries of its own dependencies.
+  libs.insert(libs.end(), depConfig.libs.begin(), depConfig.libs.end());
 }
 
 void
@@ -599,8 +1157,8 @@ BuildConfig::setVariables() {
   this->defineSimpleVar("CXX", cxx);
 
   cxxflags.push_back("-std=c++" + getPackageEdition().getString());
-  if (shouldColor()) {
-    cxxflags.emplace_back("-fdiagnostics-color");
+  if (shouldColor() && getToolchain().supports(Toolchain::COLOR_FLAG)) {
+    cxxflags.emplace_back(Toolchain::COLOR_FLAG);
   }
 
   const Profile& profile = isDebug ? getDevProfile() : getReleaseProfile();
@@ -637,7 +1195,7 @@ BuildConfig::setVariables() {
   std::string commitDate;
   try {
     git2::Repository repo{};
-    repo.open(".");
+    repo.open(getProjectBasePath().string());
 
     const git2::Oid oid = repo.refNameToId("HEAD");
     commitHash = oid.toString();
@@ -677,21 +1235,22 @@ BuildConfig::setVariables() {
   );
 
   // Environment variables takes the highest precedence and will be appended at
-  // last.
+  // last.  We keep `libs` as is since packages depending on us refer to it.
+  std::vector<std::string> allLibs = libs;
   for (const std::string& flag : getEnvFlags("LDFLAGS")) {
-    libs.push_back(flag);
+    allLibs.push_back(flag);
   }
-  this->defineSimpleVar("LIBS", fmt::format("{:s}", fmt::join(libs, " ")));
+  this->defineSimpleVar("LIBS", fmt::format("{:s}", fmt::join(allLibs, " ")));
 }
 
 void
 BuildConfig::processSrc(
-    const fs::path& sourceFilePath,
-    std::unordered_set<std::string>& buildObjTargets, tbb::spin_mutex* mtx
+    const fs::path& sourceFilePath, const std::string& mmOutput,
+    std::unordered_set<std::string>& buildObjTargets
 ) {
   std::string objTarget;  // source.o
   const std::unordered_set<std::string> objTargetDeps =
-      parseMMOutput(runMM(sourceFilePath), objTarget);
+      parseMMOutput(mmOutput, objTarget);
 
   const fs::path targetBaseDir =
       fs::relative(sourceFilePath.parent_path(), getProjectBasePath() / "src");
@@ -701,53 +1260,51 @@ BuildConfig::processSrc(
   }
 
   const std::string buildObjTarget = buildTargetBaseDir / objTarget;
-
-  if (mtx) {
-    mtx->lock();
-  }
   buildObjTargets.insert(buildObjTarget);
   defineCompileTarget(buildObjTarget, sourceFilePath, objTargetDeps);
-  if (mtx) {
-    mtx->unlock();
-  }
 }
 
-std::unordered_set<std::string>
-BuildConfig::processSources(const std::vector<fs::path>& sourceFilePaths) {
-  std::unordered_set<std::string> buildObjTargets;
-
-  if (isParallel()) {
-    tbb::spin_mutex mtx;
-    tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, sourceFilePaths.size()),
-        [&](const tbb::blocked_range<size_t>& rng) {
-          for (size_t i = rng.begin(); i != rng.end(); ++i) {
-            processSrc(sourceFilePaths[i], buildObjTargets, &mtx);
-          }
+std::vector<std::pair<fs::path, std::string>>
+BuildConfig::processSources(
+    const std::vector<fs::path>& sourceFilePaths,
+    std::unordered_set<std::string>& buildObjTargets
+) {
+  // The callbacks run one at a time on this thread, so they share the
+  // targets without locking.  With --jobs 1, the commands run one at a time
+  // too, in the order they are submitted.
+  std::vector<std::pair<fs::path, std::string>> testMMOutputs;
+  ProcessPool pool(isParallel() ? getParallelism() : 1);
+  for (const fs::path& sourceFilePath : sourceFilePaths) {
+    submitCmd(
+        pool, mmCommand(sourceFilePath),
+        [this, &buildObjTargets, sourceFilePath](const std::string& mmOutput) {
+          processSrc(sourceFilePath, mmOutput, buildObjTargets);
+        }
+    );
+    findTestCode(
+        pool, sourceFilePath,
+        [this, &pool, &testMMOutputs, sourceFilePath] {
+          submitCmd(
+              pool, mmCommand(sourceFilePath, /*isTest=*/true),
+              [&testMMOutputs, sourceFilePath](std::string mmOutput) {
+                testMMOutputs.emplace_back(sourceFilePath, std::move(mmOutput));
+              }
+          );
         }
     );
-  } else {
-    for (const fs::path& sourceFilePath : sourceFilePaths) {
-      processSrc(sourceFilePath, buildObjTargets);
-    }
   }
-
-  return buildObjTargets;
+  pool.wait();
+  return testMMOutputs;
 }
 
 void
 BuildConfig::processUnittestSrc(
-    const fs::path& sourceFilePath,
-    const std::unordered_set<std::string>& buildObjTargets,
-    std::unordered_set<std::string>& testTargets, tbb::spin_mutex* mtx
+    const fs::path& sourceFilePath, const std::string& mmOutput,
+    std::unordered_set<std::string>& testTargets
 ) {
-  if (!containsTestCode(sourceFilePath)) {
-    return;
-  }
-
   std::string objTarget;  // source.o
   const std::unordered_set<std::string> objTargetDeps =
-      parseMMOutput(runMM(sourceFilePath, /*isTest=*/true), objTarget);
+      parseMMOutput(mmOutput, objTarget);
 
   const fs::path targetBaseDir = fs::relative(
       sourceFilePath.parent_path(), getProjectBasePath() / "src"_path
@@ -762,15 +1319,12 @@ BuildConfig::processUnittestSrc(
       (testTargetBaseDir / sourceFilePath.filename()).string() + ".test";
 
   // Test binary target.
-  std::unordered_set<std::string> testTargetDeps = { testObjTarget };
+  std::unordered_set<std::string> testTargetDeps = getPackageDepArchives();
+  testTargetDeps.insert(testObjTarget);
   collectBinDepObjs(
-      testTargetDeps, sourceFilePath.stem().string(), objTargetDeps,
-      buildObjTargets
+      testTargetDeps, sourceFilePath.stem().string(), objTargetDeps
   );
 
-  if (mtx) {
-    mtx->lock();
-  }
   // Test object target.
   defineCompileTarget(
       testObjTarget, sourceFilePath, objTargetDeps, /*isTest=*/true
@@ -781,9 +1335,6 @@ BuildConfig::processUnittestSrc(
   defineTarget(testTarget, commands, testTargetDeps);
 
   testTargets.insert(testTarget);
-  if (mtx) {
-    mtx->unlock();
-  }
 }
 
 static std::vector<fs::path>
@@ -798,21 +1349,34 @@ listSourceFilePaths(const fs::path& dir) {
   return sourceFilePaths;
 }
 
+static bool
+isMainSource(const fs::path& file) {
+  return file.filename().stem() == "main";
+}
+
+static bool
+isLibSource(const fs::path& file) {
+  return file.filename().stem() == "lib";
+}
+
+// Find the targets we are building: src/main.*, src/lib.*, and src/bin/*.
+// This only lists the directories, so it is cheap enough to call even when the
+// Makefile is up to date and we don't configure the build.
 void
-BuildConfig::configureBuild() {
+BuildConfig::findTargets() {
   const fs::path srcDir = getProjectBasePath() / "src";
   if (!fs::exists(srcDir)) {
     throw CabinError(srcDir, " is required but not found");
   }
 
+  mainSource.clear();
+  libSource.clear();
+  binSources.clear();
+  binNames.clear();
+  hasBinaryTarget = false;
+  hasLibraryTarget = false;
+
   // find main source file
-  const auto isMainSource = [](const fs::path& file) {
-    return file.filename().stem() == "main";
-  };
-  const auto isLibSource = [](const fs::path& file) {
-    return file.filename().stem() == "lib";
-  };
-  fs::path mainSource;
   for (const auto& entry : fs::directory_iterator(srcDir)) {
     const fs::path& path = entry.path();
     if (!SOURCE_FILE_EXTS.contains(path.extension())) {
@@ -827,8 +1391,10 @@ BuildConfig::configureBuild() {
     mainSource = path;
     hasBinaryTarget = true;
   }
+  if (hasBinaryTarget) {
+    binNames.push_back(packageName);
+  }
 
-  fs::path libSource;
   for (const auto& entry : fs::directory_iterator(srcDir)) {
     const fs::path& path = entry.path();
     if (!SOURCE_FILE_EXTS.contains(path.extension())) {
@@ -844,11 +1410,49 @@ BuildConfig::configureBuild() {
     hasLibraryTarget = true;
   }
 
-  if (!hasBinaryTarget && !hasLibraryTarget) {
+  // Every source file directly in src/bin is an additional binary.  Sources
+  // in subdirectories of src/bin are shared like any other source file.
+  const fs::path binDir = srcDir / "bin";
+  if (fs::is_directory(binDir)) {
+    for (const auto& entry : fs::directory_iterator(binDir)) {
+      const fs::path& path = entry.path();
+      if (!entry.is_regular_file()
+          || !SOURCE_FILE_EXTS.contains(path.extension())) {
+        continue;
+      }
+      binSources.push_back(path);
+    }
+    // directory_iterator has no particular order.
+    std::ranges::sort(binSources);
+
+    for (const fs::path& binSource : binSources) {
+      const std::string binName = binSource.stem().string();
+      if (binName == packageName && hasBinaryTarget) {
+        throw CabinError(fmt::format(
+            "binary `{}` in src/bin conflicts with the package binary",
+            binName
+        ));
+      }
+      if (std::ranges::find(binNames, binName) != binNames.end()) {
+        throw CabinError(
+            fmt::format("multiple sources for binary `{}` were found", binName)
+        );
+      }
+      binNames.push_back(binName);
+    }
+  }
+
+  if (binNames.empty() && !hasLibraryTarget) {
     throw CabinError(
         fmt::format("src/(main|lib){} was not found", SOURCE_FILE_EXTS)
     );
   }
+}
+
+void
+BuildConfig::configureBuild() {
+  findTargets();
+  const fs::path srcDir = getProjectBasePath() / "src";
 
   if (!fs::exists(outBasePath)) {
     fs::create_directories(outBasePath);
@@ -857,17 +1461,43 @@ BuildConfig::configureBuild() {
   setVariables();
 
   std::unordered_set<std::string> all = {};
-  if (hasBinaryTarget) {
-    all.insert(packageName);
+  for (const std::string& binName : binNames) {
+    all.insert((outBasePath / binName).string());
   }
   if (hasLibraryTarget) {
-    all.insert(libName);
+    all.insert((outBasePath / libName).string());
   }
 
   // Build rules
   setAll(all);
   addPhony("all");
 
+  // Path dependencies with a library are built by their own Makefile.  The
+  // recursive make decides whether the archive is up-to-date, so we always
+  // run it.  Their dependencies come first so that two makes never build the
+  // same package at once.
+  for (const PackageBuild& packageDep : packageDeps) {
+    std::unordered_set<std::string> remDeps = { "FORCE" };
+    for (const PackageBuild& other : packageDeps) {
+      if (std::ranges::find(packageDep.deps, other.root)
+          != packageDep.deps.end()) {
+        remDeps.insert(other.targets.front());
+      }
+    }
+    defineTarget(
+        packageDep.targets.front(),
+        { fmt::format(
+            "$(MAKE) -C {} {}", packageDep.outBasePath.string(),
+            packageDep.targets.front()
+        ) },
+        remDeps
+    );
+  }
+  if (!packageDeps.empty()) {
+    defineTarget("FORCE", {});
+    addPhony("FORCE");
+  }
+
   std::vector<fs::path> sourceFilePaths = listSourceFilePaths(srcDir);
   std::string srcs;
   for (const fs::path& sourceFilePath : sourceFilePaths) {
@@ -894,43 +1524,44 @@ BuildConfig::configureBuild() {
 
   defineSimpleVar("SRCS", srcs);
 
-  // Source Pass
-  const std::unordered_set<std::string> buildObjTargets =
-      processSources(sourceFilePaths);
+  // Source Pass, which also runs the compiler for the test pass since test
+  // objects are found only by preprocessing.
+  std::unordered_set<std::string> buildObjTargets;
+  const std::vector<std::pair<fs::path, std::string>> testMMOutputs =
+      processSources(sourceFilePaths, buildObjTargets);
+  computeObjClosure(buildObjTargets);
 
+  // Binaries are relinked when the archive of a path dependency changes.
+  // The library must not depend on the archives, or `ar` would nest them.
+  const std::unordered_set<std::string> depArchives = getPackageDepArchives();
   if (hasBinaryTarget) {
     const std::vector<std::string> commands = { LINK_BIN_COMMAND };
     defineOutputTarget(
-        buildObjTargets, buildOutPath / "main.o", commands,
-        outBasePath / packageName
+        buildOutPath / "main.o", commands, outBasePath / packageName,
+        depArchives
     );
   }
 
-  if (hasLibraryTarget) {
-    const std::vector<std::string> commands = { ARCHIVE_LIB_COMMAND };
+  // Binaries in src/bin link against the same object files as the package
+  // binary, so every shared source is compiled only once.
+  for (const fs::path& binSource : binSources) {
+    const std::string binName = binSource.stem().string();
+    const std::vector<std::string> commands = { LINK_BIN_COMMAND };
     defineOutputTarget(
-        buildObjTargets, buildOutPath / "lib.o", commands, outBasePath / libName
+        buildOutPath / "bin" / (binName + ".o"), commands,
+        outBasePath / binName, depArchives
     );
   }
 
+  if (hasLibraryTarget) {
+    const std::vector<std::string> commands = { ARCHIVE_LIB_COMMAND };
+    defineOutputTarget(buildOutPath / "lib.o", commands, outBasePath / libName);
+  }
+
   // Test Pass
   std::unordered_set<std::string> testTargets;
-  if (isParallel()) {
-    tbb::spin_mutex mtx;
-    tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, sourceFilePaths.size()),
-        [&](const tbb::blocked_range<size_t>& rng) {
-          for (size_t i = rng.begin(); i != rng.end(); ++i) {
-            processUnittestSrc(
-                sourceFilePaths[i], buildObjTargets, testTargets, &mtx
-            );
-          }
-        }
-    );
-  } else {
-    for (const fs::path& sourceFilePath : sourceFilePaths) {
-      processUnittestSrc(sourceFilePath, buildObjTargets, testTargets);
-    }
+  for (const auto& [sourceFilePath, mmOutput] : testMMOutputs) {
+    processUnittestSrc(sourceFilePath, mmOutput, testTargets);
   }
 
   // Tidy Pass
@@ -947,17 +1578,40 @@ BuildConfig::configureBuild() {
   addPhony("$(TIDY_TARGETS)");
 }
 
+// In the directory of every shared build, i.e., of a git dependency.
+static constexpr std::string_view SHARED_BUILD_LOCK = ".lock";
+
 BuildConfig
-emitMakefile(const bool isDebug, const bool includeDevDeps) {
-  BuildConfig config(getPackageName(), isDebug);
+emitMakefile(
+    const bool isDebug, const bool includeDevDeps,
+    const std::optional<std::string>& revision
+) {
+  BuildConfig config(getPackageName(), isDebug, revision);
 
   // When emitting Makefile, we also build the project.  So, we need to
   // make sure the dependencies are installed.
   config.installDeps(includeDevDeps);
 
+  // Our Makefile refers to the archives and libraries of path dependencies, so
+  // it is stale if one of theirs has been regenerated.
+  std::vector<fs::path> depMakefiles;
+  for (const PackageBuild& packageDep : config.getPackageDeps()) {
+    depMakefiles.push_back(packageDep.outBasePath / "Makefile");
+  }
+
+  // Another cabin process may be configuring the same shared build.
+  std::optional<FileLock> lock;
+  if (revision.has_value()) {
+    fs::create_directories(config.outBasePath);
+    lock.emplace(config.outBasePath / SHARED_BUILD_LOCK);
+  }
+
   const std::string makefilePath = config.outBasePath / "Makefile";
-  if (isUpToDate(makefilePath)) {
+  const fs::path planPath = config.outBasePath / BuildPlan::FILE_NAME;
+  if (isUpToDate(makefilePath, depMakefiles) && fs::exists(planPath)) {
     logger::debug("Makefile is up to date");
+    // We still need to know which targets to build.
+    config.findTargets();
     return config;
   }
   logger::debug("Makefile is NOT up to date");
@@ -965,6 +1619,8 @@ emitMakefile(const bool isDebug, const bool includeDevDeps) {
   config.configureBuild();
   std::ofstream ofs(makefilePath);
   config.emitMakefile(ofs);
+  std::ofstream planOfs(planPath);
+  config.emitBuildPlan(planOfs);
   return config;
 }
 
@@ -989,6 +1645,96 @@ emitCompdb(const bool isDebug, const bool includeDevDeps) {
   return config.outBasePath;
 }
 
+/// Configures every member of the workspace and emits a Makefile building all
+/// of them, with their path dependencies, by a single make invocation.  All
+/// packages then share one jobserver.
+///
+/// @returns the packages in the order they are built.
+std::vector<PackageBuild>
+emitWorkspaceMakefile(const bool isDebug, fs::path& makefilePath) {
+  const std::vector<fs::path>& members = getWorkspaceMembers();
+  if (members.empty()) {
+    throw CabinError("no members were found in [workspace]");
+  }
+  const fs::path outBasePath =
+      getProjectBasePath() / "cabin-out" / modeToString(isDebug);
+
+  std::vector<PackageBuild> packages;
+  const auto findPackage = [&packages](const fs::path& root) {
+    return std::ranges::find_if(packages, [&root](const PackageBuild& pkg) {
+      return pkg.root == root;
+    });
+  };
+  for (const fs::path& member : members) {
+    const ScopedManifest scopedManifest(member / "cabin.toml");
+    const BuildConfig config = emitMakefile(isDebug, /*includeDevDeps=*/false);
+
+    // Path dependencies precede their dependents.
+    for (const PackageBuild& packageDep : config.getPackageDeps()) {
+      if (findPackage(packageDep.root) == packages.end()) {
+        packages.push_back(packageDep);
+      }
+    }
+
+    PackageBuild package{
+      .name = getPackageName(),
+      .version = getPackageVersion().toString(),
+      .root = member,
+      .outBasePath = config.outBasePath,
+      .targets = {},
+      .deps = {},
+    };
+    for (const std::string& binName : config.getBinNames()) {
+      package.targets.push_back((config.outBasePath / binName).string());
+    }
+    if (config.hasLibTarget()) {
+      package.targets.push_back(
+          (config.outBasePath / config.getLibName()).string()
+      );
+    }
+    for (const PackageBuild& packageDep : config.getPackageDeps()) {
+      package.deps.push_back(packageDep.root);
+    }
+
+    // Another member may have depended on this member already.  The member
+    // builds its binaries as well as its library.
+    if (const auto itr = findPackage(member); itr != packages.end()) {
+      *itr = std::move(package);
+    } else {
+      packages.push_back(std::move(package));
+    }
+  }
+
+  std::unordered_set<std::string> all;
+  for (const PackageBuild& package : packages) {
+    all.insert(package.outBasePath.string());
+  }
+
+  fs::create_directories(outBasePath);
+  makefilePath = outBasePath / "workspace.mk";
+  std::ofstream ofs(makefilePath);
+  std::unordered_set<std::string> phony = all;
+  phony.insert("all");
+  emitTarget(ofs, ".PHONY", phony);
+  emitTarget(ofs, "all", all);
+  for (const PackageBuild& package : packages) {
+    std::unordered_set<std::string> dependsOn;
+    for (const fs::path& dep : package.deps) {
+      if (const auto itr = findPackage(dep); itr != packages.end()) {
+        dependsOn.insert(itr->outBasePath.string());
+      }
+    }
+    emitTarget(
+        ofs, package.outBasePath.string(), dependsOn, std::nullopt,
+        { fmt::format(
+            "$(MAKE) -C {} {}", package.outBasePath.string(),
+            fmt::join(package.targets, " ")
+        ) }
+    );
+  }
+  return packages;
+}
+
 std::string_view
 modeToString(const bool isDebug) {
   return isDebug ? "debug" : "release";
@@ -1017,6 +1763,103 @@ getMakeCommand() {
   return makeCommand;
 }
 
+// Returns true if `targets` in `outBasePath` are up-to-date, given that the
+// archives of path dependencies are.  The archives depend on FORCE to be
+// always remade by a recursive make, so make must assume that FORCE is old;
+// the archives themselves are compared by their timestamps as usual, as they
+// may have been rebuilt by another package or on their own.
+bool
+areTargetsUpToDate(
+    const fs::path& outBasePath, const std::vector<std::string>& targets
+) {
+  const Command checkUpToDateCmd = getMakeCommand()
+                                       .addArg("--question")
+                                       .addArg("--assume-old=FORCE")
+                                       .addArg("-C")
+                                       .addArg(outBasePath.string())
+                                       .addArgs(targets);
+  return execCmd(checkUpToDateCmd) == EXIT_SUCCESS;
+}
+
+// Returns the ones of `targets` in `plan` which are not up-to-date, like
+// areTargetsUpToDate() does but without running make for each of them: the
+// prerequisites are read from the plan, and the timestamps are compared here.
+// The archives of path dependencies are compared as they are, so they must
+// be up-to-date themselves.
+std::vector<std::string>
+findStaleTargets(
+    const BuildPlan& plan, const std::vector<std::string>& targets
+) {
+  std::unordered_map<std::string, bool> isStale;
+  const auto checkStale = [&](const auto& self, const std::string& target) {
+    if (const auto itr = isStale.find(target); itr != isStale.end()) {
+      return itr->second;
+    }
+    isStale[target] = false;  // breaks cycles, which make ignores as well
+
+    std::error_code ec;
+    const fs::path path = plan.outBasePath / target;
+    const fs::file_time_type time = fs::last_write_time(path, ec);
+    bool stale = static_cast<bool>(ec);
+    const auto planTarget = plan.targets.find(target);
+    if (planTarget != plan.targets.end()) {
+      for (const std::string& prereq : planTarget->second.deps) {
+        // A missing source file is left to make to report.
+        const fs::file_time_type prereqTime =
+            fs::last_write_time(plan.outBasePath / prereq, ec);
+        if (self(self, prereq) || ec || (!stale && prereqTime > time)) {
+          stale = true;
+        }
+      }
+    }
+    return isStale[target] = stale;
+  };
+
+  std::vector<std::string> staleTargets;
+  for (const std::string& target : targets) {
+    if (checkStale(checkStale, target)) {
+      staleTargets.push_back(target);
+    }
+  }
+  return staleTargets;
+}
+
+// Returns the packages which are not up-to-date, in the order of `packages`.
+std::vector<PackageBuild>
+findOutdatedPackages(const std::vector<PackageBuild>& packages) {
+  std::vector<PackageBuild> outdated;
+  for (const PackageBuild& package : packages) {
+    if (!areTargetsUpToDate(package.outBasePath, package.targets)) {
+      outdated.push_back(package);
+    }
+  }
+  return outdated;
+}
+
+// Locks the shared builds among `packages` until the returned locks are
+// destroyed, so that two cabin processes never run make on one of them at
+// once.  The locks are taken in the order of their paths, so two processes
+// never wait for each other.
+std::vector<FileLock>
+lockSharedBuilds(const std::vector<PackageBuild>& packages) {
+  const std::string sharedDir = (getCacheDir() / "build").string() + '/';
+  std::vector<fs::path> dirs;
+  for (const PackageBuild& package : packages) {
+    if (package.outBasePath.string().starts_with(sharedDir)) {
+      dirs.push_back(package.outBasePath);
+    }
+  }
+  std::ranges::sort(dirs);
+  const auto [first, last] = std::ranges::unique(dirs);
+  dirs.erase(first, last);
+
+  std::vector<FileLock> locks;
+  for (const fs::path& dir : dirs) {
+    locks.emplace_back(dir / SHARED_BUILD_LOCK);
+  }
+  return locks;
+}
+
 #ifdef CABIN_TEST
 
 namespace tests {
@@ -1131,6 +1974,60 @@ testDependOnUnregisteredTarget() {
   pass();
 }
 
+static void
+testObjClosure() {
+  BuildConfig config("test");
+  const fs::path srcDir = getProjectBasePath() / "src";
+  const fs::path objDir = config.outBasePath / "test.d";
+  const auto obj = [&objDir](const std::string& stem) {
+    return (objDir / (stem + ".o")).string();
+  };
+  const auto header = [&srcDir](const std::string& stem) {
+    return (srcDir / (stem + ".hpp")).string();
+  };
+  const auto source = [&srcDir](const std::string& stem) {
+    return (srcDir / (stem + ".cc")).string();
+  };
+
+  // A diamond, a -> {b, c} -> d, and a cycle, e <-> f.
+  const std::unordered_map<std::string, std::vector<std::string>> includes{
+    { "a", { "a", "b", "c" } }, { "b", { "b", "d" } }, { "c", { "c", "d" } },
+    { "d", { "d" } },           { "e", { "e", "f" } }, { "f", { "f", "e" } },
+  };
+  std::unordered_set<std::string> objs;
+  for (const auto& [stem, headers] : includes) {
+    std::unordered_set<std::string> remDeps;
+    for (const std::string& included : headers) {
+      remDeps.insert(header(included));
+    }
+    config.defineTarget(obj(stem), {}, remDeps, source(stem));
+    objs.insert(obj(stem));
+  }
+  config.computeObjClosure(objs);
+
+  using Objs = std::unordered_set<std::string>;
+  Objs deps;
+  config.collectBinDepObjs(deps, "", { header("a") });
+  assertTrue(deps == Objs{ obj("a"), obj("b"), obj("c"), obj("d") });
+
+  deps.clear();
+  config.collectBinDepObjs(deps, "", { header("e") });
+  assertTrue(deps == Objs{ obj("e"), obj("f") });
+
+  // A test of d.cc links its own test object instead of d.o, even though
+  // a.hpp leads back to d.o.
+  deps.clear();
+  config.collectBinDepObjs(deps, "d", { header("d"), header("a") });
+  assertTrue(deps == Objs{ obj("a"), obj("b"), obj("c") });
+
+  // Likewise through the cycle: f.o leads back to e.o.
+  deps.clear();
+  config.collectBinDepObjs(deps, "e", { header("e"), header("f") });
+  assertTrue(deps == Objs{ obj("f") });
+
+  pass();
+}
+
 static void
 testParseEnvFlags() {
   std::vector<std::string> argsNoEscape = parseEnvFlags(" a   b c ");
@@ -1172,6 +2069,153 @@ testParseEnvFlags() {
   pass();
 }
 
+static void
+testBuildPlan() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-plan";
+  fs::remove_all(tmp);
+  fs::create_directories(tmp);
+
+  BuildConfig config("test");
+  const std::string unittests = config.outBasePath / "unittests";
+  const std::string testObj = unittests + "/a.cc.o";
+  const std::string test = unittests + "/a.cc.test";
+  config.defineTarget(test, { "echo test" }, { testObj, "lib.o" });
+  config.defineTarget(testObj, { "echo test.o" }, { "a.hpp" }, "a.cc");
+  config.defineTarget(
+      "lib.o", { "echo lib.o" }, { "a.hpp", "FORCE" }, "lib.cc"
+  );
+  config.defineTarget("FORCE", {});
+  config.addPhony("FORCE");
+  std::ofstream planOfs(tmp / BuildPlan::FILE_NAME);
+  config.emitBuildPlan(planOfs);
+  planOfs.close();
+
+  using Kind = BuildPlan::Kind;
+  const BuildPlan plan = BuildPlan::load(tmp);
+  assertEq(plan.targets.size(), 3UL);
+  assertTrue(plan.getTargets(Kind::Test) == std::vector<std::string>{ test });
+  assertTrue(
+      plan.getTargets(Kind::TestObject) == std::vector<std::string>{ testObj }
+  );
+  assertTrue(
+      plan.getTargets(Kind::Object) == std::vector<std::string>{ "lib.o" }
+  );
+
+  // A test is attributed the source of its test object.
+  assertEq(plan.targets.at(test).sourceFile.value(), "a.cc");
+  // Phony prerequisites are left out, and the source file comes first.
+  assertTrue(
+      plan.targets.at("lib.o").deps
+      == std::vector<std::string>{ "lib.cc", "a.hpp" }
+  );
+
+  std::ofstream(tmp / BuildPlan::FILE_NAME) << R"({"version":0})";
+  assertException<CabinError>(
+      [&tmp] { BuildPlan::load(tmp); },
+      "invalid build plan " + (tmp / BuildPlan::FILE_NAME).string()
+          + ": unsupported version; run `cabin clean` and try again"
+  );
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+static void
+testFindStaleTargets() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-stale";
+  fs::remove_all(tmp);
+  fs::create_directories(tmp);
+
+  const std::unordered_set<std::string> headers{ "include/a.hpp",
+                                                  "include/common.hpp" };
+  BuildConfig config("test");
+  config.defineTarget("a.test", { "echo a" }, { "a.o", "lib.o" });
+  config.defineTarget("b.test", { "echo b" }, { "b.o", "lib.o", "dep.a" });
+  config.defineTarget("a.o", { "echo a.o" }, headers, "a.cc");
+  config.defineTarget("b.o", { "echo b.o" }, {}, "b.cc");
+  config.defineTarget("lib.o", { "echo lib.o" }, {}, "lib.cc");
+  std::ofstream planOfs(tmp / BuildPlan::FILE_NAME);
+  config.emitBuildPlan(planOfs);
+  planOfs.close();
+  const BuildPlan plan = BuildPlan::load(tmp);
+
+  const auto now = fs::file_time_type::clock::now();
+  const auto touch = [&](const std::string& name, const int age) {
+    fs::create_directories((tmp / name).parent_path());
+    std::ofstream(tmp / name).close();
+    fs::last_write_time(tmp / name, now - std::chrono::seconds(age));
+  };
+  for (const std::string& header : headers) {
+    touch(header, 100);
+  }
+  for (const char* source : { "a.cc", "b.cc", "lib.cc" }) {
+    touch(source, 100);
+  }
+  for (const char* object : { "a.o", "b.o", "lib.o" }) {
+    touch(object, 50);
+  }
+  touch("dep.a", 50);
+  touch("a.test", 10);
+  touch("b.test", 10);
+
+  const std::vector<std::string> tests{ "a.test", "b.test" };
+  assertTrue(findStaleTargets(plan, tests).empty());
+
+  touch("include/common.hpp", 0);
+  assertTrue(
+      findStaleTargets(plan, tests) == std::vector<std::string>{ "a.test" }
+  );
+
+  // The archive of a path dependency may have been rebuilt on its own.
+  touch("include/common.hpp", 100);
+  touch("dep.a", 0);
+  assertTrue(
+      findStaleTargets(plan, tests) == std::vector<std::string>{ "b.test" }
+  );
+
+  touch("lib.cc", 0);
+  assertTrue(findStaleTargets(plan, tests) == tests);
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+static void
+testHashLinkInputs() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-link-inputs";
+  fs::remove_all(tmp);
+  fs::create_directories(tmp);
+  std::ofstream(tmp / "libfoo.a").close();
+
+  const char* ldflags = std::getenv("LDFLAGS");
+  const std::string origLdflags = ldflags ? ldflags : "";
+  setenv("LDFLAGS", fmt::format("-L{} -lfoo", tmp.string()).c_str(), 1);
+
+  const BuildConfig config("test");
+  const std::string hash = config.hashLinkInputs();
+  assertEq(config.hashLinkInputs(), hash);
+
+  // An upgraded library gives the same flags a new key.
+  fs::last_write_time(
+      tmp / "libfoo.a",
+      fs::last_write_time(tmp / "libfoo.a") - std::chrono::seconds(10)
+  );
+  const std::string rebuiltHash = config.hashLinkInputs();
+  assertNe(rebuiltHash, hash);
+
+  // So does a shared library next to it, which the linker prefers.
+  std::ofstream(tmp / fmt::format("libfoo{}", SHARED_LIB_EXT)).close();
+  assertNe(config.hashLinkInputs(), rebuiltHash);
+
+  if (ldflags) {
+    setenv("LDFLAGS", origLdflags.c_str(), 1);
+  } else {
+    unsetenv("LDFLAGS");
+  }
+  fs::remove_all(tmp);
+  pass();
+}
+
 }  // namespace tests
 
 int
@@ -1182,6 +2226,10 @@ main() {
   tests::testCycleTargets();
   tests::testSimpleTargets();
   tests::testDependOnUnregisteredTarget();
+  tests::testObjClosure();
   tests::testParseEnvFlags();
+  tests::testBuildPlan();
+  tests::testFindStaleTargets();
+  tests::testHashLinkInputs();
 }
 #endif
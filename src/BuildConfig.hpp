@@ -1,16 +1,19 @@
 #pragma once
 
+#include "Algos.hpp"
 #include "Command.hpp"
 #include "Exception.hpp"
+#include "ProcessPool.hpp"
 #include "Rustify.hpp"
 
 #include <cstdint>
+#include <functional>
 #include <optional>
 #include <string>
 #include <string_view>
-#include <tbb/spin_mutex.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 // clang-format off
@@ -45,6 +48,58 @@ struct Target {
   std::unordered_set<std::string> remDeps;
 };
 
+// A cabin package built with its own Makefile as a part of another build: a
+// path dependency with a library, or a member of a workspace.
+struct PackageBuild {
+  std::string name;
+  std::string version;
+  fs::path root;
+  fs::path outBasePath;
+  // Absolute paths of the targets we build; the first one is the library
+  // archive for path dependencies.
+  std::vector<std::string> targets;
+  // Roots of the packages this package depends on.
+  std::vector<fs::path> deps;
+};
+
+// The targets of a package as BuildConfig last configured them.  It is saved
+// as build-plan.json next to the Makefile so that commands and external tools
+// need not parse the Makefile.
+struct BuildPlan {
+  // Bump when the format changes.
+  static constexpr int VERSION = 1;
+  static constexpr std::string_view FILE_NAME = "build-plan.json";
+
+  enum class Kind : uint8_t {
+    Object,
+    TestObject,
+    Library,
+    Binary,
+    Test,
+    // The library archive of a path dependency.
+    Dependency,
+    Other,
+  };
+
+  struct Target {
+    std::string name;
+    Kind kind = Kind::Other;
+    // The source file compiled by an object, or by the test object of a test.
+    std::optional<std::string> sourceFile;
+    // Every prerequisite in the Makefile, including the source file.
+    std::vector<std::string> deps;
+  };
+
+  fs::path outBasePath;
+  std::unordered_map<std::string, Target> targets;
+
+  /// Load the plan saved in `outBasePath`.
+  static BuildPlan load(const fs::path& outBasePath);
+
+  /// @returns the names of the targets of `kind`, sorted.
+  std::vector<std::string> getTargets(Kind kind) const;
+};
+
 struct BuildConfig {
   // NOLINTNEXTLINE(cppcoreguidelines-non-private-member-variables-in-classes,misc-non-private-member-variables-in-classes)
   fs::path outBasePath;
@@ -55,12 +110,23 @@ private:
   fs::path buildOutPath;
   fs::path unittestOutPath;
   bool isDebug;
+  // The commit of a git dependency, which is built in the cache shared
+  // across projects.
+  std::optional<std::string> revision;
 
   // if we are building an binary
   bool hasBinaryTarget{ false };
   // if we are building a hasLibraryTarget
   bool hasLibraryTarget{ false };
 
+  fs::path mainSource;
+  fs::path libSource;
+  // src/bin/*.cc; each of them is linked into its own binary.
+  std::vector<fs::path> binSources;
+  // Names of all binaries we are building: the package name for src/main.cc
+  // followed by the file stem of each source in src/bin.
+  std::vector<std::string> binNames;
+
   std::unordered_map<std::string, Variable> variables;
   std::unordered_map<std::string, std::vector<std::string>> varDeps;
   std::unordered_map<std::string, Target> targets;
@@ -71,14 +137,36 @@ private:
   std::string cxx;
   std::vector<std::string> cxxflags;
   std::vector<std::string> defines;
-  std::vector<std::string> includes = { "-I../../include" };
+  std::vector<std::string> includes;
   std::vector<std::string> libs;
+  // Path dependencies with a library, including transitive ones, in the order
+  // they should be built.
+  std::vector<PackageBuild> packageDeps;
+
+  // Object dependency graph shared by every binary and test target.  Built
+  // once per configure by computeObjClosure().
+  std::vector<std::string> objTargets;
+  std::vector<std::string> objTargetStems;
+  std::unordered_map<std::string, size_t> objTargetIdx;
+  std::unordered_map<std::string, std::optional<size_t>> headerToObjIdx;
+  std::vector<std::vector<size_t>> objTargetGraph;
+  // objTargetClosure[i] is a bitset of every object objTargets[i] transitively
+  // depends on, including itself.
+  std::vector<std::vector<uint64_t>> objTargetClosure;
+
+  std::optional<size_t> findObjTarget(const std::string& headerPath) const;
+  void setOutBasePath(const fs::path& path);
+  fs::path
+  getSharedOutBasePath(const std::vector<std::string>& depRevisions) const;
 
 public:
-  explicit BuildConfig(const std::string& packageName, bool isDebug = true);
+  explicit BuildConfig(
+      const std::string& packageName, bool isDebug = true,
+      const std::optional<std::string>& revision = std::nullopt
+  );
 
   bool hasBinTarget() const {
-    return hasBinaryTarget;
+    return !binNames.empty();
   }
   bool hasLibTarget() const {
     return hasLibraryTarget;
@@ -86,6 +174,16 @@ public:
   const std::string& getLibName() const {
     return this->libName;
   }
+  const std::vector<std::string>& getBinNames() const {
+    return binNames;
+  }
+  const std::vector<PackageBuild>& getPackageDeps() const {
+    return packageDeps;
+  }
+  /// Identifies what targets are linked with besides their own objects: the
+  /// archives of path dependencies, and the libraries of system dependencies
+  /// and LDFLAGS, which binaries may also load at run time.
+  std::string hashLinkInputs() const;
 
   void defineVar(
       const std::string& name, const Variable& value,
@@ -145,20 +243,30 @@ public:
   void emitVariable(std::ostream& os, const std::string& varName) const;
   void emitMakefile(std::ostream& os) const;
   void emitCompdb(std::ostream& os) const;
-  std::string runMM(const std::string& sourceFile, bool isTest = false) const;
-  bool containsTestCode(const std::string& sourceFile) const;
+  void emitBuildPlan(std::ostream& os) const;
+  Command mmCommand(const std::string& sourceFile, bool isTest = false) const;
+  // Calls `onFound` from `pool` if `sourceFile` has code only for tests.
+  void findTestCode(
+      ProcessPool& pool, const std::string& sourceFile,
+      std::function<void()> onFound
+  ) const;
 
   void installDeps(bool includeDevDeps);
+  void addPackageDep(
+      const fs::path& packageRoot, const std::optional<std::string>& revision
+  );
   void addDefine(std::string_view name, std::string_view value);
   void setVariables();
 
   void processSrc(
-      const fs::path& sourceFilePath,
-      std::unordered_set<std::string>& buildObjTargets,
-      tbb::spin_mutex* mtx = nullptr
+      const fs::path& sourceFilePath, const std::string& mmOutput,
+      std::unordered_set<std::string>& buildObjTargets
+  );
+  // Returns the -MM outputs for tests of the sources having test code.
+  std::vector<std::pair<fs::path, std::string>> processSources(
+      const std::vector<fs::path>& sourceFilePaths,
+      std::unordered_set<std::string>& buildObjTargets
   );
-  std::unordered_set<std::string>
-  processSources(const std::vector<fs::path>& sourceFilePaths);
 
   void defineCompileTarget(
       const std::string& objTarget, const std::string& sourceFile,
@@ -166,30 +274,46 @@ public:
   );
 
   void defineOutputTarget(
-      const std::unordered_set<std::string>& buildObjTargets,
       const std::string& targetInputPath,
       const std::vector<std::string>& commands,
-      const std::string& targetOutputPath
+      const std::string& targetOutputPath,
+      const std::unordered_set<std::string>& extraDeps = {}
   );
+  std::unordered_set<std::string> getPackageDepArchives() const;
 
-  void collectBinDepObjs(  // NOLINT(misc-no-recursion)
+  void computeObjClosure(const std::unordered_set<std::string>& buildObjTargets
+  );
+  void collectBinDepObjs(
       std::unordered_set<std::string>& deps, std::string_view sourceFileName,
-      const std::unordered_set<std::string>& objTargetDeps,
-      const std::unordered_set<std::string>& buildObjTargets
+      const std::unordered_set<std::string>& objTargetDeps
   ) const;
 
   void processUnittestSrc(
-      const fs::path& sourceFilePath,
-      const std::unordered_set<std::string>& buildObjTargets,
-      std::unordered_set<std::string>& testTargets,
-      tbb::spin_mutex* mtx = nullptr
+      const fs::path& sourceFilePath, const std::string& mmOutput,
+      std::unordered_set<std::string>& testTargets
   );
 
+  void findTargets();
   void configureBuild();
 };
 
-BuildConfig emitMakefile(bool isDebug, bool includeDevDeps);
+BuildConfig emitMakefile(
+    bool isDebug, bool includeDevDeps,
+    const std::optional<std::string>& revision = std::nullopt
+);
+std::vector<PackageBuild>
+emitWorkspaceMakefile(bool isDebug, fs::path& makefilePath);
 std::string emitCompdb(bool isDebug, bool includeDevDeps);
 std::string_view modeToString(bool isDebug);
 std::string_view modeToProfile(bool isDebug);
 Command getMakeCommand();
+bool areTargetsUpToDate(
+    const fs::path& outBasePath, const std::vector<std::string>& targets
+);
+std::vector<std::string> findStaleTargets(
+    const BuildPlan& plan, const std::vector<std::string>& targets
+);
+std::vector<PackageBuild>
+findOutdatedPackages(const std::vector<PackageBuild>& packages);
+std::vector<FileLock>
+lockSharedBuilds(const std::vector<PackageBuild>& packages);
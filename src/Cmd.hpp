@@ -2,6 +2,7 @@
 
 #include "Cmd/Add.hpp"
 #include "Cmd/Build.hpp"
+#include "Cmd/Cache.hpp"
 #include "Cmd/Clean.hpp"
 #include "Cmd/Fmt.hpp"
 #include "Cmd/Help.hpp"
@@ -12,4 +13,6 @@
 #include "Cmd/Search.hpp"
 #include "Cmd/Test.hpp"
 #include "Cmd/Tidy.hpp"
+#include "Cmd/Update.hpp"
+#include "Cmd/Vendor.hpp"
 #include "Cmd/Version.hpp"
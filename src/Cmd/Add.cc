@@ -2,6 +2,7 @@
 
 #include "../Logger.hpp"
 #include "../Manifest.hpp"
+#include "../RegistryIndex.hpp"
 #include "../Rustify.hpp"
 #include "Common.hpp"
 
@@ -68,7 +69,14 @@ getDependencyGitUrl(const std::string_view dep) {
   if (dep.find("://") == std::string_view::npos) {
     // Check if at least in "user/repo" format.
     if (dep.find('/') == std::string_view::npos) {
-      logger::error("Invalid dependency: {}", dep);
+      if (RegistryIndex().getPackage(std::string(dep)).has_value()) {
+        logger::error(
+            "{} is a registry package, which cabin.toml does not support yet",
+            dep
+        );
+      } else {
+        logger::error("Invalid dependency: {}", dep);
+      }
       return "";
     }
 
@@ -32,45 +32,110 @@ const Subcmd BUILD_CMD =
         .addOpt(OPT_JOBS)
         .setMainFn(buildMain);
 
+// Logs `Compiling` for every package which is not up-to-date.
+//
+// @returns true if all packages are up-to-date.
+static bool
+checkPackagesUpToDate(const std::vector<PackageBuild>& packages) {
+  const std::vector<PackageBuild> outdated = findOutdatedPackages(packages);
+  for (const PackageBuild& package : outdated) {
+    logger::info(
+        "Compiling", "{} v{} ({})", package.name, package.version,
+        package.root.string()
+    );
+  }
+  return outdated.empty();
+}
+
 int
 runBuildCommand(
     const std::string& outDir, const BuildConfig& config,
-    const std::string& targetName
+    const std::vector<std::string>& targetNames
 ) {
-  const Command makeCmd = getMakeCommand().addArg("-C").addArg(outDir).addArg(
-      (config.outBasePath / targetName).string()
-  );
-  Command checkUpToDateCmd = makeCmd;
-  checkUpToDateCmd.addArg("--question");
-
-  int exitCode = execCmd(checkUpToDateCmd);
-  if (exitCode != EXIT_SUCCESS) {
-    // If `targetName` is not up-to-date, compile it.
-    logger::info(
-        "Compiling", "{} v{} ({})", targetName, getPackageVersion().toString(),
-        getProjectBasePath().string()
-    );
-    exitCode = execCmd(makeCmd);
+  // Path dependencies are built through our Makefile, before us.
+  std::vector<PackageBuild> packages = config.getPackageDeps();
+  PackageBuild package{
+    .name = getPackageName(),
+    .version = getPackageVersion().toString(),
+    .root = getProjectBasePath(),
+    .outBasePath = config.outBasePath,
+    .targets = {},
+    .deps = {},
+  };
+  for (const std::string& targetName : targetNames) {
+    package.targets.push_back((config.outBasePath / targetName).string());
   }
-  return exitCode;
+  for (const PackageBuild& packageDep : packages) {
+    package.deps.push_back(packageDep.root);
+  }
+  packages.push_back(package);
+
+  if (checkPackagesUpToDate(packages)) {
+    return EXIT_SUCCESS;
+  }
+  const std::vector<FileLock> locks = lockSharedBuilds(packages);
+  // Compile all targets at once so that make can schedule all of them in
+  // parallel.
+  const Command makeCmd =
+      getMakeCommand().addArg("-C").addArg(outDir).addArgs(package.targets);
+  return execCmd(makeCmd);
+}
+
+// Build every member of the workspace with a single make invocation.
+static int
+buildWorkspace(
+    std::string& outDir, const bool isDebug, std::vector<std::string>* binNames
+) {
+  fs::path makefilePath;
+  const std::vector<PackageBuild> packages =
+      emitWorkspaceMakefile(isDebug, makefilePath);
+  outDir = makefilePath.parent_path();
+  if (binNames) {
+    // Only the binaries of the root package, if any, can be run from here.
+    binNames->clear();
+    const fs::path root = fs::weakly_canonical(getProjectBasePath());
+    for (const PackageBuild& package : packages) {
+      if (package.root != root) {
+        continue;
+      }
+      for (const std::string& target : package.targets) {
+        if (!target.ends_with(".a")) {
+          binNames->push_back(fs::path(target).filename().string());
+        }
+      }
+    }
+  }
+
+  if (checkPackagesUpToDate(packages)) {
+    return EXIT_SUCCESS;
+  }
+  const std::vector<FileLock> locks = lockSharedBuilds(packages);
+  const Command makeCmd =
+      getMakeCommand().addArg("-f").addArg(makefilePath.string()).addArg("all");
+  return execCmd(makeCmd);
 }
 
 int
-buildImpl(std::string& outDir, const bool isDebug) {
+buildImpl(
+    std::string& outDir, const bool isDebug, std::vector<std::string>* binNames
+) {
   const auto start = std::chrono::steady_clock::now();
 
-  const BuildConfig config = emitMakefile(isDebug, /*includeDevDeps=*/false);
-  outDir = config.outBasePath;
-
-  const std::string& packageName = getPackageName();
-  int exitCode = 0;
-  if (config.hasBinTarget()) {
-    exitCode = runBuildCommand(outDir, config, packageName);
-  }
+  int exitCode = EXIT_SUCCESS;
+  if (isWorkspace()) {
+    exitCode = buildWorkspace(outDir, isDebug, binNames);
+  } else {
+    const BuildConfig config = emitMakefile(isDebug, /*includeDevDeps=*/false);
+    outDir = config.outBasePath;
+    if (binNames) {
+      *binNames = config.getBinNames();
+    }
 
-  if (config.hasLibTarget() && exitCode == 0) {
-    const std::string& libName = config.getLibName();
-    exitCode = runBuildCommand(outDir, config, libName);
+    std::vector<std::string> targetNames = config.getBinNames();
+    if (config.hasLibTarget()) {
+      targetNames.push_back(config.getLibName());
+    }
+    exitCode = runBuildCommand(outDir, config, targetNames);
   }
 
   const auto end = std::chrono::steady_clock::now();
@@ -94,6 +159,7 @@ buildImpl(std::string& outDir, const bool isDebug) {
         modeToProfile(isDebug), fmt::join(profiles, " + "), elapsed.count()
     );
   }
+  logResourceUsage();
   return exitCode;
 }
 
@@ -3,6 +3,10 @@
 #include "../Cli.hpp"
 
 #include <string>
+#include <vector>
 
 extern const Subcmd BUILD_CMD;
-int buildImpl(std::string& outDir, bool isDebug);
+int buildImpl(
+    std::string& outDir, bool isDebug,
+    std::vector<std::string>* binNames = nullptr
+);
@@ -0,0 +1,91 @@
+#include "Cache.hpp"
+
+#include "../Cli.hpp"
+#include "../ContentStore.hpp"
+#include "../Logger.hpp"
+#include "../Manifest.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <span>
+#include <string>
+#include <string_view>
+
+static int cacheMain(std::span<const std::string_view> args);
+
+const Subcmd CACHE_CMD =  //
+    Subcmd{ "cache" }
+        .setDesc("Show how much the dependency store saves")
+        .setArg(Arg{ "stats" }.setRequired(false))
+        .setMainFn(cacheMain);
+
+static std::string
+humanSize(const uintmax_t bytes) {
+  static constexpr std::array<std::string_view, 5> UNITS = {
+    "B", "KiB", "MiB", "GiB", "TiB"
+  };
+  double size = static_cast<double>(bytes);
+  size_t unit = 0;
+  while (size >= 1024 && unit + 1 < UNITS.size()) {
+    size /= 1024;
+    ++unit;
+  }
+  if (unit == 0) {
+    return fmt::format("{} {}", bytes, UNITS[unit]);
+  }
+  return fmt::format("{:.1f} {}", size, UNITS[unit]);
+}
+
+static int
+printStats() {
+  const ContentStore& store = getContentStore();
+  const ContentStore::Stats stats = store.stats();
+
+  // What the checkouts would take without the store, and what the store
+  // holds for them, including objects no checkout links to any longer.
+  const uintmax_t saved = stats.linkedBytes > stats.storedBytes
+                              ? stats.linkedBytes - stats.storedBytes
+                              : 0;
+  const double ratio =
+      stats.linkedBytes == 0
+          ? 0.0
+          : 100.0 * static_cast<double>(saved)
+                / static_cast<double>(stats.linkedBytes);
+
+  fmt::print("store:        {}\n", store.getRoot().string());
+  fmt::print("snapshots:    {}\n", stats.numSnapshots);
+  fmt::print(
+      "objects:      {} ({} linked from checkouts)\n", stats.numObjects,
+      stats.numLinks
+  );
+  fmt::print(
+      "unreferenced: {} ({})\n", stats.numUnreferenced,
+      humanSize(stats.unreferencedBytes)
+  );
+  fmt::print("stored:       {}\n", humanSize(stats.storedBytes));
+  fmt::print("in checkouts: {}\n", humanSize(stats.linkedBytes));
+  fmt::print("saved:        {} ({:.1f}%)\n", humanSize(saved), ratio);
+  return EXIT_SUCCESS;
+}
+
+static int
+cacheMain(const std::span<const std::string_view> args) {
+  // Parse args
+  for (auto itr = args.begin(); itr != args.end(); ++itr) {
+    if (const auto res = Cli::handleGlobalOpts(itr, args.end(), "cache")) {
+      if (res.value() == Cli::CONTINUE) {
+        continue;
+      } else {
+        return res.value();
+      }
+    } else if (*itr == "stats") {
+      continue;
+    } else {
+      return CACHE_CMD.noSuchArg(*itr);
+    }
+  }
+
+  return printStats();
+}
@@ -10,9 +10,11 @@
 #include "Build.hpp"
 #include "Common.hpp"
 
+#include <algorithm>
 #include <charconv>
 #include <cstdint>
 #include <cstdlib>
+#include <fmt/ranges.h>
 #include <span>
 #include <string>
 #include <string_view>
@@ -23,10 +25,13 @@ static int runMain(std::span<const std::string_view> args);
 const Subcmd RUN_CMD =
     Subcmd{ "run" }
         .setShort("r")
-        .setDesc("Build and execute src/main.cc")
+        .setDesc("Build and execute src/main.cc or a binary in src/bin")
         .addOpt(OPT_DEBUG)
         .addOpt(OPT_RELEASE)
         .addOpt(OPT_JOBS)
+        .addOpt(Opt{ "--bin" }
+                    .setDesc("Name of the binary to run")
+                    .setPlaceholder("<NAME>"))
         .setArg(Arg{ "args" }
                     .setDesc("Arguments passed to the program")
                     .setVariadic(true)
@@ -37,6 +42,7 @@ static int
 runMain(const std::span<const std::string_view> args) {
   // Parse args
   bool isDebug = true;
+  std::string_view binName;
   auto itr = args.begin();
   for (; itr != args.end(); ++itr) {
     if (const auto res = Cli::handleGlobalOpts(itr, args.end(), "run")) {
@@ -64,6 +70,11 @@ runMain(const std::span<const std::string_view> args) {
         logger::error("invalid number of threads: {}", *itr);
         return EXIT_FAILURE;
       }
+    } else if (*itr == "--bin") {
+      if (itr + 1 == args.end()) {
+        return Subcmd::missingArgumentForOpt(*itr);
+      }
+      binName = *++itr;
     } else {
       break;
     }
@@ -75,11 +86,30 @@ runMain(const std::span<const std::string_view> args) {
   }
 
   std::string outDir;
-  if (buildImpl(outDir, isDebug) != EXIT_SUCCESS) {
+  std::vector<std::string> binNames;
+  if (buildImpl(outDir, isDebug, &binNames) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  if (binNames.empty()) {
+    logger::error("a bin target must be available for `cabin run`");
+    return EXIT_FAILURE;
+  }
+  if (binName.empty()) {
+    if (binNames.size() != 1) {
+      logger::error(
+          "`cabin run` could not determine which binary to run; use the "
+          "`--bin` option to specify a binary: {}",
+          fmt::join(binNames, ", ")
+      );
+      return EXIT_FAILURE;
+    }
+    binName = binNames.front();
+  } else if (std::ranges::find(binNames, binName) == binNames.end()) {
+    logger::error("no binary named `{}` was found", binName);
     return EXIT_FAILURE;
   }
 
-  const std::string& projectName = getPackageName();
-  const Command command(outDir + "/" + projectName, runArgs);
+  const Command command(outDir + "/" + std::string(binName), runArgs);
   return execCmd(command);
 }
@@ -2,10 +2,10 @@
 
 #include "../Cli.hpp"
 #include "../Logger.hpp"
+#include "../RegistryIndex.hpp"
 
 #include <cstddef>
 #include <cstdlib>
-#include <curl/curl.h>
 #include <iomanip>
 #include <iostream>
 #include <nlohmann/json.hpp>
@@ -35,45 +35,6 @@ struct SearchArgs {
   size_t page = 1;
 };
 
-static size_t
-writeCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
-  userp->append(static_cast<char*>(contents), size * nmemb);
-  return size * nmemb;
-}
-
-static nlohmann::json
-searchPackages(const SearchArgs& args) {
-  nlohmann::json req;
-  req["query"] =
-#include "../GraphQL/SearchPackages.gql"
-      ;
-  req["variables"]["name"] = "%" + args.name + "%";
-  req["variables"]["limit"] = args.perPage;
-  req["variables"]["offset"] = (args.page - 1) * args.perPage;
-
-  const std::string reqStr = req.dump();
-  std::string resStr;
-
-  CURL* curl = curl_easy_init();
-  if (!curl) {
-    logger::error("curl_easy_init() failed");
-    return EXIT_FAILURE;
-  }
-
-  curl_easy_setopt(curl, CURLOPT_URL, "https://cabin.hasura.app/v1/graphql");
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resStr);
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, reqStr.c_str());
-  curl_easy_perform(curl);  // TODO: Handle CURLCode
-
-  curl_easy_cleanup(curl);
-
-  const nlohmann::json res = nlohmann::json::parse(resStr);
-  const nlohmann::json packages = res["data"]["packages"];
-  return packages;
-}
-
 static void
 printTable(const nlohmann::json& packages) {
   constexpr int tableWidth = 80;
@@ -129,7 +90,9 @@ searchMain(const std::span<const std::string_view> args) {
     return EXIT_FAILURE;
   }
 
-  const nlohmann::json packages = searchPackages(searchArgs);
+  const nlohmann::json packages = RegistryIndex().search(
+      searchArgs.name, searchArgs.perPage, searchArgs.page
+  );
   if (packages.empty()) {
     logger::warn("no packages found");
     return EXIT_SUCCESS;
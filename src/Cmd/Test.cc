@@ -6,19 +6,33 @@
 #include "../Logger.hpp"
 #include "../Manifest.hpp"
 #include "../Parallelism.hpp"
+#include "../ProcessPool.hpp"
+#include "../Sha256.hpp"
 #include "Common.hpp"
 
+#include <algorithm>
+#include <array>
 #include <charconv>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <exception>
 #include <fmt/core.h>
 #include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <optional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
+extern char** environ;  // NOLINT(readability-redundant-declaration)
+
 static int testMain(std::span<const std::string_view> args);
 
 const Subcmd TEST_CMD =  //
@@ -28,12 +42,92 @@ const Subcmd TEST_CMD =  //
         .addOpt(OPT_DEBUG)
         .addOpt(OPT_RELEASE)
         .addOpt(OPT_JOBS)
+        .addOpt(Opt{ "--no-cache" }.setDesc("Run tests that passed before too"))
         .setMainFn(testMain);
 
+// Tests which passed, remembered in cabin-out/<profile> so that a test is
+// not run again until its binary, what it is linked with, or the environment
+// changes.
+static constexpr std::string_view TEST_CACHE_FILE = "test-cache.json";
+// Bump when what we cache changes.
+static constexpr int TEST_CACHE_VERSION = 2;
+
+// Maps each test target which passed to its key, i.e., what it was run with.
+using TestCache = std::unordered_map<std::string, std::string>;
+
+static TestCache
+loadTestCache(const fs::path& cachePath) {
+  std::ifstream ifs(cachePath);
+  if (!ifs) {
+    return {};
+  }
+  try {
+    const nlohmann::json json = nlohmann::json::parse(ifs);
+    if (json.at("version").get<int>() != TEST_CACHE_VERSION) {
+      return {};
+    }
+    return json.at("passed").get<TestCache>();
+  } catch (const std::exception& e) {
+    logger::debug("ignoring {}: {}", cachePath.string(), e.what());
+    return {};
+  }
+}
+
+static void
+saveTestCache(const fs::path& cachePath, const TestCache& cache) {
+  const nlohmann::json json{
+    { "version", TEST_CACHE_VERSION },
+    { "passed", cache },
+  };
+
+  // Failing to cache only costs running the tests again next time.
+  fs::path tmp = cachePath;
+  tmp += fmt::format(".{}.tmp", getpid());
+  std::ofstream(tmp) << json.dump();
+  std::error_code ec;
+  fs::rename(tmp, cachePath, ec);
+  if (ec) {
+    logger::debug("cannot cache {}: {}", cachePath.string(), ec.message());
+    fs::remove(tmp, ec);
+  }
+}
+
+// Variables the shell, terminal, or login session sets on its own, e.g.,
+// PWD after every cd, which would otherwise make cached results miss.
+static constexpr std::array<std::string_view, 17> VOLATILE_ENV_VARS{
+  "_",               "COLUMNS",        "GPG_TTY",
+  "LINES",           "OLDPWD",         "PWD",
+  "SHLVL",           "SSH_AUTH_SOCK",  "SSH_CLIENT",
+  "SSH_CONNECTION",  "SSH_TTY",        "STY",
+  "TERM_SESSION_ID", "TMUX_PANE",      "WINDOW",
+  "WINDOWID",        "XDG_SESSION_ID",
+};
+
+// Tests inherit our environment, which may change what they do.
+static std::string
+hashEnvironment() {
+  std::vector<std::string_view> vars;
+  for (char** env = environ; *env != nullptr; ++env) {
+    const std::string_view var = *env;
+    if (std::ranges::find(VOLATILE_ENV_VARS, var.substr(0, var.find('=')))
+        == VOLATILE_ENV_VARS.end()) {
+      vars.push_back(var);
+    }
+  }
+  std::ranges::sort(vars);
+  Sha256 sha;
+  for (const std::string_view var : vars) {
+    sha.update(var);
+    sha.update(std::string_view("\0", 1));
+  }
+  return sha.hexDigest();
+}
+
 static int
 testMain(const std::span<const std::string_view> args) {
   // Parse args
   bool isDebug = true;
+  bool useCache = true;
   for (auto itr = args.begin(); itr != args.end(); ++itr) {
     if (const auto res = Cli::handleGlobalOpts(itr, args.end(), "test")) {
       if (res.value() == Cli::CONTINUE) {
@@ -64,6 +158,8 @@ testMain(const std::span<const std::string_view> args) {
         logger::error("invalid number of threads: {}", *itr);
         return EXIT_FAILURE;
       }
+    } else if (*itr == "--no-cache") {
+      useCache = false;
     } else {
       return TEST_CMD.noSuchArg(*itr);
     }
@@ -73,22 +169,9 @@ testMain(const std::span<const std::string_view> args) {
 
   const BuildConfig config = emitMakefile(isDebug, /*includeDevDeps=*/true);
 
-  // Collect test targets from the generated Makefile.
-  const std::string unittestTargetPrefix =
-      (config.outBasePath / "unittests").string() + '/';
-  std::vector<std::string> unittestTargets;
-  std::ifstream infile(config.outBasePath / "Makefile");
-  std::string line;
-  while (std::getline(infile, line)) {
-    if (!line.starts_with(unittestTargetPrefix)) {
-      continue;
-    }
-    line = line.substr(0, line.find(':'));
-    if (!line.ends_with(".test")) {
-      continue;
-    }
-    unittestTargets.push_back(line);
-  }
+  const BuildPlan plan = BuildPlan::load(config.outBasePath);
+  const std::vector<std::string> unittestTargets =
+      plan.getTargets(BuildPlan::Kind::Test);
 
   if (unittestTargets.empty()) {
     logger::warn("No test targets found");
@@ -99,53 +182,122 @@ testMain(const std::span<const std::string_view> args) {
   const Command baseMakeCmd =
       getMakeCommand().addArg("-C").addArg(config.outBasePath.string());
 
-  // Find not up-to-date test targets, emit compilation status once, and
-  // compile them.
-  int exitCode{};
-  bool alreadyEmitted = false;
-  for (const std::string& target : unittestTargets) {
-    Command checkUpToDateCmd = baseMakeCmd;
-    checkUpToDateCmd.addArg("--question").addArg(target);
-    if (execCmd(checkUpToDateCmd) != EXIT_SUCCESS) {
-      // This test target is not up-to-date.
-      if (!alreadyEmitted) {
-        logger::info(
-            "Compiling", "{} v{} ({})", packageName,
-            getPackageVersion().toString(), getProjectBasePath().string()
-        );
-        alreadyEmitted = true;
-      }
+  // If a path dependency is not up-to-date, every test target is not.
+  // Otherwise, staleness is decided from the build plan here rather than by
+  // running `make --question` for each target.
+  const std::vector<std::string> staleTargets =
+      findOutdatedPackages(config.getPackageDeps()).empty()
+          ? findStaleTargets(plan, unittestTargets)
+          : unittestTargets;
 
-      Command testCmd = baseMakeCmd;
-      testCmd.addArg(target);
-      const int curExitCode = execCmd(testCmd);
-      if (curExitCode != EXIT_SUCCESS) {
-        exitCode = curExitCode;
-      }
+  // Compile all stale test targets at once so that make can schedule all of
+  // them in parallel.
+  int exitCode{};
+  if (!staleTargets.empty()) {
+    logger::info(
+        "Compiling", "{} v{} ({})", packageName,
+        getPackageVersion().toString(), getProjectBasePath().string()
+    );
+    const std::vector<FileLock> locks =
+        lockSharedBuilds(config.getPackageDeps());
+    const Command testCmd = Command(baseMakeCmd).addArgs(staleTargets);
+    exitCode = execCmd(testCmd);
+    if (exitCode != EXIT_SUCCESS) {
+      // Compilation failed; don't proceed to run tests.
+      return exitCode;
     }
   }
-  if (exitCode != EXIT_SUCCESS) {
-    // Compilation failed; don't proceed to run tests.
-    return exitCode;
+
+  // Run tests, up to --jobs at once.  The output of each test is captured
+  // and printed as a whole once it finishes, so that the outputs of
+  // concurrent tests do not interleave.
+  // A test which passed is not run again while its binary, what it is linked
+  // with, and the environment stay the same.  With --no-cache, the cache is
+  // neither read nor written.
+  struct TestResult {
+    std::string sourcePath;
+    std::string cacheKey;
+    bool cached = false;
+    int exitCode = EXIT_SUCCESS;
+    std::chrono::duration<double> elapsed{};
+  };
+  const fs::path cachePath = config.outBasePath / TEST_CACHE_FILE;
+  TestCache cache;
+  std::string inputsHash;
+  if (useCache) {
+    cache = loadTestCache(cachePath);
+    inputsHash =
+        fmt::format("{} {}", config.hashLinkInputs(), hashEnvironment());
   }
+  std::vector<TestResult> results(unittestTargets.size());
+  ProcessPool pool(getParallelism());
+  for (size_t i = 0; i < unittestTargets.size(); ++i) {
+    const std::string& target = unittestTargets[i];
+    const std::optional<std::string>& sourceFile =
+        plan.targets.at(target).sourceFile;
+    results[i].sourcePath =
+        sourceFile.has_value()
+            ? fs::relative(sourceFile.value(), getProjectBasePath()).string()
+            : target;
 
-  // Run tests.
-  for (const std::string& target : unittestTargets) {
-    // `target` always starts with "unittests/" and ends with ".test".
-    // We need to replace "unittests/" with "src/" and remove ".test" to get
-    // the source file path.
-    std::string sourcePath = target;
-    sourcePath.replace(0, unittestTargetPrefix.size(), "src/");
-    sourcePath.resize(sourcePath.size() - ".test"sv.size());
+    if (useCache) {
+      results[i].cacheKey =
+          fmt::format("{} {}", Sha256::hashFile(target), inputsHash);
+      const auto itr = cache.find(target);
+      if (itr != cache.end() && itr->second == results[i].cacheKey) {
+        results[i].cached = true;
+        continue;
+      }
+    }
 
     const std::string testBinPath =
         fs::relative(target, getProjectBasePath()).string();
-    logger::info("Running", "unittests {} ({})", sourcePath, testBinPath);
+    pool.submit(
+        Command(target),
+        [&result = results[i], testBinPath](const CommandOutput& output) {
+          logger::info(
+              "Running", "unittests {} ({})", result.sourcePath, testBinPath
+          );
+          std::cout << output.stdOut << std::flush;
+          std::cerr << output.stdErr << std::flush;
+          result.exitCode = output.exitCode;
+          result.elapsed = output.elapsed;
+        }
+    );
+  }
+  pool.wait();
 
-    const int curExitCode = execCmd(Command(target));
-    if (curExitCode != EXIT_SUCCESS) {
-      exitCode = curExitCode;
+  // Tests which failed or no longer exist are forgotten.
+  if (useCache) {
+    TestCache passed;
+    for (size_t i = 0; i < unittestTargets.size(); ++i) {
+      if (results[i].exitCode == EXIT_SUCCESS) {
+        passed.emplace(unittestTargets[i], results[i].cacheKey);
+      }
     }
+    saveTestCache(cachePath, passed);
+  }
+
+  // Summarize in the order of the tests, not of their completion.
+  size_t numFailed = 0;
+  for (const TestResult& result : results) {
+    if (result.cached) {
+      logger::info("Passed", "unittests {} (cached)", result.sourcePath);
+      continue;
+    }
+    if (result.exitCode == EXIT_SUCCESS) {
+      logger::info(
+          "Passed", "unittests {} in {:.2f}s", result.sourcePath,
+          result.elapsed.count()
+      );
+      continue;
+    }
+    ++numFailed;
+    exitCode = result.exitCode;
+    logger::error(
+        "unittests {} failed with exit code {} in {:.2f}s", result.sourcePath,
+        result.exitCode, result.elapsed.count()
+    );
   }
 
   const auto end = std::chrono::steady_clock::now();
@@ -155,6 +307,9 @@ testMain(const std::span<const std::string_view> args) {
     logger::info(
         "Finished", "{} test(s) in {}s", modeToString(isDebug), elapsed.count()
     );
+  } else {
+    logger::error("{} of {} test(s) failed", numFailed, results.size());
   }
+  logResourceUsage();
   return exitCode;
 }
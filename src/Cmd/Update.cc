@@ -0,0 +1,41 @@
+#include "Update.hpp"
+
+#include "../Cli.hpp"
+#include "../Logger.hpp"
+#include "../Manifest.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <span>
+#include <string_view>
+
+static int updateMain(std::span<const std::string_view> args);
+
+const Subcmd UPDATE_CMD =  //
+    Subcmd{ "update" }
+        .setDesc("Update dependencies listed in cabin.lock")
+        .setMainFn(updateMain);
+
+static int
+updateMain(const std::span<const std::string_view> args) {
+  // Parse args
+  for (auto itr = args.begin(); itr != args.end(); ++itr) {
+    if (const auto res = Cli::handleGlobalOpts(itr, args.end(), "update")) {
+      if (res.value() == Cli::CONTINUE) {
+        continue;
+      } else {
+        return res.value();
+      }
+    } else {
+      return UPDATE_CMD.noSuchArg(*itr);
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  updateDependencies();
+  const auto end = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = end - start;
+
+  logger::info("Finished", "updating cabin.lock in {:.2f}s", elapsed.count());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#include "Vendor.hpp"
+
+#include "../Cli.hpp"
+#include "../Logger.hpp"
+#include "../Manifest.hpp"
+#include "../Rustify/Aliases.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string_view>
+
+static int vendorMain(std::span<const std::string_view> args);
+
+const Subcmd VENDOR_CMD =  //
+    Subcmd{ "vendor" }
+        .setDesc("Copy git dependencies into the package for offline builds")
+        .setMainFn(vendorMain);
+
+static int
+vendorMain(const std::span<const std::string_view> args) {
+  // Parse args
+  for (auto itr = args.begin(); itr != args.end(); ++itr) {
+    if (const auto res = Cli::handleGlobalOpts(itr, args.end(), "vendor")) {
+      if (res.value() == Cli::CONTINUE) {
+        continue;
+      } else {
+        return res.value();
+      }
+    } else {
+      return VENDOR_CMD.noSuchArg(*itr);
+    }
+  }
+
+  const std::optional<fs::path> vendorDir = getVendorDir();
+  const auto start = std::chrono::steady_clock::now();
+  vendorDependencies(vendorDir.value_or(getProjectBasePath() / "vendor"));
+  const auto end = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = end - start;
+
+  logger::info("Finished", "vendoring in {:.2f}s", elapsed.count());
+  if (!vendorDir.has_value()) {
+    std::cout << "To build from the vendored dependencies, add this to "
+                 "cabin.toml:\n\n"
+                 "[vendor]\n"
+                 "directory = \"vendor\"\n";
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "../Cli.hpp"
+
+extern const Subcmd VENDOR_CMD;
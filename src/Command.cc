@@ -1,33 +1,105 @@
 #include "Command.hpp"
 
 #include "Exception.hpp"
-#include "Rustify.hpp"
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstddef>
-#include <cstdio>
 #include <cstdlib>
 #include <fcntl.h>
+#include <mutex>
+#include <spawn.h>
 #include <string>
+#include <string_view>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <system_error>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
+extern char** environ;  // NOLINT(readability-redundant-declaration)
+
 constexpr std::size_t BUFFER_SIZE = 128;
 
+ResourceUsage
+ResourceUsage::from(const struct rusage& usage) noexcept {
+  const auto toSec = [](const timeval& time) {
+    return static_cast<double>(time.tv_sec)
+           + static_cast<double>(time.tv_usec) / 1e6;
+  };
+#ifdef __APPLE__
+  const int64_t maxRssKiB = usage.ru_maxrss / 1024;  // in bytes
+#else
+  const int64_t maxRssKiB = usage.ru_maxrss;
+#endif
+  return { .userSec = toSec(usage.ru_utime),
+           .sysSec = toSec(usage.ru_stime),
+           .maxRssKiB = maxRssKiB,
+           .inBlocks = usage.ru_inblock,
+           .outBlocks = usage.ru_oublock };
+}
+
+ResourceUsage&
+ResourceUsage::operator+=(const ResourceUsage& other) noexcept {
+  userSec += other.userSec;
+  sysSec += other.sysSec;
+  maxRssKiB = std::max(maxRssKiB, other.maxRssKiB);
+  inBlocks += other.inBlocks;
+  outBlocks += other.outBlocks;
+  return *this;
+}
+
+static std::mutex&
+usagesMutex() {
+  static std::mutex mtx;
+  return mtx;
+}
+
+static std::vector<CommandUsage>&
+recordedUsages() {
+  static std::vector<CommandUsage> usages;
+  return usages;
+}
+
+void
+recordUsage(std::string command, const ResourceUsage& usage) {
+  const std::lock_guard<std::mutex> lock(usagesMutex());
+  recordedUsages().push_back(
+      { .command = std::move(command), .usage = usage }
+  );
+}
+
+std::vector<CommandUsage>
+getRecordedUsages() {
+  const std::lock_guard<std::mutex> lock(usagesMutex());
+  return recordedUsages();
+}
+
+int
+toExitCode(const int status) noexcept {
+  if (WIFSIGNALED(status)) {
+    // WEXITSTATUS would say 0.
+    return 128 + WTERMSIG(status);
+  }
+  return WEXITSTATUS(status);
+}
+
 int
 Child::wait() const {
   int status{};
-  if (waitpid(pid, &status, 0) == -1) {
+  struct rusage usage {};
+  if (wait4(pid, &status, 0, &usage) == -1) {
     if (stdOutFd != -1) {
       close(stdOutFd);
     }
     if (stdErrFd != -1) {
       close(stdErrFd);
     }
-    throw CabinError("waitpid() failed");
+    throw CabinError("wait4() failed");
   }
+  recordUsage(command, ResourceUsage::from(usage));
 
   if (stdOutFd != -1) {
     close(stdOutFd);
@@ -36,13 +108,24 @@ Child::wait() const {
     close(stdErrFd);
   }
 
-  const int exitCode = WEXITSTATUS(status);
+  const int exitCode = toExitCode(status);
   return exitCode;
 }
 
 CommandOutput
 Child::waitWithOutput() const {
   std::string stdOutOutput;
+  CommandOutput output =
+      waitWithOutput([&stdOutOutput](const std::string_view chunk) {
+        stdOutOutput.append(chunk);
+        return true;
+      });
+  output.stdOut = std::move(stdOutOutput);
+  return output;
+}
+
+CommandOutput
+Child::waitWithOutput(const OutputSink& onStdOut) const {
   std::string stdErrOutput;
 
   int maxfd = -1;
@@ -90,8 +173,11 @@ Child::waitWithOutput() const {
       } else if (count == 0) {
         stdOutEOF = true;
         close(stdOutFd);
-      } else {
-        stdOutOutput.append(buffer.data(), static_cast<std::size_t>(count));
+      } else if (!onStdOut(std::string_view(
+                     buffer.data(), static_cast<std::size_t>(count)
+                 ))) {
+        stdOutEOF = true;
+        close(stdOutFd);
       }
     }
 
@@ -117,109 +203,200 @@ Child::waitWithOutput() const {
   }
 
   int status{};
-  if (waitpid(pid, &status, 0) == -1) {
-    throw CabinError("waitpid() failed");
+  struct rusage usage {};
+  if (wait4(pid, &status, 0, &usage) == -1) {
+    throw CabinError("wait4() failed");
   }
+  const ResourceUsage resourceUsage = ResourceUsage::from(usage);
+  recordUsage(command, resourceUsage);
 
-  const int exitCode = WEXITSTATUS(status);
+  const int exitCode = toExitCode(status);
   return { .exitCode = exitCode,
-           .stdOut = stdOutOutput,
-           .stdErr = stdErrOutput };
+           .stdOut = "",
+           .stdErr = stdErrOutput,
+           .usage = resourceUsage,
+           .elapsed = std::chrono::steady_clock::now() - startTime };
 }
 
-Child
-Command::spawn() const {
-  std::array<int, 2> stdOutPipe{};
-  std::array<int, 2> stdErrPipe{};
-
-  // Set up stdout pipe if needed
-  if (stdOutConfig == IOConfig::Piped) {
-    if (pipe(stdOutPipe.data()) == -1) {
-      throw CabinError("pipe() failed for stdout");
-    }
+// Creates a pipe which children spawned concurrently by other threads do not
+// inherit; a stray copy of the write end would delay EOF.
+static void
+openPipe(std::array<int, 2>& fds, const std::string_view name) {
+#ifdef __linux__
+  if (pipe2(fds.data(), O_CLOEXEC) == -1) {
+    throw CabinError("pipe2() failed for ", name);
   }
-  // Set up stderr pipe if needed
-  if (stdErrConfig == IOConfig::Piped) {
-    if (pipe(stdErrPipe.data()) == -1) {
-      throw CabinError("pipe() failed for stderr");
+#else
+  // Without pipe2(), a child spawned by another thread between pipe() and
+  // fcntl() can still inherit the pipe.
+  if (pipe(fds.data()) == -1) {
+    throw CabinError("pipe() failed for ", name);
+  }
+  for (const int fd : fds) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+      close(fds[0]);
+      close(fds[1]);
+      throw CabinError("fcntl() failed for ", name);
     }
   }
+#endif
+}
 
-  const pid_t pid = fork();
-  if (pid == -1) {
-    throw CabinError("fork() failed");
-  } else if (pid == 0) {
-    // Child process
-
-    // Redirect stdout
-    if (stdOutConfig == IOConfig::Piped) {
-      close(stdOutPipe[0]);  // Child doesn't read from stdout pipe
-      dup2(stdOutPipe[1], STDOUT_FILENO);
-      close(stdOutPipe[1]);
-    } else if (stdOutConfig == IOConfig::Null) {
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
-      const int nullfd = open("/dev/null", O_WRONLY);
-      dup2(nullfd, STDOUT_FILENO);
-      close(nullfd);
-    }
+// Sets up `fd` of the child as `config` says.  `pipeFds` is the pipe for
+// IOConfig::Piped.  Returns an error number as posix_spawn_file_actions_*()
+// do.
+static int
+addRedirection(
+    posix_spawn_file_actions_t& actions, const int fd,
+    const Command::IOConfig config, const std::array<int, 2>& pipeFds
+) {
+  if (config == Command::IOConfig::Piped) {
+    // The duplicate loses FD_CLOEXEC; the original ends close on exec.
+    return posix_spawn_file_actions_adddup2(&actions, pipeFds[1], fd);
+  } else if (config == Command::IOConfig::Null) {
+    return posix_spawn_file_actions_addopen(
+        &actions, fd, "/dev/null", O_WRONLY, 0
+    );
+  }
+  return 0;
+}
 
-    // Redirect stderr
-    if (stdErrConfig == IOConfig::Piped) {
-      close(stdErrPipe[0]);  // Child doesn't read from stderr pipe
-      dup2(stdErrPipe[1], STDERR_FILENO);
-      close(stdErrPipe[1]);
-    } else if (stdErrConfig == IOConfig::Null) {
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
-      const int nullfd = open("/dev/null", O_WRONLY);
-      dup2(nullfd, STDERR_FILENO);
-      close(nullfd);
+static void
+closePipes(
+    const std::array<int, 2>& stdOutPipe, const std::array<int, 2>& stdErrPipe
+) {
+  for (const std::array<int, 2>* pipeFds : { &stdOutPipe, &stdErrPipe }) {
+    for (const int fd : *pipeFds) {
+      if (fd != -1) {
+        close(fd);
+      }
     }
+  }
+}
 
-    // Prepare arguments
-    std::vector<std::vector<char>> argBuffers;
-    std::vector<char*> args;
+// posix_spawn() creates the child without copying the page tables of this
+// process, e.g., with vfork() or clone(CLONE_VM | CLONE_VFORK), so the cost
+// of spawning does not grow with our memory usage.  Everything the child
+// needs is prepared here since it must not allocate.
+Child
+Command::spawn() const {
+  std::array<int, 2> stdOutPipe{ -1, -1 };
+  std::array<int, 2> stdErrPipe{ -1, -1 };
+  if (stdOutConfig == IOConfig::Piped) {
+    openPipe(stdOutPipe, "stdout");
+  }
+  if (stdErrConfig == IOConfig::Piped) {
+    try {
+      openPipe(stdErrPipe, "stderr");
+    } catch (...) {
+      closePipes(stdOutPipe, stdErrPipe);
+      throw;
+    }
+  }
 
-    // Add command
-    argBuffers.emplace_back(command.begin(), command.end());
-    argBuffers.back().push_back('\0');
-    args.push_back(argBuffers.back().data());
+  posix_spawn_file_actions_t actions;
+  if (const int error = posix_spawn_file_actions_init(&actions)) {
+    closePipes(stdOutPipe, stdErrPipe);
+    throw CabinError(
+        "failed to spawn `", command,
+        "`: posix_spawn_file_actions_init: ",
+        std::generic_category().message(error)
+    );
+  }
+  posix_spawnattr_t attrs;
+  if (const int error = posix_spawnattr_init(&attrs)) {
+    posix_spawn_file_actions_destroy(&actions);
+    closePipes(stdOutPipe, stdErrPipe);
+    throw CabinError(
+        "failed to spawn `", command,
+        "`: posix_spawnattr_init: ", std::generic_category().message(error)
+    );
+  }
 
-    // Add arguments
-    for (const std::string& arg : arguments) {
-      argBuffers.emplace_back(arg.begin(), arg.end());
-      argBuffers.back().push_back('\0');
-      args.push_back(argBuffers.back().data());
+  // The child is not spawned if any of these fails, as it would get wrong
+  // file descriptors or a wrong working directory.
+  int error = 0;
+  std::string_view failedCall;
+  const auto check = [&error, &failedCall](const int res, const char* call) {
+    if (error == 0 && res != 0) {
+      error = res;
+      failedCall = call;
     }
-    args.push_back(nullptr);
+  };
+  check(
+      addRedirection(actions, STDOUT_FILENO, stdOutConfig, stdOutPipe),
+      "redirecting stdout"
+  );
+  check(
+      addRedirection(actions, STDERR_FILENO, stdErrConfig, stdErrPipe),
+      "redirecting stderr"
+  );
+  if (!workingDirectory.empty()) {
+    check(
+        posix_spawn_file_actions_addchdir_np(
+            &actions, workingDirectory.c_str()
+        ),
+        "posix_spawn_file_actions_addchdir_np"
+    );
+  }
+  if (newProcessGroup) {
+    check(
+        posix_spawnattr_setflags(&attrs, POSIX_SPAWN_SETPGROUP),
+        "posix_spawnattr_setflags"
+    );
+    check(posix_spawnattr_setpgroup(&attrs, 0), "posix_spawnattr_setpgroup");
+    // Reading the terminal from a background process group would stop the
+    // child.
+    check(
+        posix_spawn_file_actions_addopen(
+            &actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0
+        ),
+        "redirecting stdin"
+    );
+  }
 
-    if (!workingDirectory.empty()) {
-      if (chdir(workingDirectory.c_str()) == -1) {
-        perror("chdir() failed");
-        _exit(1);
-      }
-    }
+  // posix_spawnp() does not modify the arguments despite its signature.
+  std::vector<char*> args;
+  args.reserve(arguments.size() + 2);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  args.push_back(const_cast<char*>(command.c_str()));
+  for (const std::string& arg : arguments) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    args.push_back(const_cast<char*>(arg.c_str()));
+  }
+  args.push_back(nullptr);
 
-    // Execute the command
-    if (execvp(command.c_str(), args.data()) == -1) {
-      perror("execvp() failed");
-      _exit(1);
-    }
-    unreachable();
-  } else {
-    // Parent process
+  pid_t pid{};
+  if (error == 0) {
+    error = posix_spawnp(
+        &pid, command.c_str(), &actions, &attrs, args.data(), environ
+    );
+  }
+  posix_spawnattr_destroy(&attrs);
+  posix_spawn_file_actions_destroy(&actions);
 
-    // Close unused pipe ends
-    if (stdOutConfig == IOConfig::Piped) {
-      close(stdOutPipe[1]);  // Parent doesn't write to stdout pipe
+  if (error != 0) {
+    closePipes(stdOutPipe, stdErrPipe);
+    if (!failedCall.empty()) {
+      throw CabinError(
+          "failed to spawn `", command, "`: ", failedCall, ": ",
+          std::generic_category().message(error)
+      );
     }
-    if (stdErrConfig == IOConfig::Piped) {
-      close(stdErrPipe[1]);  // Parent doesn't write to stderr pipe
+    throw CabinError(
+        "failed to spawn `", command,
+        "`: ", std::generic_category().message(error)
+    );
+  }
+  // Close the ends the child writes to.
+  for (const std::array<int, 2>* pipeFds : { &stdOutPipe, &stdErrPipe }) {
+    if ((*pipeFds)[1] != -1) {
+      close((*pipeFds)[1]);
     }
-
-    // Return the Child object with appropriate file descriptors
-    return { pid, stdOutConfig == IOConfig::Piped ? stdOutPipe[0] : -1,
-             stdErrConfig == IOConfig::Piped ? stdErrPipe[0] : -1 };
   }
+
+  return { pid, stdOutPipe[0], stdErrPipe[0], toString() };
 }
 
 CommandOutput
@@ -230,6 +407,14 @@ Command::output() const {
   return cmd.spawn().waitWithOutput();
 }
 
+CommandOutput
+Command::output(const OutputSink& onStdOut) const {
+  Command cmd = *this;
+  cmd.setStdOutConfig(IOConfig::Piped);
+  cmd.setStdErrConfig(IOConfig::Piped);
+  return cmd.spawn().waitWithOutput(onStdOut);
+}
+
 std::string
 Command::toString() const {
   std::string res = command;
@@ -243,3 +428,60 @@ std::ostream&
 operator<<(std::ostream& os, const Command& cmd) {
   return os << cmd.toString();
 }
+
+#ifdef CABIN_BENCH
+
+#  include <cstdio>
+
+namespace bench {
+
+// What spawn() used to do.  fork() copies the page tables of this process,
+// so it slows down as the process grows.
+static void
+forkTrue() {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    execlp("true", "true", nullptr);
+    _exit(1);
+  }
+  int status{};
+  waitpid(pid, &status, 0);
+}
+
+static void
+spawnTrue() {
+  static_cast<void>(Command("true").spawn().wait());
+}
+
+static void
+run(const std::string_view name, const size_t heapMiB, void (*spawnFn)()) {
+  constexpr int numSpawns = 200;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numSpawns; ++i) {
+    spawnFn();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf(
+      "bench %s with %zu MiB heap ... %.0f spawns/s\n",
+      std::string(name).c_str(), heapMiB, numSpawns / elapsed.count()
+  );
+}
+
+}  // namespace bench
+
+int
+main() {
+  for (const size_t heapMiB : { 0, 256, 1024 }) {
+    std::vector<char> heap(heapMiB << 20);
+    // Touch every page so that it is mapped in this process.
+    constexpr size_t pageSize = 4096;
+    for (size_t i = 0; i < heap.size(); i += pageSize) {
+      static_cast<volatile char&>(heap[i]) = 1;
+    }
+    bench::run("posix_spawn", heapMiB, bench::spawnTrue);
+    bench::run("fork", heapMiB, bench::forkTrue);
+  }
+}
+
+#endif
@@ -1,34 +1,85 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <ostream>
 #include <string>
 #include <string_view>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <utility>
 #include <vector>
 
+// What a child used, as wait4() reports it.  This includes the descendants
+// it waited for, e.g., the compilers run by make.
+struct ResourceUsage {
+  double userSec = 0;
+  double sysSec = 0;
+  // The largest resident set of any single process, not a sum.
+  int64_t maxRssKiB = 0;
+  int64_t inBlocks = 0;
+  int64_t outBlocks = 0;
+
+  static ResourceUsage from(const struct rusage& usage) noexcept;
+
+  double cpuSec() const noexcept {
+    return userSec + sysSec;
+  }
+  ResourceUsage& operator+=(const ResourceUsage& other) noexcept;
+};
+
+struct CommandUsage {
+  std::string command;
+  ResourceUsage usage;
+};
+
+/// Record the usage of a child we waited for.  Thread-safe.
+void recordUsage(std::string command, const ResourceUsage& usage);
+/// The usage of every child recorded so far.
+std::vector<CommandUsage> getRecordedUsages();
+/// The exit code of a child from its wait status, 128 plus the signal
+/// number if a signal killed it, as shells report it.
+int toExitCode(int status) noexcept;
+
 struct CommandOutput {
   int exitCode;
   std::string stdOut;
   std::string stdErr;
+  ResourceUsage usage{};
+  // From spawning to reaping.
+  std::chrono::duration<double> elapsed{};
 };
 
+// Receives the stdout of a command chunk by chunk instead of it being
+// buffered, and returns false once it needs no more.  The rest of the
+// output is then discarded by closing the pipe, which usually kills the
+// command with SIGPIPE.
+using OutputSink = std::function<bool(std::string_view)>;
+
 class Child {
 private:
   pid_t pid;
   int stdOutFd;
   int stdErrFd;
+  std::string command;
+  std::chrono::steady_clock::time_point startTime;
 
-  Child(pid_t pid, int stdOutFd, int stdErrFd) noexcept
-      : pid(pid), stdOutFd(stdOutFd), stdErrFd(stdErrFd) {}
+  Child(pid_t pid, int stdOutFd, int stdErrFd, std::string command) noexcept
+      : pid(pid), stdOutFd(stdOutFd), stdErrFd(stdErrFd),
+        command(std::move(command)),
+        startTime(std::chrono::steady_clock::now()) {}
 
   friend struct Command;
+  friend class ProcessPool;
 
 public:
   int wait() const;
   CommandOutput waitWithOutput() const;
+  /// Like waitWithOutput(), but passes stdout to `onStdOut`, leaving
+  /// CommandOutput::stdOut empty.
+  CommandOutput waitWithOutput(const OutputSink& onStdOut) const;
 };
 
 struct Command {
@@ -43,6 +94,9 @@ struct Command {
   std::filesystem::path workingDirectory;
   IOConfig stdOutConfig = IOConfig::Inherit;
   IOConfig stdErrConfig = IOConfig::Inherit;
+  // Make the child lead a process group of its own, so that it can be
+  // signaled together with its children.
+  bool newProcessGroup = false;
 
   explicit Command(std::string_view cmd) : command(cmd) {}
   Command(std::string_view cmd, std::vector<std::string> args)
@@ -69,11 +123,16 @@ struct Command {
     workingDirectory = dir;
     return *this;
   }
+  Command& setNewProcessGroup(bool enable) noexcept {
+    newProcessGroup = enable;
+    return *this;
+  }
 
   std::string toString() const;
 
   Child spawn() const;
   CommandOutput output() const;
+  CommandOutput output(const OutputSink& onStdOut) const;
 };
 
 std::ostream& operator<<(std::ostream& os, const Command& cmd);
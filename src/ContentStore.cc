@@ -0,0 +1,348 @@
+#include "ContentStore.hpp"
+
+#include "Logger.hpp"
+#include "Rustify/Aliases.hpp"
+#include "Sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fmt/core.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+ContentStore::ContentStore(fs::path root) noexcept : root(std::move(root)) {}
+
+fs::path
+ContentStore::objectPath(
+    const std::string_view hash, const bool executable
+) const {
+  // Links share permissions, so executables are stored apart.
+  std::string name(hash.substr(2));
+  if (executable) {
+    name += ".x";
+  }
+  return root / "objects" / hash.substr(0, 2) / name;
+}
+
+fs::path
+ContentStore::snapshotPath(const std::string_view key) const {
+  return root / "snapshots" / (std::string(key) + ".json");
+}
+
+static constexpr fs::perms READ_ONLY =
+    fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read;
+static constexpr fs::perms EXECUTABLE =
+    fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec;
+
+// Replaces `path` with a link to `object` unless they are on different file
+// systems.  The link is renamed over `path` so that `path` never goes
+// missing.
+static void
+replaceWithLink(const fs::path& object, const fs::path& path) {
+  fs::path tmp = path;
+  tmp += ".cabin-link";
+  std::error_code ec;
+  fs::remove(tmp, ec);
+  fs::create_hard_link(object, tmp, ec);
+  if (ec) {
+    logger::debug("cannot link {}: {}", path.string(), ec.message());
+    return;
+  }
+  fs::rename(tmp, path);
+}
+
+// Tells whether `object` still has the content named `hash`.  Read-only
+// permissions do not stop root, e.g., in a CI container, from writing
+// through a checkout into the store.  A changed object is removed so that
+// the next ingest stores it afresh.
+static bool
+isIntact(const fs::path& object, const std::string_view hash) {
+  if (Sha256::hashFile(object) == hash) {
+    return true;
+  }
+  logger::debug("{} was modified; removing it", object.string());
+  std::error_code ec;
+  fs::remove(object, ec);
+  return false;
+}
+
+// Stores `path` as `object`, linking it if possible.
+static void
+store(const fs::path& path, const fs::path& object, const bool executable) {
+  fs::create_directories(object.parent_path());
+  fs::permissions(
+      path, executable ? READ_ONLY | EXECUTABLE : READ_ONLY,
+      fs::perm_options::replace
+  );
+  std::error_code ec;
+  fs::create_hard_link(path, object, ec);
+  if (!ec || ec == std::errc::file_exists) {
+    // Either way, the object has the content now.
+    return;
+  }
+
+  // Copy under a name of our own first so that a concurrent reader never
+  // sees a partial object.
+  fs::path tmp = object;
+  tmp += fmt::format(
+      ".{}.{:x}.tmp", getpid(),
+      std::hash<std::thread::id>{}(std::this_thread::get_id())
+  );
+  fs::copy_file(path, tmp, fs::copy_options::overwrite_existing);
+  fs::rename(tmp, object);
+}
+
+void
+ContentStore::ingest(const fs::path& dir, const std::string_view key) const {
+  nlohmann::json files = nlohmann::json::array();
+  for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+    const std::string relPath =
+        entry.path().lexically_relative(dir).generic_string();
+    if (entry.is_symlink()) {
+      files.push_back({ { "path", relPath },
+                        { "symlink", fs::read_symlink(entry).string() } });
+      continue;
+    }
+    if (!entry.is_regular_file()) {
+      continue;  // directories are recreated from the paths of files
+    }
+
+    const bool executable =
+        (entry.status().permissions() & fs::perms::owner_exec)
+        != fs::perms::none;
+    const std::string hash = Sha256::hashFile(entry.path());
+    const fs::path object = objectPath(hash, executable);
+    std::error_code ec;
+    if (!fs::exists(object, ec) || !isIntact(object, hash)) {
+      store(entry.path(), object, executable);
+    }
+    if (!fs::equivalent(object, entry.path(), ec)) {
+      replaceWithLink(object, entry.path());
+    }
+    files.push_back({ { "path", relPath },
+                      { "sha256", hash },
+                      { "executable", executable } });
+  }
+
+  const fs::path snapshot = snapshotPath(key);
+  fs::create_directories(snapshot.parent_path());
+  // Each process has a temporary file of its own, so that two of them
+  // ingesting the same commit never interleave their writes.
+  fs::path tmp = snapshot;
+  tmp += fmt::format(".{}.tmp", getpid());
+  std::ofstream(tmp) << nlohmann::json{ { "files", files } }.dump();
+  std::error_code ec;
+  fs::rename(tmp, snapshot, ec);
+  if (ec) {
+    logger::debug("failed to write {}: {}", snapshot.string(), ec.message());
+    fs::remove(tmp, ec);
+  }
+}
+
+bool
+ContentStore::materialize(
+    const std::string_view key, const fs::path& dir
+) const {
+  std::ifstream ifs(snapshotPath(key));
+  if (!ifs) {
+    return false;
+  }
+  try {
+    const nlohmann::json snapshot = nlohmann::json::parse(ifs);
+    for (const nlohmann::json& file : snapshot.at("files")) {
+      const fs::path path = dir / file.at("path").get<std::string>();
+      fs::create_directories(path.parent_path());
+      if (file.contains("symlink")) {
+        fs::create_symlink(file["symlink"].get<std::string>(), path);
+        continue;
+      }
+
+      const std::string hash = file.at("sha256").get<std::string>();
+      const fs::path object =
+          objectPath(hash, file.at("executable").get<bool>());
+      if (!fs::exists(object)) {
+        logger::debug("{} is missing from the store", object.string());
+        return false;
+      }
+      if (!isIntact(object, hash)) {
+        return false;
+      }
+      std::error_code ec;
+      fs::create_hard_link(object, path, ec);
+      if (ec) {
+        fs::copy_file(object, path);
+      }
+    }
+  } catch (const std::exception& e) {
+    logger::debug("cannot materialize {}: {}", key, e.what());
+    return false;
+  }
+  return true;
+}
+
+ContentStore::Stats
+ContentStore::stats() const {
+  Stats stats;
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(root / "snapshots", ec)) {
+    if (entry.path().extension() == ".json") {
+      ++stats.numSnapshots;
+    }
+  }
+  for (const auto& entry :
+       fs::recursive_directory_iterator(root / "objects", ec)) {
+    if (!entry.is_regular_file() || entry.path().extension() == ".tmp") {
+      continue;
+    }
+    const uintmax_t size = entry.file_size();
+    const uintmax_t numLinks = entry.hard_link_count() - 1;
+    ++stats.numObjects;
+    stats.storedBytes += size;
+    if (numLinks == 0) {
+      ++stats.numUnreferenced;
+      stats.unreferencedBytes += size;
+    }
+    stats.numLinks += numLinks;
+    stats.linkedBytes += size * numLinks;
+  }
+  return stats;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+static void
+writeFile(const fs::path& path, const std::string_view content) {
+  fs::create_directories(path.parent_path());
+  std::ofstream(path) << content;
+}
+
+static std::string
+readFile(const fs::path& path) {
+  std::ifstream ifs(path);
+  return { std::istreambuf_iterator<char>(ifs),
+           std::istreambuf_iterator<char>() };
+}
+
+static bool
+isExecutable(const fs::path& path) {
+  return (fs::status(path).permissions() & fs::perms::owner_exec)
+         != fs::perms::none;
+}
+
+static void
+testIngestAndMaterialize() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-store";
+  fs::remove_all(tmp);
+  const ContentStore store(tmp / "store");
+
+  const fs::path first = tmp / "first";
+  writeFile(first / "configure", "#!/bin/sh\n");
+  fs::permissions(first / "configure", EXECUTABLE, fs::perm_options::add);
+  writeFile(first / "include" / "a.hpp", "#pragma once\n");
+  writeFile(first / "include" / "b.hpp", "#pragma once\n");
+  fs::create_symlink("include/a.hpp", first / "a.hpp");
+  store.ingest(first, "rev1");
+
+  // Identical files share one object.
+  assertTrue(
+      fs::equivalent(first / "include" / "a.hpp", first / "include" / "b.hpp")
+  );
+  assertTrue(
+      fs::status(first / "include" / "a.hpp").permissions() == READ_ONLY
+  );
+  assertTrue(isExecutable(first / "configure"));
+
+  const fs::path second = tmp / "second";
+  assertTrue(store.materialize("rev1", second));
+  assertEq(readFile(second / "include" / "b.hpp"), "#pragma once\n");
+  assertTrue(
+      fs::equivalent(first / "include" / "a.hpp", second / "include" / "b.hpp")
+  );
+  assertTrue(isExecutable(second / "configure"));
+  assertEq(fs::read_symlink(second / "a.hpp").string(), "include/a.hpp");
+
+  ContentStore::Stats stats = store.stats();
+  assertEq(stats.numSnapshots, 1UL);
+  assertEq(stats.numObjects, 2UL);
+  assertEq(stats.storedBytes, 23UL);
+  assertEq(stats.numLinks, 6UL);
+  assertEq(stats.linkedBytes, 72UL);
+  assertEq(stats.numUnreferenced, 0UL);
+
+  fs::remove_all(first);
+  fs::remove_all(second);
+  stats = store.stats();
+  assertEq(stats.numUnreferenced, 2UL);
+  assertEq(stats.unreferencedBytes, 23UL);
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+static void
+testMissing() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-store";
+  fs::remove_all(tmp);
+  const ContentStore store(tmp / "store");
+
+  assertFalse(store.materialize("unknown", tmp / "unknown"));
+
+  writeFile(tmp / "first" / "file", "content");
+  store.ingest(tmp / "first", "rev1");
+  fs::remove_all(tmp / "store" / "objects");
+  assertFalse(store.materialize("rev1", tmp / "second"));
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+static void
+testModified() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-store";
+  fs::remove_all(tmp);
+  const ContentStore store(tmp / "store");
+
+  // As root would, write through a checkout into the store.
+  writeFile(tmp / "first" / "file", "content");
+  store.ingest(tmp / "first", "rev1");
+  fs::permissions(
+      tmp / "first" / "file", fs::perms::owner_write, fs::perm_options::add
+  );
+  writeFile(tmp / "first" / "file", "modified");
+  assertFalse(store.materialize("rev1", tmp / "second"));
+
+  // Checking the commit out again stores the file afresh.
+  fs::remove_all(tmp / "second");
+  writeFile(tmp / "second" / "file", "content");
+  store.ingest(tmp / "second", "rev1");
+  assertTrue(store.materialize("rev1", tmp / "third"));
+  assertEq(readFile(tmp / "third" / "file"), "content");
+  assertEq(readFile(tmp / "first" / "file"), "modified");
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testIngestAndMaterialize();
+  tests::testMissing();
+  tests::testModified();
+}
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Files of dependency checkouts, stored once per content under `root` and
+// hardlinked into every checkout having them.  Each checkout is recorded as
+// a snapshot, so checking out the same commit again only creates links.
+//
+// Stored files are read-only since writing through one link would change
+// every checkout sharing it.  That does not stop root, so files are hashed
+// again before they are linked, and a modified one is dropped from the
+// store.
+class ContentStore {
+public:
+  explicit ContentStore(fs::path root) noexcept;
+
+  struct Stats {
+    size_t numSnapshots = 0;
+    size_t numObjects = 0;
+    uintmax_t storedBytes = 0;
+    // Objects no checkout links to any longer.
+    size_t numUnreferenced = 0;
+    uintmax_t unreferencedBytes = 0;
+    // Files in checkouts linked to objects, and what they would take
+    // without the store.
+    size_t numLinks = 0;
+    uintmax_t linkedBytes = 0;
+  };
+
+  const fs::path& getRoot() const noexcept {
+    return root;
+  }
+
+  /// Move the regular files under `dir` into the store, leaving links in
+  /// their place, and record `dir` as snapshot `key`, e.g., a commit hash.
+  void ingest(const fs::path& dir, std::string_view key) const;
+  /// Recreate snapshot `key` at `dir`.  Returns false if the store lacks the
+  /// snapshot or any intact file of it, leaving `dir` partially populated.
+  bool materialize(std::string_view key, const fs::path& dir) const;
+  Stats stats() const;
+
+private:
+  fs::path root;
+
+  fs::path objectPath(std::string_view hash, bool executable) const;
+  fs::path snapshotPath(std::string_view key) const;
+};
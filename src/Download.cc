@@ -0,0 +1,538 @@
+#include "Download.hpp"
+
+#include "Algos.hpp"
+#include "Exception.hpp"
+#include "Logger.hpp"
+#include "Rustify/Aliases.hpp"
+#include "Sha256.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <curl/curl.h>
+#include <deque>
+#include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+Downloader::Downloader(const size_t maxTransfers)
+    : multi(curl_multi_init()),
+      maxTransfers(std::max<size_t>(maxTransfers, 1)) {
+  if (!multi) {
+    throw CabinError("curl_multi_init() failed");
+  }
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  // Servers without HTTP/2 get a connection per transfer, so this also
+  // bounds the number of connections.
+  curl_multi_setopt(
+      multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+      static_cast<long>(this->maxTransfers)
+  );
+}
+
+Downloader::~Downloader() {
+  curl_multi_cleanup(multi);
+}
+
+namespace {
+
+struct Transfer {
+  const Download* download;
+  fs::path partFile;
+  std::ofstream ofs;
+  Sha256 hasher;
+  curl_off_t resumeFrom = 0;
+  std::array<char, CURL_ERROR_SIZE> errorBuf{};
+
+  struct EasyDeleter {
+    void operator()(CURL* curl) const noexcept {
+      curl_easy_cleanup(curl);
+    }
+  };
+  std::unique_ptr<CURL, EasyDeleter> easy;
+};
+
+}  // namespace
+
+static constexpr long HTTP_RANGE_NOT_SATISFIABLE = 416;
+static constexpr int POLL_TIMEOUT_MS = 1000;
+
+static size_t
+writeCallback(char* ptr, size_t size, size_t nmemb, Transfer* transfer) {
+  const std::string_view chunk(ptr, size * nmemb);
+  transfer->ofs.write(
+      chunk.data(), static_cast<std::streamsize>(chunk.size())
+  );
+  if (!transfer->ofs) {
+    return 0;  // fails the transfer with CURLE_WRITE_ERROR
+  }
+  transfer->hasher.update(chunk);
+  return chunk.size();
+}
+
+// Prepares the transfer of `download`, continuing the .part file if
+// `resume` and it exists.
+static std::unique_ptr<Transfer>
+prepare(const Download& download, const bool resume) {
+  auto transfer = std::make_unique<Transfer>();
+  transfer->download = &download;
+  transfer->partFile = download.dest;
+  transfer->partFile += ".part";
+  fs::create_directories(download.dest.parent_path());
+
+  std::error_code ec;
+  const uintmax_t partSize = fs::file_size(transfer->partFile, ec);
+  if (resume && !ec && partSize > 0) {
+    // Hash what we already have so that the whole file is verified.
+    std::ifstream ifs(transfer->partFile, std::ios::binary);
+    std::array<char, 65536> chunk{};
+    while (ifs.read(chunk.data(), chunk.size()) || ifs.gcount() > 0) {
+      transfer->hasher.update({ chunk.data(),
+                                static_cast<size_t>(ifs.gcount()) });
+    }
+    transfer->resumeFrom = static_cast<curl_off_t>(partSize);
+    transfer->ofs.open(transfer->partFile, std::ios::binary | std::ios::app);
+    logger::debug(
+        "resuming {} from byte {}", download.url, transfer->resumeFrom
+    );
+  } else {
+    transfer->ofs.open(
+        transfer->partFile, std::ios::binary | std::ios::trunc
+    );
+  }
+  if (!transfer->ofs) {
+    throw CabinError("failed to open ", transfer->partFile.string());
+  }
+
+  transfer->easy.reset(curl_easy_init());
+  CURL* curl = transfer->easy.get();
+  if (!curl) {
+    throw CabinError("curl_easy_init() failed");
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, download.url.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // Wait for a connection to multiplex on rather than opening another.
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, transfer->resumeFrom);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->errorBuf.data());
+  return transfer;
+}
+
+// Hex digests may come in either case.
+static bool
+isSameDigest(const std::string_view lhs, const std::string_view rhs) {
+  return toUpper(lhs) == toUpper(rhs);
+}
+
+// Records the outcome of `transfer`, or queues it again without resuming if
+// the server cannot continue the .part file.
+static void
+finish(
+    std::unique_ptr<Transfer> transfer, const CURLcode code,
+    std::deque<std::pair<const Download*, bool>>& pending,
+    std::vector<std::string>& errors
+) {
+  const Download& download = *transfer->download;
+  transfer->ofs.close();
+  long status = 0;
+  curl_easy_getinfo(transfer->easy.get(), CURLINFO_RESPONSE_CODE, &status);
+
+  std::error_code ec;
+  if (transfer->resumeFrom > 0
+      && (code == CURLE_RANGE_ERROR || status == HTTP_RANGE_NOT_SATISFIABLE)) {
+    logger::debug("cannot resume {}; restarting", download.url);
+    fs::remove(transfer->partFile, ec);
+    pending.emplace_front(&download, false);
+    return;
+  }
+  if (code != CURLE_OK || !transfer->ofs) {
+    // Keep what we got to resume next time.
+    if (fs::file_size(transfer->partFile, ec) == 0) {
+      fs::remove(transfer->partFile, ec);
+    }
+    errors.push_back(fmt::format(
+        "{}: {}", download.url,
+        transfer->errorBuf[0] != '\0' ? transfer->errorBuf.data()
+                                      : curl_easy_strerror(code)
+    ));
+    return;
+  }
+
+  const std::string digest = transfer->hasher.hexDigest();
+  if (!download.sha256.empty() && !isSameDigest(digest, download.sha256)) {
+    fs::remove(transfer->partFile, ec);
+    errors.push_back(fmt::format(
+        "{}: checksum mismatch: expected {}, got {}", download.url,
+        download.sha256, digest
+    ));
+    return;
+  }
+  fs::rename(transfer->partFile, download.dest, ec);
+  if (ec) {
+    errors.push_back(fmt::format(
+        "{}: failed to write {}: {}", download.url, download.dest.string(),
+        ec.message()
+    ));
+    return;
+  }
+  logger::debug("downloaded {}", download.url);
+}
+
+void
+Downloader::download(const std::span<const Download> downloads) {
+  // Downloads to start, with whether to resume their .part files.
+  std::deque<std::pair<const Download*, bool>> pending;
+  for (const Download& download : downloads) {
+    std::error_code ec;
+    if (!download.sha256.empty() && fs::exists(download.dest, ec)
+        && isSameDigest(Sha256::hashFile(download.dest), download.sha256)) {
+      logger::debug("{} is up to date", download.dest.string());
+      continue;
+    }
+    pending.emplace_back(&download, true);
+  }
+
+  std::unordered_map<CURL*, std::unique_ptr<Transfer>> active;
+  std::vector<std::string> errors;
+  try {
+    while (!pending.empty() || !active.empty()) {
+      while (active.size() < maxTransfers && !pending.empty()) {
+        const auto [download, resume] = pending.front();
+        pending.pop_front();
+        std::unique_ptr<Transfer> transfer = prepare(*download, resume);
+        CURL* easy = transfer->easy.get();
+        curl_multi_add_handle(multi, easy);
+        active.emplace(easy, std::move(transfer));
+      }
+
+      int running = 0;
+      if (const CURLMcode code = curl_multi_perform(multi, &running);
+          code != CURLM_OK) {
+        throw CabinError(
+            "curl_multi_perform() failed: ", curl_multi_strerror(code)
+        );
+      }
+
+      int queued = 0;
+      while (const CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+        if (msg->msg != CURLMSG_DONE) {
+          continue;
+        }
+        CURL* easy = msg->easy_handle;
+        const CURLcode code = msg->data.result;
+        curl_multi_remove_handle(multi, easy);
+        const auto itr = active.find(easy);
+        std::unique_ptr<Transfer> transfer = std::move(itr->second);
+        active.erase(itr);
+        finish(std::move(transfer), code, pending, errors);
+      }
+
+      if (running > 0) {
+        curl_multi_poll(multi, nullptr, 0, POLL_TIMEOUT_MS, nullptr);
+      }
+    }
+  } catch (...) {
+    for (const auto& [easy, transfer] : active) {
+      curl_multi_remove_handle(multi, easy);
+    }
+    throw;
+  }
+
+  if (!errors.empty()) {
+    std::string msg = "failed to download:";
+    for (const std::string& error : errors) {
+      msg += "\n  " + error;
+    }
+    throw CabinError(msg);
+  }
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+#  include <arpa/inet.h>
+#  include <fmt/ranges.h>
+#  include <iterator>
+#  include <map>
+#  include <mutex>
+#  include <netinet/in.h>
+#  include <sys/socket.h>
+#  include <thread>
+#  include <unistd.h>
+
+namespace tests {
+
+// A minimal HTTP/1.1 server on localhost serving `files`, one connection at
+// a time.  Paths under /no-range/ ignore range requests like some servers.
+using Files = std::map<std::string, std::string>;
+
+class TestServer {
+public:
+  explicit TestServer(Files files)
+      : files(std::move(files)), listenFd(socket(AF_INET, SOCK_STREAM, 0)) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), addrLen) != 0
+        || listen(listenFd, SOMAXCONN) != 0
+        || getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen)
+               != 0) {
+      throw CabinError("failed to start the test server");
+    }
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+    port = ntohs(addr.sin_port);
+    thread = std::thread([this] { serve(); });
+  }
+  ~TestServer() {
+    shutdown(listenFd, SHUT_RDWR);
+    thread.join();
+    close(listenFd);
+  }
+  TestServer(const TestServer&) = delete;
+  TestServer& operator=(const TestServer&) = delete;
+  TestServer(TestServer&&) = delete;
+  TestServer& operator=(TestServer&&) = delete;
+
+  std::string url(const std::string_view path) const {
+    return fmt::format("http://127.0.0.1:{}{}", port, path);
+  }
+  // Each request as "<path> <range>", e.g., "/foo bytes=5-".
+  std::vector<std::string> getRequests() {
+    const std::lock_guard lock(mtx);
+    return requests;
+  }
+
+private:
+  Files files;
+  int listenFd;
+  uint16_t port = 0;
+  std::thread thread;
+  std::mutex mtx;
+  std::vector<std::string> requests;
+
+  void serve() {
+    for (int conn; (conn = accept(listenFd, nullptr, nullptr)) >= 0;) {
+      respond(conn);
+      close(conn);
+    }
+  }
+
+  void respond(const int conn) {
+    std::string req;
+    std::array<char, 4096> buf{};
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t len = read(conn, buf.data(), buf.size());
+      if (len <= 0) {
+        return;
+      }
+      req.append(buf.data(), static_cast<size_t>(len));
+    }
+    const size_t pathStart = req.find(' ') + 1;
+    const std::string path =
+        req.substr(pathStart, req.find(' ', pathStart) - pathStart);
+    size_t offset = 0;
+    std::string range;
+    if (const size_t pos = req.find("\r\nRange: "); pos != std::string::npos) {
+      range = req.substr(pos + 9, req.find('\r', pos + 2) - pos - 9);
+      if (!path.starts_with("/no-range/")) {
+        offset = std::stoul(range.substr(range.find('=') + 1));
+      }
+    }
+    {
+      const std::lock_guard lock(mtx);
+      requests.push_back(fmt::format("{} {}", path, range));
+    }
+
+    std::string res;
+    const auto file = files.find(path);
+    if (file == files.end()) {
+      res = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n";
+    } else if (offset >= file->second.size() && offset > 0) {
+      res = fmt::format(
+          "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */{}\r\n"
+          "Content-Length: 0\r\n",
+          file->second.size()
+      );
+    } else if (offset > 0) {
+      res = fmt::format(
+          "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes {}-{}/{}\r\n"
+          "Content-Length: {}\r\n",
+          offset, file->second.size() - 1, file->second.size(),
+          file->second.size() - offset
+      );
+    } else {
+      res = fmt::format(
+          "HTTP/1.1 200 OK\r\nContent-Length: {}\r\n", file->second.size()
+      );
+    }
+    res += "Connection: close\r\n\r\n";
+    if (file != files.end()) {
+      res += file->second.substr(offset);
+    }
+    for (size_t sent = 0; sent < res.size();) {
+      const ssize_t len = write(conn, res.data() + sent, res.size() - sent);
+      if (len <= 0) {
+        return;
+      }
+      sent += static_cast<size_t>(len);
+    }
+  }
+};
+
+static std::string
+readFile(const fs::path& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  return { std::istreambuf_iterator<char>(ifs),
+           std::istreambuf_iterator<char>() };
+}
+
+static fs::path
+testDir() {
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-download";
+  fs::remove_all(dir);
+  return dir;
+}
+
+static std::string
+largeContent() {
+  std::string content;
+  for (size_t i = 0; content.size() < 200000; ++i) {
+    content += fmt::format("line {}\n", i);
+  }
+  return content;
+}
+
+static void
+testDownload() {
+  const std::string large = largeContent();
+  TestServer server(Files{ { "/small", "hello" }, { "/large", large } });
+  const fs::path dir = testDir();
+
+  std::vector<Download> downloads;
+  for (size_t i = 0; i < 8; ++i) {
+    downloads.push_back({ .url = server.url("/large"),
+                          .dest = dir / fmt::format("large{}", i),
+                          .sha256 = Sha256::hash(large) });
+  }
+  downloads.push_back({ .url = server.url("/small"),
+                        .dest = dir / "sub" / "small",
+                        .sha256 = "" });
+  Downloader(4).download(downloads);
+  assertEq(readFile(dir / "large0"), large);
+  assertEq(readFile(dir / "large7"), large);
+  assertEq(readFile(dir / "sub" / "small"), "hello");
+  assertFalse(fs::exists(dir / "large0.part"));
+  assertEq(server.getRequests().size(), 9UL);
+
+  // Verified files are kept; those without a checksum are downloaded again.
+  Downloader().download(downloads);
+  assertEq(server.getRequests().size(), 10UL);
+
+  fs::remove_all(dir);
+  pass();
+}
+
+static void
+testFailures() {
+  TestServer server(Files{ { "/file", "hello" } });
+  const fs::path dir = testDir();
+
+  const std::vector<Download> downloads = {
+    { .url = server.url("/missing"), .dest = dir / "missing", .sha256 = "" },
+    { .url = server.url("/file"),
+      .dest = dir / "file",
+      .sha256 = Sha256::hash("bye") },
+  };
+  std::string msg;
+  try {
+    Downloader().download(downloads);
+  } catch (const CabinError& e) {
+    msg = e.what();
+  }
+  assertTrue(msg.starts_with("failed to download:\n"));
+  assertTrue(msg.find(server.url("/missing") + ": ") != std::string::npos);
+  assertTrue(
+      msg.find(fmt::format(
+          "{}: checksum mismatch: expected {}, got {}", server.url("/file"),
+          Sha256::hash("bye"), Sha256::hash("hello")
+      ))
+      != std::string::npos
+  );
+  assertFalse(fs::exists(dir / "missing"));
+  assertFalse(fs::exists(dir / "missing.part"));
+  assertFalse(fs::exists(dir / "file"));
+  assertFalse(fs::exists(dir / "file.part"));
+
+  fs::remove_all(dir);
+  pass();
+}
+
+static void
+testResume() {
+  const std::string large = largeContent();
+  TestServer server(
+      Files{ { "/large", large }, { "/no-range/large", large } }
+  );
+  const fs::path dir = testDir();
+  fs::create_directories(dir);
+  const std::string half = large.substr(0, large.size() / 2);
+  std::ofstream(dir / "resumed.part", std::ios::binary) << half;
+  std::ofstream(dir / "restarted.part", std::ios::binary) << half;
+  std::ofstream(dir / "complete.part", std::ios::binary) << large;
+
+  const std::vector<Download> downloads = {
+    { .url = server.url("/large"),
+      .dest = dir / "resumed",
+      .sha256 = Sha256::hash(large) },
+    { .url = server.url("/no-range/large"),
+      .dest = dir / "restarted",
+      .sha256 = Sha256::hash(large) },
+    { .url = server.url("/large"),
+      .dest = dir / "complete",
+      .sha256 = Sha256::hash(large) },
+  };
+  Downloader(1).download(downloads);
+  assertEq(readFile(dir / "resumed"), large);
+  assertEq(readFile(dir / "restarted"), large);
+  assertEq(readFile(dir / "complete"), large);
+
+  const std::string range = fmt::format("bytes={}-", half.size());
+  assertEq(
+      fmt::format("{}", fmt::join(server.getRequests(), ", ")),
+      fmt::format(
+          "/large {}, /no-range/large {}, /no-range/large , /large bytes={}-, "
+          "/large ",
+          range, range, large.size()
+      )
+  );
+
+  fs::remove_all(dir);
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testDownload();
+  tests::testFailures();
+  tests::testResume();
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+
+#include <cstddef>
+#include <curl/curl.h>
+#include <span>
+#include <string>
+
+struct Download {
+  std::string url;
+  fs::path dest;
+  // The expected SHA-256 in hex, or empty not to verify the file.
+  std::string sha256;
+};
+
+// Downloads files concurrently with curl_multi.  Transfers to the same host
+// are multiplexed over one HTTP/2 connection when the server supports it,
+// and connections are kept open for later downloads by the same Downloader.
+//
+// Each file is first written to `dest` + ".part" while its SHA-256 is
+// computed, and renamed to `dest` only once complete and verified.  A .part
+// file left by an interrupted download is resumed with a range request.
+class Downloader {
+public:
+  /// Run at most `maxTransfers` transfers at a time.
+  explicit Downloader(size_t maxTransfers = DEFAULT_MAX_TRANSFERS);
+  ~Downloader();
+
+  Downloader(const Downloader&) = delete;
+  Downloader& operator=(const Downloader&) = delete;
+  Downloader(Downloader&&) = delete;
+  Downloader& operator=(Downloader&&) = delete;
+
+  /// Download all of `downloads`.  Files already at `dest` with the expected
+  /// SHA-256 are skipped.  Throws CabinError listing every failed download
+  /// after the others finish.
+  void download(std::span<const Download> downloads);
+
+private:
+  static constexpr size_t DEFAULT_MAX_TRANSFERS = 16;
+
+  CURLM* multi;
+  size_t maxTransfers;
+};
@@ -7,6 +7,7 @@
 #include "Git2/Global.hpp"
 #include "Git2/Object.hpp"
 #include "Git2/Oid.hpp"
+#include "Git2/Remote.hpp"
 #include "Git2/Repository.hpp"
 #include "Git2/Revparse.hpp"
 #include "Git2/Revwalk.hpp"
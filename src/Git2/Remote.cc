@@ -0,0 +1,55 @@
+#include "Remote.hpp"
+
+#include "Exception.hpp"
+#include "Repository.hpp"
+
+#include <git2/remote.h>
+#include <git2/strarray.h>
+#include <git2/version.h>
+#include <string>
+#include <vector>
+
+namespace git2 {
+
+Remote::Remote(
+    const Repository& repo, const std::string& name, const std::string& url
+) {
+  git2Throw(git_remote_create(&this->raw, repo.raw, name.c_str(), url.c_str())
+  );
+}
+Remote::Remote(const Repository& repo, const std::string& url) {
+  git2Throw(git_remote_create_anonymous(&this->raw, repo.raw, url.c_str()));
+}
+Remote::~Remote() noexcept {
+  git_remote_free(this->raw);
+}
+
+Remote&
+Remote::fetch(
+    const std::vector<std::string>& refspecs, [[maybe_unused]] const int depth
+) {
+  std::vector<char*> specs;
+  specs.reserve(refspecs.size());
+  for (const std::string& refspec : refspecs) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    specs.push_back(const_cast<char*>(refspec.c_str()));
+  }
+  const git_strarray strarray{ .strings = specs.data(),
+                               .count = specs.size() };
+
+  git_fetch_options opts;
+  git2Throw(git_fetch_options_init(&opts, GIT_FETCH_OPTIONS_VERSION));
+  // Only fetch the tags we ask for.
+  opts.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+#if (LIBGIT2_VER_MAJOR > 1) \
+    || ((LIBGIT2_VER_MAJOR == 1) && (LIBGIT2_VER_MINOR >= 7))
+  opts.depth = depth;
+#endif
+
+  git2Throw(git_remote_fetch(
+      this->raw, refspecs.empty() ? nullptr : &strarray, &opts, nullptr
+  ));
+  return *this;
+}
+
+}  // end namespace git2
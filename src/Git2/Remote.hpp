@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Global.hpp"
+#include "Repository.hpp"
+
+#include <git2/remote.h>
+#include <git2/version.h>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace git2 {
+
+/// libgit2 can fetch a shallow history since 1.7.
+#if (LIBGIT2_VER_MAJOR > 1) \
+    || ((LIBGIT2_VER_MAJOR == 1) && (LIBGIT2_VER_MINOR >= 7))
+inline constexpr bool SHALLOW_FETCH_SUPPORTED = true;
+#else
+inline constexpr bool SHALLOW_FETCH_SUPPORTED = false;
+#endif
+
+/// Passing this as the fetch depth makes a shallow repository complete.
+inline constexpr int UNSHALLOW_DEPTH = std::numeric_limits<int>::max();
+
+struct Remote : public GlobalState {
+  git_remote* raw = nullptr;
+
+  Remote() = delete;
+  /// Add a remote with the default fetch refspec to the repository's
+  /// configuration.
+  Remote(
+      const Repository& repo, const std::string& name, const std::string& url
+  );
+  /// Create an in-memory remote which is not saved to the repository's
+  /// configuration.  Fetches need explicit refspecs.
+  Remote(const Repository& repo, const std::string& url);
+  ~Remote() noexcept;
+
+  Remote(const Remote&) = delete;
+  Remote(Remote&&) noexcept = default;
+  Remote& operator=(const Remote&) = delete;
+  Remote& operator=(Remote&&) noexcept = default;
+
+  /// Download new data and update tips.
+  ///
+  /// If `refspecs` is empty, the configured refspecs are used.  A positive
+  /// `depth` fetches only that many commits of history, if
+  /// SHALLOW_FETCH_SUPPORTED; otherwise, the whole history is fetched.
+  Remote& fetch(const std::vector<std::string>& refspecs, int depth = 0);
+};
+
+}  // end namespace git2
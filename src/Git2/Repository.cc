@@ -4,7 +4,11 @@
 #include "Exception.hpp"
 #include "Oid.hpp"
 
+#include <git2/checkout.h>
+#include <git2/errors.h>
 #include <git2/ignore.h>
+#include <git2/object.h>
+#include <git2/refs.h>
 #include <git2/repository.h>
 #include <git2/revparse.h>
 #include <string>
@@ -37,6 +41,11 @@ Repository::initBare(const std::string& path) {
   return *this;
 }
 
+bool
+Repository::isShallow() const {
+  return git_repository_is_shallow(this->raw) == 1;
+}
+
 bool
 Repository::isIgnored(const std::string& path) const {
   int ignored = 0;
@@ -75,6 +84,37 @@ Repository::checkoutHead(bool force) {
   return *this;
 }
 
+Repository&
+Repository::checkoutTree(const Object& treeish, const std::string& targetDir) {
+  git_checkout_options opts;
+  git2Throw(git_checkout_options_init(&opts, GIT_CHECKOUT_OPTIONS_VERSION));
+  opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DONT_UPDATE_INDEX;
+  opts.target_directory = targetDir.c_str();
+  git2Throw(git_checkout_tree(this->raw, treeish.raw, &opts));
+  return *this;
+}
+
+Repository&
+Repository::createReference(
+    const std::string& name, const Object& target, const bool force
+) {
+  git_reference* ref = nullptr;
+  git2Throw(git_reference_create(
+      &ref, this->raw, name.c_str(), git_object_id(target.raw), force, nullptr
+  ));
+  git_reference_free(ref);
+  return *this;
+}
+
+Repository&
+Repository::deleteReference(const std::string& name) {
+  const int error = git_reference_remove(this->raw, name.c_str());
+  if (error != GIT_ENOTFOUND) {
+    git2Throw(error);
+  }
+  return *this;
+}
+
 Oid
 Repository::refNameToId(const std::string& refname) const {
   git_oid oid;
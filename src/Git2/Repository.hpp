@@ -42,6 +42,9 @@ struct Repository : public GlobalState {
   /// The folder must exist prior to invoking this function.
   Repository& initBare(const std::string& path);
 
+  /// Determine if the repository was a shallow clone.
+  bool isShallow() const;
+
   /// Check if path is ignored by the ignore rules.
   bool isIgnored(const std::string& path) const;
 
@@ -60,6 +63,20 @@ struct Repository : public GlobalState {
   /// Checkout current HEAD
   Repository& checkoutHead(bool force = false);
 
+  /// Write the files of `treeish` into `targetDir` instead of the working
+  /// directory, leaving HEAD and the index untouched.  Works for bare
+  /// repositories.
+  Repository&
+  checkoutTree(const Object& treeish, const std::string& targetDir);
+
+  /// Create a new direct reference pointing to `target`.
+  Repository& createReference(
+      const std::string& name, const Object& target, bool force = false
+  );
+
+  /// Delete the reference `name`, if any.
+  Repository& deleteReference(const std::string& name);
+
   /// Lookup a reference by name and resolve immediately to OID.
   Oid refNameToId(const std::string& refname) const;
 
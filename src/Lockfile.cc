@@ -0,0 +1,365 @@
+#include "Lockfile.hpp"
+
+#include "Logger.hpp"
+#include "Rustify.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <toml.hpp>
+#include <tuple>
+#include <vector>
+
+static std::string
+getEnvOrEmpty(const char* name) {
+  if (const char* envP = std::getenv(name)) {
+    return envP;
+  }
+  return "";
+}
+
+// Returns the modification time and size of the file.
+static std::optional<std::pair<int64_t, int64_t>>
+statFile(const std::string& path) {
+  std::error_code ec;
+  const auto mtime = fs::last_write_time(path, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  const auto size = fs::file_size(path, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  return std::make_pair(
+      static_cast<int64_t>(mtime.time_since_epoch().count()),
+      static_cast<int64_t>(size)
+  );
+}
+
+void
+LockedSystemDep::stamp() {
+  pkgConfigPath = getEnvOrEmpty("PKG_CONFIG_PATH");
+  pkgConfigLibdir = getEnvOrEmpty("PKG_CONFIG_LIBDIR");
+  for (PcFileStamp& pcFile : pcFiles) {
+    const auto stat = statFile(pcFile.path);
+    pcFile.mtime = stat.has_value() ? stat->first : 0;
+    pcFile.size = stat.has_value() ? stat->second : 0;
+  }
+}
+
+bool
+LockedSystemDep::isFresh() const {
+  if (pcFiles.empty() || getEnvOrEmpty("PKG_CONFIG_PATH") != pkgConfigPath
+      || getEnvOrEmpty("PKG_CONFIG_LIBDIR") != pkgConfigLibdir) {
+    return false;
+  }
+  return std::ranges::all_of(pcFiles, [](const PcFileStamp& pcFile) {
+    const auto stat = statFile(pcFile.path);
+    return stat.has_value() && stat->first == pcFile.mtime
+           && stat->second == pcFile.size;
+  });
+}
+
+Lockfile
+Lockfile::read(const fs::path& path) {
+  if (!fs::exists(path)) {
+    return {};
+  }
+
+  try {
+    const toml::value data = toml::parse(path);
+    if (toml::find_or<int64_t>(data, "version", 0) != VERSION) {
+      logger::warn("ignoring {} of an unknown version", path.string());
+      return {};
+    }
+
+    Lockfile lockfile;
+    for (const auto& entry :
+         toml::find_or<toml::array>(data, "git", toml::array{})) {
+      std::optional<std::string> target = std::nullopt;
+      if (entry.contains("target")) {
+        target = toml::find<std::string>(entry, "target");
+      }
+      lockfile.gitDeps.push_back(
+          { .name = toml::find<std::string>(entry, "name"),
+            .url = toml::find<std::string>(entry, "url"),
+            .target = target,
+            .revision = toml::find<std::string>(entry, "revision") }
+      );
+    }
+    for (const auto& entry :
+         toml::find_or<toml::array>(data, "system", toml::array{})) {
+      std::vector<PcFileStamp> pcFiles;
+      for (const auto& pcFile : toml::find<toml::array>(entry, "pc-files")) {
+        pcFiles.push_back({ .path = toml::find<std::string>(pcFile, "path"),
+                            .mtime = toml::find<int64_t>(pcFile, "mtime"),
+                            .size = toml::find<int64_t>(pcFile, "size") });
+      }
+      lockfile.systemDeps.push_back(
+          { .name = toml::find<std::string>(entry, "name"),
+            .versionReq = toml::find<std::string>(entry, "version"),
+            .cflags = toml::find<std::string>(entry, "cflags"),
+            .libs = toml::find<std::string>(entry, "libs"),
+            .pcFiles = pcFiles,
+            .pkgConfigPath = toml::find<std::string>(entry, "pkg-config-path"),
+            .pkgConfigLibdir =
+                toml::find<std::string>(entry, "pkg-config-libdir") }
+      );
+    }
+    return lockfile;
+  } catch (const std::exception& e) {
+    logger::warn("ignoring malformed {}: {}", path.string(), e.what());
+    return {};
+  }
+}
+
+// Quotes `str` as a TOML basic string.
+static std::string
+quote(const std::string_view str) {
+  std::string quoted = "\"";
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+      quoted += fmt::format("\\u{:04X}", static_cast<unsigned char>(c));
+    } else {
+      quoted += c;
+    }
+  }
+  quoted += '"';
+  return quoted;
+}
+
+std::string
+Lockfile::toString() const {
+  std::vector<LockedGitDep> gitDeps = this->gitDeps;
+  std::ranges::sort(gitDeps, [](const auto& lhs, const auto& rhs) {
+    return std::tie(lhs.name, lhs.url, lhs.target)
+           < std::tie(rhs.name, rhs.url, rhs.target);
+  });
+  std::vector<LockedSystemDep> systemDeps = this->systemDeps;
+  std::ranges::sort(systemDeps, [](const auto& lhs, const auto& rhs) {
+    return std::tie(lhs.name, lhs.versionReq)
+           < std::tie(rhs.name, rhs.versionReq);
+  });
+
+  std::ostringstream oss;
+  oss << "# This file is generated by cabin.  Run `cabin update` to refresh "
+         "it.\n";
+  oss << "version = " << VERSION << '\n';
+  for (const LockedGitDep& dep : gitDeps) {
+    oss << "\n[[git]]\n";
+    oss << "name = " << quote(dep.name) << '\n';
+    oss << "url = " << quote(dep.url) << '\n';
+    if (dep.target.has_value()) {
+      oss << "target = " << quote(dep.target.value()) << '\n';
+    }
+    oss << "revision = " << quote(dep.revision) << '\n';
+  }
+  for (const LockedSystemDep& dep : systemDeps) {
+    oss << "\n[[system]]\n";
+    oss << "name = " << quote(dep.name) << '\n';
+    oss << "version = " << quote(dep.versionReq) << '\n';
+    oss << "cflags = " << quote(dep.cflags) << '\n';
+    oss << "libs = " << quote(dep.libs) << '\n';
+    oss << "pc-files = [\n";
+    for (const PcFileStamp& pcFile : dep.pcFiles) {
+      oss << "  { path = " << quote(pcFile.path) << ", mtime = " << pcFile.mtime
+          << ", size = " << pcFile.size << " },\n";
+    }
+    oss << "]\n";
+    oss << "pkg-config-path = " << quote(dep.pkgConfigPath) << '\n';
+    oss << "pkg-config-libdir = " << quote(dep.pkgConfigLibdir) << '\n';
+  }
+  return oss.str();
+}
+
+void
+Lockfile::write(const fs::path& path) const {
+  const std::string contents = toString();
+  if (fs::exists(path)) {
+    std::ifstream ifs(path);
+    const std::string current(
+        (std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>()
+    );
+    if (current == contents) {
+      return;
+    }
+  }
+
+  logger::debug("Writing {}", path.string());
+  std::ofstream ofs(path);
+  ofs << contents;
+}
+
+const LockedGitDep*
+Lockfile::findGitDep(
+    const std::string_view name, const std::string_view url,
+    const std::optional<std::string>& target
+) const {
+  const auto itr = std::ranges::find_if(gitDeps, [&](const auto& dep) {
+    return dep.name == name && dep.url == url && dep.target == target;
+  });
+  return itr == gitDeps.end() ? nullptr : &*itr;
+}
+
+const LockedSystemDep*
+Lockfile::findSystemDep(
+    const std::string_view name, const std::string_view versionReq
+) const {
+  const auto itr = std::ranges::find_if(systemDeps, [&](const auto& dep) {
+    return dep.name == name && dep.versionReq == versionReq;
+  });
+  return itr == systemDeps.end() ? nullptr : &*itr;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+static Lockfile
+sampleLockfile() {
+  Lockfile lockfile;
+  lockfile.gitDeps.push_back(
+      { .name = "toml11",
+        .url = "https://github.com/ToruNiina/toml11.git",
+        .target = "v4.2.0",
+        .revision = "846abd9a49082fe51440aa07005c360f13a67bbf" }
+  );
+  lockfile.gitDeps.push_back({ .name = "fmt",
+                               .url = "https://github.com/fmtlib/fmt.git",
+                               .target = std::nullopt,
+                               .revision = std::string(40, 'a') });
+  lockfile.systemDeps.push_back({ .name = "zlib",
+                                  .versionReq = ">=1.2.0",
+                                  .cflags = "-I\"/opt/zlib dir\"",
+                                  .libs = "-lz",
+                                  .pcFiles = { {
+                                      .path = "/usr/lib/pkgconfig/zlib.pc",
+                                      .mtime = 1700000000000000000,
+                                      .size = 123,
+                                  } },
+                                  .pkgConfigPath = "",
+                                  .pkgConfigLibdir = "" });
+  return lockfile;
+}
+
+static void
+testRoundTrip() {
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-lockfile";
+  fs::create_directories(dir);
+  const fs::path path = dir / "cabin.lock";
+
+  const Lockfile lockfile = sampleLockfile();
+  lockfile.write(path);
+  const Lockfile read = Lockfile::read(path);
+  fs::remove_all(dir);
+
+  assertEq(read.toString(), lockfile.toString());
+  assertEq(read.gitDeps.size(), 2UL);
+  assertEq(read.systemDeps.size(), 1UL);
+  assertEq(read.systemDeps[0].cflags, "-I\"/opt/zlib dir\"");
+
+  pass();
+}
+
+static void
+testStableOrder() {
+  Lockfile lockfile = sampleLockfile();
+  const std::string str = lockfile.toString();
+  std::ranges::reverse(lockfile.gitDeps);
+  assertEq(lockfile.toString(), str);
+  assertTrue(str.find("name = \"fmt\"") < str.find("name = \"toml11\""));
+
+  pass();
+}
+
+static void
+testFind() {
+  const Lockfile lockfile = sampleLockfile();
+  assertTrue(
+      lockfile.findGitDep(
+          "toml11", "https://github.com/ToruNiina/toml11.git", "v4.2.0"
+      )
+      != nullptr
+  );
+  assertTrue(
+      lockfile.findGitDep(
+          "toml11", "https://github.com/ToruNiina/toml11.git", "v4.3.0"
+      )
+      == nullptr
+  );
+  assertTrue(
+      lockfile.findGitDep(
+          "fmt", "https://github.com/fmtlib/fmt.git", std::nullopt
+      )
+      != nullptr
+  );
+  assertTrue(lockfile.findSystemDep("zlib", ">=1.2.0") != nullptr);
+  assertTrue(lockfile.findSystemDep("zlib", ">=1.3.0") == nullptr);
+
+  pass();
+}
+
+static void
+testMissing() {
+  const Lockfile lockfile =
+      Lockfile::read(fs::temp_directory_path() / "cabin-no-such-lockfile");
+  assertTrue(lockfile.gitDeps.empty());
+  assertTrue(lockfile.systemDeps.empty());
+
+  pass();
+}
+
+static void
+testIsFresh() {
+  LockedSystemDep dep;
+  assertFalse(dep.isFresh());  // no .pc file
+
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-pc";
+  fs::create_directories(dir);
+  const fs::path foo = dir / "foo.pc";
+  const fs::path bar = dir / "bar.pc";
+  std::ofstream(foo) << "Name: foo\nRequires: bar\n";
+  std::ofstream(bar) << "Name: bar\n";
+  dep.pcFiles = { { .path = foo.string() }, { .path = bar.string() } };
+  dep.stamp();
+  assertTrue(dep.isFresh());
+
+  // A change in a required package invalidates the flags, too.
+  std::ofstream(bar, std::ios::app) << "Version: 1.0.0\n";
+  assertFalse(dep.isFresh());
+  dep.stamp();
+  assertTrue(dep.isFresh());
+
+  fs::remove(bar);
+  assertFalse(dep.isFresh());
+  fs::remove_all(dir);
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testRoundTrip();
+  tests::testStableOrder();
+  tests::testFind();
+  tests::testMissing();
+  tests::testIsFresh();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct LockedGitDep {
+  std::string name;
+  std::string url;
+  std::optional<std::string> target;
+  // The commit `target` pointed to when the dependency was resolved.
+  std::string revision;
+};
+
+struct PcFileStamp {
+  std::string path;
+  int64_t mtime = 0;
+  int64_t size = 0;
+};
+
+struct LockedSystemDep {
+  std::string name;
+  std::string versionReq;
+  std::string cflags;
+  std::string libs;
+  // The .pc files which the flags came from, i.e., the dependency's own and
+  // those it requires, and the pkg-config search path at resolution time.
+  // The flags are reused while all of them stay the same.
+  std::vector<PcFileStamp> pcFiles;
+  std::string pkgConfigPath;
+  std::string pkgConfigLibdir;
+
+  /// Record the current state of `pcFiles` and the search path.
+  void stamp();
+  /// Check if stamp() would record the same state now.
+  bool isFresh() const;
+};
+
+// cabin.lock pins git dependencies to commits and caches what pkg-config
+// reported for system dependencies, so an ordinary build neither asks remotes
+// where branches point nor spawns pkg-config.  `cabin update` refreshes it.
+struct Lockfile {
+  static constexpr int64_t VERSION = 1;
+
+  std::vector<LockedGitDep> gitDeps;
+  std::vector<LockedSystemDep> systemDeps;
+
+  /// Read a lockfile, or return an empty one if `path` does not exist.  A
+  /// malformed lockfile is ignored with a warning since it can be recreated.
+  static Lockfile read(const fs::path& path);
+  /// Serialize in a stable order so that the file does not change unless
+  /// the locked dependencies do.
+  std::string toString() const;
+  /// Write the lockfile unless it already has the same contents.
+  void write(const fs::path& path) const;
+
+  const LockedGitDep* findGitDep(
+      std::string_view name, std::string_view url,
+      const std::optional<std::string>& target
+  ) const;
+  const LockedSystemDep*
+  findSystemDep(std::string_view name, std::string_view versionReq) const;
+};
@@ -1,21 +1,33 @@
 #include "Manifest.hpp"
 
 #include "Algos.hpp"
+#include "ContentStore.hpp"
 #include "Exception.hpp"
 #include "Git2.hpp"
+#include "Lockfile.hpp"
 #include "Logger.hpp"
+#include "Parallelism.hpp"
+#include "PkgConfig.hpp"
 #include "Rustify.hpp"
 #include "Semver.hpp"
 #include "TermColor.hpp"
+#include "Toolchain.hpp"
 #include "VersionReq.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <exception>
+#include <fmt/core.h>
+#include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
 #include <toml.hpp>
 #include <unordered_map>
 #include <unordered_set>
@@ -124,6 +136,29 @@ struct GitDependency {
   std::string url;
   std::optional<std::string> target;
 
+  /// The name of installDir(), telling apart the targets of a dependency.
+  std::string dirName() const;
+  fs::path installDir() const;
+  /// The bare repository shared by all revisions of this dependency.
+  fs::path mirrorDir() const;
+  /// The ref in the mirror recording which commit installDir() holds.
+  std::string checkoutRef() const;
+  /// The commit checked out into installDir(), if any.
+  std::optional<std::string> checkedOutRevision() const;
+  /// Checks out `locked`, or `target` if not locked, unless it is already
+  /// there.  `refresh` asks the remote where `target` points now even if it
+  /// was checked out before.  Returns whether anything was checked out.
+  /// Does not log at the info level so that concurrent fetches can report in
+  /// the manifest order.
+  bool fetch(
+      const std::optional<std::string>& locked = std::nullopt,
+      bool refresh = false
+  ) const;
+  void logDownloaded() const;
+  /// Requires fetch() to have succeeded.
+  DepMetadata metadata() const;
+  /// Requires fetch() to have succeeded.
+  std::string revision() const;
   DepMetadata install() const;
 };
 
@@ -138,6 +173,11 @@ struct SystemDependency {
   std::string name;
   VersionReq versionReq;
 
+  /// Resolve from .pc files in-process, or return std::nullopt if
+  /// pkg-config has to be asked.
+  std::optional<LockedSystemDep> resolveNatively(PkgConfig& pkgConfig) const;
+  /// Query pkg-config.
+  LockedSystemDep resolve() const;
   DepMetadata install() const;
 };
 
@@ -167,11 +207,28 @@ struct Manifest {
   ~Manifest() noexcept = default;
 
   static Manifest& instance() {
-    static Manifest instance;
+    if (scopedInstances().empty()) {
+      return root();
+    }
+    Manifest& instance = *scopedInstances().back();
     instance.load();
     return instance;
   }
 
+  // The manifest of the package being built, even while a dependency's one
+  // is in effect.
+  static Manifest& root() {
+    static Manifest rootInstance;
+    rootInstance.load();
+    return rootInstance;
+  }
+
+  // Manifests pushed by ScopedManifest; the last one is in effect.
+  static std::vector<std::unique_ptr<Manifest>>& scopedInstances() {
+    static std::vector<std::unique_ptr<Manifest>> instances;
+    return instances;
+  }
+
   std::optional<fs::path> manifestPath = std::nullopt;
 
   std::optional<toml::value> data = std::nullopt;
@@ -185,8 +242,11 @@ struct Manifest {
   std::optional<Profile> releaseProfile = std::nullopt;
 
   std::optional<std::vector<std::string>> cpplintFilters = std::nullopt;
+  std::optional<std::vector<fs::path>> workspaceMembers = std::nullopt;
 
 private:
+  friend class ScopedManifest;
+
   Manifest() noexcept = default;
 
   void load() {
@@ -200,11 +260,36 @@ private:
       toml::color::disable();
     }
 
-    manifestPath = findManifest();
+    if (!manifestPath.has_value()) {
+      manifestPath = findManifest();
+    }
     data = toml::parse(manifestPath.value());
   }
 };
 
+ScopedManifest::ScopedManifest(const fs::path& manifestPath) {
+  const fs::path path = fs::weakly_canonical(manifestPath);
+  if (!fs::exists(path)) {
+    throw CabinError("could not find `", path.string(), "`");
+  }
+  for (const auto& scoped : Manifest::scopedInstances()) {
+    if (scoped->manifestPath == path) {
+      throw CabinError(
+          "cyclic dependency detected on package at `",
+          path.parent_path().string(), "`"
+      );
+    }
+  }
+
+  std::unique_ptr<Manifest> manifest(new Manifest());
+  manifest->manifestPath = path;
+  Manifest::scopedInstances().push_back(std::move(manifest));
+}
+
+ScopedManifest::~ScopedManifest() noexcept {
+  Manifest::scopedInstances().pop_back();
+}
+
 const fs::path&
 getManifestPath() {
   return Manifest::instance().manifestPath.value();
@@ -438,6 +523,74 @@ getLintCpplintFilters() {
   return manifest.cpplintFilters.value();
 }
 
+bool
+isWorkspace() {
+  return Manifest::instance().data.value().contains("workspace");
+}
+
+// Returns the directories of the workspace members.  A member is either a
+// path to a package or `dir/*`, which means every package directly in `dir`.
+// If the workspace root is a package itself, it is the first member.
+const std::vector<fs::path>&
+getWorkspaceMembers() {
+  Manifest& manifest = Manifest::instance();
+  if (manifest.workspaceMembers.has_value()) {
+    return manifest.workspaceMembers.value();
+  }
+
+  const toml::value& data = manifest.data.value();
+  std::vector<fs::path> members;
+  if (data.contains("workspace")) {
+    if (!data.at("workspace").is_table()) {
+      throw CabinError("[workspace] must be a table");
+    }
+    const auto patterns = toml::find_or<std::vector<std::string>>(
+        data, "workspace", "members", std::vector<std::string>{}
+    );
+
+    const fs::path basePath = getProjectBasePath();
+    if (data.contains("package")) {
+      members.push_back(fs::weakly_canonical(basePath));
+    }
+    for (const std::string& pattern : patterns) {
+      if (pattern.ends_with("/*")) {
+        const fs::path dir =
+            basePath / pattern.substr(0, pattern.size() - "/*"sv.size());
+        if (!fs::is_directory(dir)) {
+          throw CabinError("workspace member `", pattern, "` was not found");
+        }
+
+        std::vector<fs::path> found;
+        for (const auto& entry : fs::directory_iterator(dir)) {
+          if (entry.is_directory()
+              && fs::exists(entry.path() / "cabin.toml")) {
+            found.push_back(fs::weakly_canonical(entry.path()));
+          }
+        }
+        // directory_iterator has no particular order.
+        std::ranges::sort(found);
+        members.insert(members.end(), found.begin(), found.end());
+      } else {
+        const fs::path member = fs::weakly_canonical(basePath / pattern);
+        if (!fs::exists(member / "cabin.toml")) {
+          throw CabinError(
+              "workspace member `", pattern, "` does not contain cabin.toml"
+          );
+        }
+        members.push_back(member);
+      }
+    }
+  }
+
+  // A member may be listed more than once through patterns.
+  std::unordered_set<std::string> seen;
+  std::erase_if(members, [&seen](const fs::path& member) {
+    return !seen.insert(member.string()).second;
+  });
+  manifest.workspaceMembers = members;
+  return manifest.workspaceMembers.value();
+}
+
 static fs::path
 getXdgCacheHome() {
   if (const char* envP = std::getenv("XDG_CACHE_HOME")) {
@@ -449,7 +602,27 @@ getXdgCacheHome() {
 
 static const fs::path CACHE_DIR(getXdgCacheHome() / "cabin");
 static const fs::path GIT_DIR(CACHE_DIR / "git");
+static const fs::path GIT_DB_DIR(GIT_DIR / "db");
 static const fs::path GIT_SRC_DIR(GIT_DIR / "src");
+static const fs::path STORE_DIR(CACHE_DIR / "store");
+static const fs::path TOOLCHAIN_DIR(CACHE_DIR / "toolchains");
+
+const fs::path&
+getCacheDir() {
+  return CACHE_DIR;
+}
+
+const ContentStore&
+getContentStore() {
+  static const ContentStore store(STORE_DIR);
+  return store;
+}
+
+const Toolchain&
+getToolchain() {
+  static const Toolchain toolchain = Toolchain::detect(TOOLCHAIN_DIR);
+  return toolchain;
+}
 
 static const std::unordered_set<char> ALLOWED_CHARS = {
   '-', '_', '/', '.', '+'  // allowed in the dependency name
@@ -602,32 +775,190 @@ parseDependencies(const char* key) {
   return deps;
 }
 
-DepMetadata
-GitDependency::install() const {
-  fs::path installDir = GIT_SRC_DIR / name;
+static bool
+isFullCommitHash(const std::string_view str) {
+  constexpr size_t sha1HexSize = 40;
+  return str.size() == sha1HexSize
+         && std::ranges::all_of(str, [](const unsigned char c) {
+              return std::isxdigit(c);
+            });
+}
+
+// Returns the first spec which resolves in `repo`, if any.
+static std::optional<std::string>
+findSpec(const git2::Repository& repo, const std::vector<std::string>& specs) {
+  for (const std::string& spec : specs) {
+    try {
+      static_cast<void>(repo.revparseSingle(spec));
+      return spec;
+    } catch (const git2::Exception&) {
+      continue;
+    }
+  }
+  return std::nullopt;
+}
+
+// Brings `mirror` up to date with `target` and returns a spec which resolves
+// to it there.  Only the commit to check out is fetched, not the whole
+// history nor the other refs, and objects which the mirror already has, e.g.,
+// from the previous tag, are not downloaded again.
+static std::string
+updateMirror(
+    git2::Repository& mirror, const std::string& url,
+    const std::optional<std::string>& target
+) {
+  std::vector<std::string> refspecs;
+  // Candidates to check out, in order.
+  std::vector<std::string> specs;
+  if (!target.has_value()) {
+    refspecs = { "+HEAD:refs/remotes/origin/HEAD" };
+    specs = { "refs/remotes/origin/HEAD" };
+  } else if (isFullCommitHash(target.value())) {
+    // A commit never changes; no need to ask the server if we have it.
+    if (findSpec(mirror, { target.value() + "^{commit}" }).has_value()) {
+      return target.value();
+    }
+    // Servers such as GitHub allow fetching a commit by its hash.
+    refspecs = { target.value() };
+    specs = { target.value() };
+  } else {
+    // We don't know whether `target` is a tag or a branch.  A refspec which
+    // matches nothing is ignored.
+    refspecs = {
+      fmt::format("+refs/tags/{0}:refs/tags/{0}", target.value()),
+      fmt::format("+refs/heads/{0}:refs/remotes/origin/{0}", target.value()),
+    };
+    specs = { "refs/tags/" + target.value(),
+              "refs/remotes/origin/" + target.value() };
+  }
+
+  git2::Remote remote(mirror, url);
+  try {
+    remote.fetch(refspecs, /*depth=*/1);
+    if (const auto spec = findSpec(mirror, specs)) {
+      return spec.value();
+    }
+  } catch (const git2::Exception& e) {
+    logger::debug("fetching {} from {} failed: {}", refspecs[0], url, e.what());
+  }
+
+  // E.g., an abbreviated commit hash, which can't be fetched by itself.
+  // Fetch every branch and tag with their whole history.
+  logger::debug("fetching the whole history of {}", url);
+  remote.fetch(
+      { "+refs/heads/*:refs/remotes/origin/*", "+refs/tags/*:refs/tags/*" },
+      mirror.isShallow() ? git2::UNSHALLOW_DEPTH : 0
+  );
   if (target.has_value()) {
-    installDir += '-' + target.value();
+    specs.push_back(target.value());
+  }
+  if (const auto spec = findSpec(mirror, specs)) {
+    return spec.value();
   }
+  throw CabinError("could not find `", target.value_or("HEAD"), "` in ", url);
+}
 
-  if (fs::exists(installDir) && !fs::is_empty(installDir)) {
+std::string
+GitDependency::dirName() const {
+  if (target.has_value()) {
+    return name + '-' + target.value();
+  }
+  return name;
+}
+
+fs::path
+GitDependency::installDir() const {
+  return GIT_SRC_DIR / dirName();
+}
+
+fs::path
+GitDependency::mirrorDir() const {
+  return GIT_DB_DIR / fmt::format("{}-{:016x}", name, fnv1aHash(url));
+}
+
+std::string
+GitDependency::checkoutRef() const {
+  return "refs/cabin/checkouts/" + dirName();
+}
+
+std::optional<std::string>
+GitDependency::checkedOutRevision() const {
+  const fs::path installDir = this->installDir();
+  const fs::path mirrorDir = this->mirrorDir();
+  if (!fs::exists(installDir) || fs::is_empty(installDir)
+      || !fs::exists(mirrorDir)) {
+    return std::nullopt;
+  }
+  // A checkout without the ref was left halfway or made by an older cabin.
+  try {
+    git2::Repository mirror;
+    mirror.openBare(mirrorDir.string());
+    return mirror.refNameToId(checkoutRef()).toString();
+  } catch (const git2::Exception&) {
+    return std::nullopt;
+  }
+}
+
+bool
+GitDependency::fetch(
+    const std::optional<std::string>& locked, const bool refresh
+) const {
+  const fs::path installDir = this->installDir();
+  const fs::path mirrorDir = this->mirrorDir();
+  const std::optional<std::string> installed = checkedOutRevision();
+  const bool isLockedOne = !locked.has_value() || installed == locked;
+  if (installed.has_value() && !refresh && isLockedOne) {
     logger::debug("{} is already installed", name);
+    return false;
+  }
+
+  git2::Repository mirror;
+  if (fs::exists(mirrorDir)) {
+    mirror.openBare(mirrorDir.string());
   } else {
-    git2::Repository repo;
-    repo.clone(url, installDir.string());
+    fs::create_directories(mirrorDir);
+    mirror.initBare(mirrorDir.string());
+  }
+  const std::string spec =
+      updateMirror(mirror, url, locked.has_value() ? locked : target);
 
-    if (target.has_value()) {
-      // Checkout to target.
-      const std::string target = this->target.value();
-      const git2::Object obj = repo.revparseSingle(target);
-      repo.setHeadDetached(obj.id());
-      repo.checkoutHead(true);
-    }
+  const git2::Object commit = mirror.revparseSingle(spec + "^{commit}");
+  if (installed.has_value() && commit.id().toString() == installed.value()) {
+    logger::debug("{} is up to date", name);
+    return false;
+  }
 
-    logger::info(
-        "Downloaded", "{} {}", name, target.has_value() ? target.value() : url
-    );
+  // Link the files of a commit checked out before from the content store.
+  // Otherwise, materialize them straight from the mirror's object database,
+  // and hand them over to the store for the next checkout.
+  // The ref goes first and comes back last, so that a checkout which fails
+  // halfway is not taken for the commit it had before.
+  const ContentStore& store = getContentStore();
+  const std::string rev = commit.id().toString();
+  mirror.deleteReference(checkoutRef());
+  fs::remove_all(installDir);
+  if (store.materialize(rev, installDir)) {
+    logger::debug("linked {} from {}", name, store.getRoot().string());
+  } else {
+    fs::remove_all(installDir);
+    fs::create_directories(installDir);
+    mirror.checkoutTree(commit, installDir.string());
+    store.ingest(installDir, rev);
   }
+  mirror.createReference(checkoutRef(), commit, /*force=*/true);
+  return true;
+}
+
+void
+GitDependency::logDownloaded() const {
+  logger::info(
+      "Downloaded", "{} {}", name, target.has_value() ? target.value() : url
+  );
+}
 
+// `installDir` holds `revision` of a git dependency, checked out or vendored.
+static DepMetadata
+gitDepMetadata(const fs::path& installDir, const std::string& revision) {
   const fs::path includeDir = installDir / "include";
   std::string includes = "-isystem";
 
@@ -638,13 +969,45 @@ GitDependency::install() const {
     includes += installDir.string();
   }
 
-  // Currently, no libs are supported.
-  return { .includes = includes, .libs = "" };
+  if (fs::exists(installDir / "cabin.toml")) {
+    // A cabin package; BuildConfig builds its library, if any, into the
+    // cache.
+    return { .includes = includes,
+             .libs = "",
+             .packageRoot = installDir,
+             .revision = revision };
+  }
+  // Other packages must be header-only.
+  return { .includes = includes, .libs = "", .revision = revision };
+}
+
+DepMetadata
+GitDependency::metadata() const {
+  return gitDepMetadata(installDir(), revision());
+}
+
+std::string
+GitDependency::revision() const {
+  const std::optional<std::string> revision = checkedOutRevision();
+  if (!revision.has_value()) {
+    throw CabinError(name, " is not installed");
+  }
+  return revision.value();
+}
+
+DepMetadata
+GitDependency::install() const {
+  if (fetch()) {
+    logDownloaded();
+  }
+  return metadata();
 }
 
 DepMetadata
 PathDependency::install() const {
-  const fs::path installDir = fs::weakly_canonical(path);
+  // Relative to the package, not to the current directory; a path dependency
+  // may have path dependencies of its own.
+  const fs::path installDir = fs::weakly_canonical(getProjectBasePath() / path);
   if (fs::exists(installDir) && !fs::is_empty(installDir)) {
     logger::debug("{} is already installed", name);
   } else {
@@ -661,28 +1024,341 @@ PathDependency::install() const {
     includes += installDir.string();
   }
 
+  if (fs::exists(installDir / "cabin.toml")) {
+    // A cabin package; BuildConfig builds its library, if any.
+    return { .includes = includes, .libs = "", .packageRoot = installDir };
+  }
   // Currently, no libs are supported.
   return { .includes = includes, .libs = "" };
 }
 
-DepMetadata
-SystemDependency::install() const {
+std::optional<LockedSystemDep>
+SystemDependency::resolveNatively(PkgConfig& pkgConfig) const {
+  const std::optional<PkgConfigResult> result =
+      pkgConfig.resolve(name, versionReq);
+  if (!result.has_value()) {
+    logger::debug("{}: falling back to pkg-config", name);
+    return std::nullopt;
+  }
+
+  LockedSystemDep locked;
+  locked.name = name;
+  locked.versionReq = versionReq.toString();
+  locked.cflags = result->cflags;
+  locked.libs = result->libs;
+  for (const fs::path& pcFile : result->pcFiles) {
+    locked.pcFiles.push_back({ .path = pcFile.string() });
+  }
+  locked.stamp();
+  return locked;
+}
+
+LockedSystemDep
+SystemDependency::resolve() const {
   const std::string pkgConfigVer = versionReq.toPkgConfigString(name);
   const Command cflagsCmd =
       Command("pkg-config").addArg("--cflags").addArg(pkgConfigVer);
   const Command libsCmd =
       Command("pkg-config").addArg("--libs").addArg(pkgConfigVer);
 
-  std::string cflags = getCmdOutput(cflagsCmd);
+  // A missing package is not a transient failure; don't retry.
+  std::string cflags = getCmdOutput(cflagsCmd, /*retry=*/1);
   cflags.pop_back();  // remove '\n'
-  std::string libs = getCmdOutput(libsCmd);
+  std::string libs = getCmdOutput(libsCmd, /*retry=*/1);
   libs.pop_back();  // remove '\n'
 
-  return { .includes = cflags, .libs = libs };
+  LockedSystemDep locked;
+  locked.name = name;
+  locked.versionReq = versionReq.toString();
+  locked.cflags = cflags;
+  locked.libs = libs;
+
+  // Find the .pc files which the flags came from, following Requires and
+  // Requires.private, so that a change in any of them invalidates the flags.
+  std::vector<std::string> pending = { name };
+  std::unordered_set<std::string> seen = { name };
+  while (!pending.empty()) {
+    const std::string pkg = pending.back();
+    pending.pop_back();
+
+    const Command pcFileDirCmd =
+        Command("pkg-config").addArg("--variable=pcfiledir").addArg(pkg);
+    std::string pcFileDir = getCmdOutput(pcFileDirCmd, /*retry=*/1);
+    pcFileDir.pop_back();  // remove '\n'
+    locked.pcFiles.push_back(
+        { .path = (fs::path(pcFileDir) / (pkg + ".pc")).string() }
+    );
+
+    for (const char* option :
+         { "--print-requires", "--print-requires-private" }) {
+      const Command requiredCmd =
+          Command("pkg-config").addArg(option).addArg(pkg);
+      // Each line is a package name optionally followed by a version
+      // constraint.
+      std::istringstream iss(getCmdOutput(requiredCmd, /*retry=*/1));
+      std::string line;
+      while (std::getline(iss, line)) {
+        std::string required;
+        std::istringstream(line) >> required;
+        if (!required.empty() && seen.insert(required).second) {
+          pending.push_back(required);
+        }
+      }
+    }
+  }
+
+  locked.stamp();
+  return locked;
 }
 
-std::vector<DepMetadata>
-installDependencies(const bool includeDevDeps) {
+DepMetadata
+SystemDependency::install() const {
+  const LockedSystemDep locked = resolve();
+  return { .includes = locked.cflags, .libs = locked.libs };
+}
+
+// Git dependencies copied into the package by `cabin vendor`.
+struct Vendor {
+  fs::path dir;
+  // What each subdirectory of `dir` holds.
+  Lockfile lockfile;
+};
+
+static constexpr std::string_view VENDOR_LOCKFILE = "vendor.lock";
+
+std::optional<fs::path>
+getVendorDir() {
+  const Manifest& manifest = Manifest::root();
+  const auto& table = toml::get<toml::table>(manifest.data.value());
+  if (!table.contains("vendor")) {
+    return std::nullopt;
+  }
+  const auto dir = toml::find_or<std::string>(
+      manifest.data.value(), "vendor", "directory", "vendor"
+  );
+  return fs::absolute(manifest.manifestPath->parent_path() / dir);
+}
+
+static std::optional<Vendor>
+findVendor() {
+  const std::optional<fs::path> dir = getVendorDir();
+  if (!dir.has_value()) {
+    return std::nullopt;
+  }
+  return Vendor{ .dir = dir.value(),
+                 .lockfile = Lockfile::read(dir.value() / VENDOR_LOCKFILE) };
+}
+
+// Returns the vendored copy of `dep`, which must be the one in `lockfile` if
+// locked there.
+static const LockedGitDep&
+findVendoredDep(
+    const Vendor& vendor, const GitDependency& dep, const Lockfile& lockfile
+) {
+  const LockedGitDep* vendored =
+      vendor.lockfile.findGitDep(dep.name, dep.url, dep.target);
+  if (vendored == nullptr || !fs::exists(vendor.dir / dep.dirName())) {
+    throw CabinError(
+        "`", dep.name, "` is not vendored in ", vendor.dir.string(),
+        "; run `cabin vendor`"
+    );
+  }
+  const LockedGitDep* locked =
+      lockfile.findGitDep(dep.name, dep.url, dep.target);
+  if (locked != nullptr && locked->revision != vendored->revision) {
+    throw CabinError(
+        "`", dep.name, "` in ", vendor.dir.string(),
+        " differs from cabin.lock; run `cabin vendor`"
+    );
+  }
+  return *vendored;
+}
+
+// Git clones are network-bound and pkg-config queries are process-bound, so
+// each kind runs in its own bounded lane and neither waits behind the other.
+// Path dependencies are resolved afterward on this thread since they read
+// the current manifest.  The results, progress messages, and the error
+// reported, if any, follow the manifest order regardless of which install
+// finishes first.
+//
+// Dependencies found in `lockfile` are installed as locked.  System ones
+// found in either `lockfile` or `cache` whose .pc files did not change need
+// no pkg-config at all.  With `refresh`, both are ignored.  The others are
+// resolved from their .pc files on this thread, sharing the parsed files,
+// and only those we can't are left to pkg-config.  What was installed is
+// appended to `resolved`.
+//
+// With `vendor`, git dependencies are read from there instead, touching
+// neither the network nor the cache.
+static std::vector<DepMetadata>
+installDependencies(
+    const std::vector<const Dependency*>& deps, const Lockfile& lockfile,
+    const Lockfile& cache, const bool refresh, const Vendor* vendor,
+    Lockfile& resolved
+) {
+  constexpr int maxConcurrentFetches = 8;
+
+  const size_t numDeps = deps.size();
+  std::vector<std::optional<LockedSystemDep>> systemDeps(numDeps);
+  // Not std::vector<bool>; the lanes write distinct elements concurrently.
+  std::vector<char> downloaded(numDeps, false);
+  std::vector<std::exception_ptr> errors(numDeps);
+
+  tbb::task_arena netLane(maxConcurrentFetches);
+  tbb::task_arena procLane(static_cast<int>(getParallelism()));
+  tbb::task_group netTasks;
+  tbb::task_group procTasks;
+
+  // Git dependencies of the same name share a mirror and possibly a
+  // checkout, e.g., when listed in both [dependencies] and
+  // [dev-dependencies], so they are fetched one after another in one task.
+  // Vendored ones need no fetching.
+  std::vector<std::vector<size_t>> fetchGroups;
+  std::unordered_map<std::string_view, size_t> groupOfName;
+  for (size_t i = 0; i < numDeps && vendor == nullptr; ++i) {
+    if (const auto* dep = std::get_if<GitDependency>(deps[i])) {
+      const auto [itr, inserted] =
+          groupOfName.try_emplace(dep->name, fetchGroups.size());
+      if (inserted) {
+        fetchGroups.emplace_back();
+      }
+      fetchGroups[itr->second].push_back(i);
+    }
+  }
+  for (const std::vector<size_t>& group : fetchGroups) {
+    netLane.execute([&] {
+      netTasks.run([&] {
+        for (const size_t i : group) {
+          const auto& dep = std::get<GitDependency>(*deps[i]);
+          const LockedGitDep* locked =
+              refresh ? nullptr
+                      : lockfile.findGitDep(dep.name, dep.url, dep.target);
+          try {
+            downloaded[i] = dep.fetch(
+                locked != nullptr ? std::optional(locked->revision)
+                                  : std::nullopt,
+                refresh
+            );
+          } catch (...) {
+            errors[i] = std::current_exception();
+          }
+        }
+      });
+    });
+  }
+  PkgConfig pkgConfig;
+  for (size_t i = 0; i < numDeps; ++i) {
+    if (const auto* dep = std::get_if<SystemDependency>(deps[i])) {
+      if (!refresh) {
+        const std::string versionReq = dep->versionReq.toString();
+        const LockedSystemDep* locked =
+            lockfile.findSystemDep(dep->name, versionReq);
+        const LockedSystemDep* cached =
+            cache.findSystemDep(dep->name, versionReq);
+        if (locked != nullptr && locked->isFresh()) {
+          systemDeps[i] = *locked;
+          continue;
+        } else if (cached != nullptr && cached->isFresh()) {
+          systemDeps[i] = *cached;
+          continue;
+        }
+      }
+      systemDeps[i] = dep->resolveNatively(pkgConfig);
+      if (systemDeps[i].has_value()) {
+        continue;
+      }
+      procLane.execute([&, i, dep] {
+        procTasks.run([&, i, dep] {
+          try {
+            systemDeps[i] = dep->resolve();
+          } catch (...) {
+            errors[i] = std::current_exception();
+          }
+        });
+      });
+    }
+  }
+  netLane.execute([&] { netTasks.wait(); });
+  procLane.execute([&] { procTasks.wait(); });
+
+  std::vector<DepMetadata> installed;
+  installed.reserve(numDeps);
+  for (size_t i = 0; i < numDeps; ++i) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+
+    if (const auto* dep = std::get_if<GitDependency>(deps[i])) {
+      std::string revision;
+      if (vendor != nullptr) {
+        revision = findVendoredDep(*vendor, *dep, lockfile).revision;
+        installed.emplace_back(
+            gitDepMetadata(vendor->dir / dep->dirName(), revision)
+        );
+      } else {
+        if (downloaded[i]) {
+          dep->logDownloaded();
+        }
+        revision = dep->revision();
+        installed.emplace_back(gitDepMetadata(dep->installDir(), revision));
+      }
+      if (resolved.findGitDep(dep->name, dep->url, dep->target) == nullptr) {
+        resolved.gitDeps.push_back({ .name = dep->name,
+                                     .url = dep->url,
+                                     .target = dep->target,
+                                     .revision = revision });
+      }
+    } else if (const auto* dep = std::get_if<PathDependency>(deps[i])) {
+      installed.emplace_back(dep->install());
+    } else {
+      const LockedSystemDep& locked = systemDeps[i].value();
+      installed.push_back({ .includes = locked.cflags, .libs = locked.libs });
+      if (resolved.findSystemDep(locked.name, locked.versionReq) == nullptr) {
+        resolved.systemDeps.push_back(locked);
+      }
+    }
+  }
+  return installed;
+}
+
+static fs::path
+getLockfilePath() {
+  return getProjectBasePath() / "cabin.lock";
+}
+
+// Unlike cabin.lock, this is machine-local and covers every package built,
+// including dependencies.  It lives in the cabin-out of the root package even
+// while a dependency's manifest is in effect, since the directories of
+// dependencies are shared by other projects or checked in.
+static fs::path
+getSystemDepCachePath() {
+  const fs::path& rootManifestPath = Manifest::root().manifestPath.value();
+  return fs::absolute(rootManifestPath.parent_path()) / "cabin-out"
+         / "pkg-config-cache.toml";
+}
+
+static void
+updateSystemDepCache(const Lockfile& cache, const Lockfile& resolved) {
+  if (resolved.systemDeps.empty()) {
+    return;
+  }
+
+  Lockfile updated;
+  updated.systemDeps = resolved.systemDeps;
+  // Keep the entries for, e.g., dev-dependencies not resolved this time.
+  for (const LockedSystemDep& dep : cache.systemDeps) {
+    if (updated.findSystemDep(dep.name, dep.versionReq) == nullptr) {
+      updated.systemDeps.push_back(dep);
+    }
+  }
+
+  const fs::path cachePath = getSystemDepCachePath();
+  fs::create_directories(cachePath.parent_path());
+  updated.write(cachePath);
+}
+
+static std::vector<const Dependency*>
+collectDependencies(const bool includeDevDeps) {
   Manifest& manifest = Manifest::instance();
   if (!manifest.dependencies.has_value()) {
     manifest.dependencies = parseDependencies("dependencies");
@@ -691,26 +1367,201 @@ installDependencies(const bool includeDevDeps) {
     manifest.devDependencies = parseDependencies("dev-dependencies");
   }
 
-  std::vector<DepMetadata> installed;
+  std::vector<const Dependency*> deps;
   if (manifest.dependencies.has_value()) {
     for (const auto& dep : manifest.dependencies.value()) {
-      std::visit(
-          [&installed](auto&& arg) { installed.emplace_back(arg.install()); },
-          dep
-      );
+      deps.push_back(&dep);
     }
   }
   if (includeDevDeps && manifest.devDependencies.has_value()) {
     for (const auto& dep : manifest.devDependencies.value()) {
-      std::visit(
-          [&installed](auto&& arg) { installed.emplace_back(arg.install()); },
-          dep
-      );
+      deps.push_back(&dep);
     }
   }
+  return deps;
+}
+
+static std::vector<DepMetadata>
+installDependencies(const bool includeDevDeps, const Vendor* vendor) {
+  const std::vector<const Dependency*> deps =
+      collectDependencies(includeDevDeps);
+
+  const Lockfile cache = Lockfile::read(getSystemDepCachePath());
+
+  // Only the package being built is locked; dependencies' lockfiles are
+  // ignored as their manifests only say what they are compatible with.
+  if (!Manifest::scopedInstances().empty()) {
+    Lockfile resolved;
+    std::vector<DepMetadata> installed = installDependencies(
+        deps, Lockfile{}, cache, /*refresh=*/false, vendor, resolved
+    );
+    updateSystemDepCache(cache, resolved);
+    return installed;
+  }
+
+  const fs::path lockfilePath = getLockfilePath();
+  const Lockfile lockfile = Lockfile::read(lockfilePath);
+  Lockfile resolved;
+  std::vector<DepMetadata> installed = installDependencies(
+      deps, lockfile, cache, /*refresh=*/false, vendor, resolved
+  );
+  updateSystemDepCache(cache, resolved);
+
+  if (!includeDevDeps) {
+    // Keep the dev-dependencies locked for the next `cabin test`.
+    for (const Dependency* dep : collectDependencies(/*includeDevDeps=*/true)) {
+      if (const auto* git = std::get_if<GitDependency>(dep)) {
+        const LockedGitDep* locked =
+            lockfile.findGitDep(git->name, git->url, git->target);
+        const bool isMissing =
+            resolved.findGitDep(git->name, git->url, git->target) == nullptr;
+        if (locked != nullptr && isMissing) {
+          resolved.gitDeps.push_back(*locked);
+        }
+      } else if (const auto* sys = std::get_if<SystemDependency>(dep)) {
+        const std::string versionReq = sys->versionReq.toString();
+        const LockedSystemDep* locked =
+            lockfile.findSystemDep(sys->name, versionReq);
+        const bool isMissing =
+            resolved.findSystemDep(sys->name, versionReq) == nullptr;
+        if (locked != nullptr && isMissing) {
+          resolved.systemDeps.push_back(*locked);
+        }
+      }
+    }
+  }
+
+  const bool hasLocked =
+      !resolved.gitDeps.empty() || !resolved.systemDeps.empty();
+  if (hasLocked || fs::exists(lockfilePath)) {
+    resolved.write(lockfilePath);
+  }
   return installed;
 }
 
+std::vector<DepMetadata>
+installDependencies(const bool includeDevDeps) {
+  const std::optional<Vendor> vendor = findVendor();
+  return installDependencies(
+      includeDevDeps, vendor.has_value() ? &vendor.value() : nullptr
+  );
+}
+
+// Copies the git dependencies of the package in effect into `vendorDir`,
+// and recurses into the dependencies which are cabin packages since they
+// have git dependencies of their own to build.
+static void
+vendorDependencies(
+    const bool includeDevDeps, const fs::path& vendorDir,
+    std::unordered_set<std::string>& visited, Lockfile& vendored
+) {
+  const std::vector<const Dependency*> deps =
+      collectDependencies(includeDevDeps);
+  // Ignore the vendored copies being replaced.
+  const std::vector<DepMetadata> installed =
+      installDependencies(includeDevDeps, /*vendor=*/nullptr);
+
+  for (size_t i = 0; i < deps.size(); ++i) {
+    if (const auto* dep = std::get_if<GitDependency>(deps[i])) {
+      if (vendored.findGitDep(dep->name, dep->url, dep->target) == nullptr) {
+        const fs::path dest = vendorDir / dep->dirName();
+        fs::remove_all(dest);
+        fs::create_directories(dest);
+        fs::copy(
+            dep->installDir(), dest,
+            fs::copy_options::recursive | fs::copy_options::copy_symlinks
+        );
+        // Checkouts share read-only files with the content store; the
+        // copies are the package's own.
+        for (const auto& entry : fs::recursive_directory_iterator(dest)) {
+          if (entry.is_regular_file() && !entry.is_symlink()) {
+            fs::permissions(
+                entry.path(), fs::perms::owner_write, fs::perm_options::add
+            );
+          }
+        }
+
+        const std::string revision = dep->revision();
+        logger::info(
+            "Vendoring", "{} {}", dep->name,
+            revision.substr(0, git2::SHORT_HASH_LEN)
+        );
+        vendored.gitDeps.push_back({ .name = dep->name,
+                                     .url = dep->url,
+                                     .target = dep->target,
+                                     .revision = revision });
+      }
+    }
+
+    const std::optional<fs::path>& root = installed[i].packageRoot;
+    if (root.has_value() && visited.insert(root->string()).second) {
+      const ScopedManifest scopedManifest(root.value() / "cabin.toml");
+      vendorDependencies(
+          /*includeDevDeps=*/false, vendorDir, visited, vendored
+      );
+    }
+  }
+}
+
+void
+vendorDependencies(const fs::path& vendorDir) {
+  const Lockfile previous = Lockfile::read(vendorDir / VENDOR_LOCKFILE);
+  std::unordered_set<std::string> visited;
+  Lockfile vendored;
+  vendorDependencies(/*includeDevDeps=*/true, vendorDir, visited, vendored);
+
+  // Remove what is no longer a dependency.
+  const auto dirName = [](const LockedGitDep& dep) {
+    const GitDependency gitDep{ .name = dep.name,
+                                .url = dep.url,
+                                .target = dep.target };
+    return gitDep.dirName();
+  };
+  std::unordered_set<std::string> kept;
+  for (const LockedGitDep& dep : vendored.gitDeps) {
+    kept.insert(dirName(dep));
+  }
+  for (const LockedGitDep& dep : previous.gitDeps) {
+    if (!kept.contains(dirName(dep))) {
+      fs::remove_all(vendorDir / dirName(dep));
+    }
+  }
+  fs::create_directories(vendorDir);
+  vendored.write(vendorDir / VENDOR_LOCKFILE);
+}
+
+void
+updateDependencies() {
+  const std::vector<const Dependency*> deps =
+      collectDependencies(/*includeDevDeps=*/true);
+
+  const fs::path lockfilePath = getLockfilePath();
+  const Lockfile lockfile = Lockfile::read(lockfilePath);
+  const Lockfile cache = Lockfile::read(getSystemDepCachePath());
+  Lockfile resolved;
+  static_cast<void>(
+      installDependencies(
+          deps, lockfile, cache, /*refresh=*/true, /*vendor=*/nullptr, resolved
+      )
+  );
+  updateSystemDepCache(cache, resolved);
+
+  for (const LockedGitDep& dep : resolved.gitDeps) {
+    const LockedGitDep* locked =
+        lockfile.findGitDep(dep.name, dep.url, dep.target);
+    const std::string newRev = dep.revision.substr(0, git2::SHORT_HASH_LEN);
+    if (locked == nullptr) {
+      logger::info("Locking", "{} {}", dep.name, newRev);
+    } else if (locked->revision != dep.revision) {
+      logger::info(
+          "Updating", "{} {} -> {}", dep.name,
+          locked->revision.substr(0, git2::SHORT_HASH_LEN), newRev
+      );
+    }
+  }
+  resolved.write(lockfilePath);
+}
+
 #ifdef CABIN_TEST
 
 namespace tests {
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "ContentStore.hpp"
 #include "Rustify/Aliases.hpp"
 #include "Semver.hpp"
+#include "Toolchain.hpp"
 
 #include <compare>
 #include <cstddef>
@@ -15,6 +17,13 @@
 struct DepMetadata {
   std::string includes;  // -Isomething
   std::string libs;      // -Lsomething -lsomething
+  // The directory containing cabin.toml if the dependency is a cabin package,
+  // which we build ourselves.
+  std::optional<fs::path> packageRoot = std::nullopt;
+  // The commit checked out for git dependencies.  The sources never change
+  // for a commit, so the build of a cabin package is cached and shared
+  // across projects, keyed by the commits of its dependencies among others.
+  std::optional<std::string> revision = std::nullopt;
 };
 
 struct Profile {
@@ -60,6 +69,27 @@ public:
   }
 };
 
+// Makes every function below read the given manifest instead of the one found
+// from the current directory while this object is alive.  This lets us
+// configure other packages, e.g., path dependencies and workspace members,
+// in-process.  Not thread-safe; create it only while nothing else reads the
+// manifest.
+class ScopedManifest {
+public:
+  explicit ScopedManifest(const fs::path& manifestPath);
+  ~ScopedManifest() noexcept;
+
+  ScopedManifest(const ScopedManifest&) = delete;
+  ScopedManifest(ScopedManifest&&) noexcept = delete;
+  ScopedManifest& operator=(const ScopedManifest&) = delete;
+  ScopedManifest& operator=(ScopedManifest&&) noexcept = delete;
+};
+
+const fs::path& getCacheDir();
+// The store sharing the files of git dependency checkouts.
+const ContentStore& getContentStore();
+/// Detected on first use, and cached across runs.
+const Toolchain& getToolchain();
 const fs::path& getManifestPath();
 fs::path getProjectBasePath();
 std::optional<std::string> validatePackageName(std::string_view name) noexcept;
@@ -69,4 +99,14 @@ const Version& getPackageVersion();
 const Profile& getDevProfile();
 const Profile& getReleaseProfile();
 const std::vector<std::string>& getLintCpplintFilters();
+bool isWorkspace();
+const std::vector<fs::path>& getWorkspaceMembers();
 std::vector<DepMetadata> installDependencies(bool includeDevDeps);
+/// Resolve every dependency afresh and rewrite cabin.lock.
+void updateDependencies();
+/// The directory of vendored dependencies if `[vendor]` in the manifest of
+/// the package being built enables them.
+std::optional<fs::path> getVendorDir();
+/// Install the dependencies, including dev-dependencies, as locked and copy
+/// every git dependency, direct or not, into `vendorDir`.
+void vendorDependencies(const fs::path& vendorDir);
@@ -0,0 +1,662 @@
+#include "PkgConfig.hpp"
+
+#include "Exception.hpp"
+#include "Logger.hpp"
+#include "Rustify.hpp"
+#include "Semver.hpp"
+#include "VersionReq.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fmt/ranges.h>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+static constexpr std::string_view WHITESPACE = " \t\r\n";
+
+static std::string_view
+trim(std::string_view str) noexcept {
+  const size_t start = str.find_first_not_of(WHITESPACE);
+  if (start == std::string_view::npos) {
+    return "";
+  }
+  const size_t end = str.find_last_not_of(WHITESPACE);
+  return str.substr(start, end - start + 1);
+}
+
+static std::vector<std::string>
+splitWhitespace(const std::string_view str) {
+  std::vector<std::string> tokens;
+  std::istringstream iss{ std::string(str) };
+  std::string token;
+  while (iss >> token) {
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+// Expands `${var}` and `$$`.
+static std::string
+expandVariables(
+    const std::string_view value,
+    const std::unordered_map<std::string, std::string>& vars,
+    const fs::path& path
+) {
+  std::string expanded;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] != '$' || i + 1 == value.size()) {
+      expanded += value[i];
+    } else if (value[i + 1] == '$') {
+      expanded += '$';
+      ++i;
+    } else if (value[i + 1] == '{') {
+      const size_t end = value.find('}', i + 2);
+      if (end == std::string_view::npos) {
+        throw CabinError(path.string(), ": unterminated variable reference");
+      }
+      const std::string var(value.substr(i + 2, end - i - 2));
+      const auto itr = vars.find(var);
+      if (itr == vars.end()) {
+        throw CabinError(path.string(), ": undefined variable `", var, "`");
+      }
+      expanded += itr->second;
+      i = end;
+    } else {
+      expanded += value[i];
+    }
+  }
+  return expanded;
+}
+
+static bool
+isPkgVersionOp(const std::string_view str) noexcept {
+  return str == "=" || str == "!=" || str == "<" || str == "<=" || str == ">"
+         || str == ">=";
+}
+
+// Parses, e.g., `glib-2.0 >= 2.50, zlib`.  Commas are optional, and the
+// operators may be attached to the names and versions.
+static std::vector<PcRequirement>
+parseRequirements(const std::string_view value) {
+  std::string spaced;
+  for (size_t i = 0; i < value.size(); ++i) {
+    const char c = value[i];
+    if (c == ',') {
+      spaced += ' ';
+    } else if (c == '<' || c == '>' || c == '=' || c == '!') {
+      const bool isTwoChars = i + 1 < value.size() && value[i + 1] == '=';
+      spaced += ' ';
+      spaced += c;
+      if (isTwoChars) {
+        spaced += '=';
+        ++i;
+      }
+      spaced += ' ';
+    } else {
+      spaced += c;
+    }
+  }
+
+  const std::vector<std::string> tokens = splitWhitespace(spaced);
+  std::vector<PcRequirement> requirements;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    PcRequirement req{ .name = tokens[i], .op = "", .version = "" };
+    if (i + 2 < tokens.size() && isPkgVersionOp(tokens[i + 1])) {
+      req.op = tokens[i + 1];
+      req.version = tokens[i + 2];
+      i += 2;
+    }
+    requirements.push_back(std::move(req));
+  }
+  return requirements;
+}
+
+PcFile
+PcFile::parse(const std::string_view contents, const fs::path& path) {
+  PcFile pcFile;
+  pcFile.path = path;
+  std::unordered_map<std::string, std::string> vars = {
+    { "pcfiledir", path.parent_path().string() },
+  };
+
+  std::istringstream iss{ std::string(contents) };
+  std::string line;
+  while (std::getline(iss, line)) {
+    // A trailing backslash continues the line.
+    while (!line.empty() && line.back() == '\\') {
+      line.pop_back();
+      std::string next;
+      if (!std::getline(iss, next)) {
+        break;
+      }
+      line += next;
+    }
+    if (const size_t comment = line.find('#');
+        comment != std::string::npos) {
+      line.erase(comment);
+    }
+
+    const std::string_view stmt = trim(line);
+    if (stmt.empty()) {
+      continue;
+    }
+    size_t keyEnd = 0;
+    while (keyEnd < stmt.size()
+           && (std::isalnum(static_cast<unsigned char>(stmt[keyEnd]))
+               || stmt[keyEnd] == '_' || stmt[keyEnd] == '.')) {
+      ++keyEnd;
+    }
+    const std::string key(stmt.substr(0, keyEnd));
+    const std::string_view rest = trim(stmt.substr(keyEnd));
+    if (key.empty() || rest.empty() || (rest[0] != '=' && rest[0] != ':')) {
+      throw CabinError(path.string(), ": unexpected line `", stmt, "`");
+    }
+    const std::string value =
+        expandVariables(trim(rest.substr(1)), vars, path);
+
+    if (rest[0] == '=') {
+      vars[key] = value;
+    } else if (key == "Name") {
+      pcFile.name = value;
+    } else if (key == "Version") {
+      pcFile.version = value;
+    } else if (key == "Cflags" || key == "CFlags") {
+      pcFile.cflags = value;
+    } else if (key == "Libs") {
+      pcFile.libs = value;
+    } else if (key == "Requires") {
+      pcFile.required = parseRequirements(value);
+    } else if (key == "Requires.private") {
+      pcFile.requiredPrivate = parseRequirements(value);
+    }
+    // Other fields, e.g., Libs.private and Conflicts, don't matter for
+    // dynamic linking.
+  }
+  return pcFile;
+}
+
+int
+comparePkgVersions(const std::string_view lhs, const std::string_view rhs
+) noexcept {
+  const auto isDigit = [](const char c) {
+    return std::isdigit(static_cast<unsigned char>(c)) != 0;
+  };
+  const auto isAlpha = [](const char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) != 0;
+  };
+
+  size_t i = 0;
+  size_t j = 0;
+  while (i < lhs.size() || j < rhs.size()) {
+    while (i < lhs.size() && !isDigit(lhs[i]) && !isAlpha(lhs[i])) {
+      ++i;
+    }
+    while (j < rhs.size() && !isDigit(rhs[j]) && !isAlpha(rhs[j])) {
+      ++j;
+    }
+    if (i == lhs.size() || j == rhs.size()) {
+      break;
+    }
+
+    const bool isNum = isDigit(lhs[i]);
+    if (isNum != isDigit(rhs[j])) {
+      // A numeric segment is newer than an alphabetic one.
+      return isNum ? 1 : -1;
+    }
+
+    const auto inSegment = [&](const char c) {
+      return isNum ? isDigit(c) : isAlpha(c);
+    };
+    const auto segmentEnd = [&](const std::string_view str, size_t pos) {
+      while (pos < str.size() && inSegment(str[pos])) {
+        ++pos;
+      }
+      return pos;
+    };
+    const size_t lhsEnd = segmentEnd(lhs, i);
+    const size_t rhsEnd = segmentEnd(rhs, j);
+    std::string_view lhsSeg = lhs.substr(i, lhsEnd - i);
+    std::string_view rhsSeg = rhs.substr(j, rhsEnd - j);
+    i = lhsEnd;
+    j = rhsEnd;
+
+    if (isNum) {
+      const auto stripZeros = [](std::string_view& seg) {
+        seg.remove_prefix(std::min(seg.find_first_not_of('0'), seg.size()));
+      };
+      stripZeros(lhsSeg);
+      stripZeros(rhsSeg);
+      if (lhsSeg.size() != rhsSeg.size()) {
+        return lhsSeg.size() < rhsSeg.size() ? -1 : 1;
+      }
+    }
+    if (const int cmp = lhsSeg.compare(rhsSeg); cmp != 0) {
+      return cmp < 0 ? -1 : 1;
+    }
+  }
+
+  if (i == lhs.size() && j == rhs.size()) {
+    return 0;
+  }
+  return i == lhs.size() ? -1 : 1;
+}
+
+static bool
+satisfies(const std::string_view version, const PcRequirement& req) noexcept {
+  if (req.op.empty()) {
+    return true;
+  }
+  const int cmp = comparePkgVersions(version, req.version);
+  if (req.op == "=") {
+    return cmp == 0;
+  } else if (req.op == "!=") {
+    return cmp != 0;
+  } else if (req.op == "<") {
+    return cmp < 0;
+  } else if (req.op == "<=") {
+    return cmp <= 0;
+  } else if (req.op == ">") {
+    return cmp > 0;
+  } else {
+    return cmp >= 0;
+  }
+}
+
+// Pads versions such as `1.2` to `1.2.0` to check them with VersionReq.
+static std::optional<Version>
+toSemver(std::string version) {
+  const auto numDots = std::ranges::count(version, '.');
+  for (auto i = numDots; i < 2; ++i) {
+    version += ".0";
+  }
+  try {
+    return Version::parse(version);
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+}
+
+static std::vector<fs::path>
+splitSearchPath(const char* envP) {
+  std::vector<fs::path> dirs;
+  if (envP == nullptr) {
+    return dirs;
+  }
+  std::istringstream iss(envP);
+  std::string dir;
+  while (std::getline(iss, dir, ':')) {
+    if (!dir.empty()) {
+      dirs.emplace_back(dir);
+    }
+  }
+  return dirs;
+}
+
+// pkg-config searches ${libdir}/pkgconfig and ${datadir}/pkgconfig of the
+// prefix it was installed to by default, plus the multiarch directories on
+// Debian-like systems.  We guess the prefix from the location of pkg-config
+// in $PATH.
+static std::vector<fs::path>
+getDefaultSearchPath() {
+  std::optional<fs::path> prefix;
+  for (const fs::path& dir : splitSearchPath(std::getenv("PATH"))) {
+    if (fs::exists(dir / "pkg-config")) {
+      prefix = fs::weakly_canonical(dir / "pkg-config").parent_path();
+      prefix = prefix->parent_path();
+      break;
+    }
+  }
+
+  std::vector<fs::path> prefixes;
+  if (!prefix.has_value() || prefix.value() == "/usr") {
+    prefixes = { "/usr/local", "/usr" };
+  } else {
+    prefixes = { prefix.value() };
+  }
+
+  std::vector<fs::path> dirs;
+  for (const fs::path& prefix : prefixes) {
+    std::vector<fs::path> multiarch;
+    if (fs::is_directory(prefix / "lib")) {
+      for (const auto& entry : fs::directory_iterator(prefix / "lib")) {
+        const std::string name = entry.path().filename().string();
+        if (name.find("-linux-") != std::string::npos) {
+          multiarch.push_back(entry.path() / "pkgconfig");
+        }
+      }
+    }
+    std::ranges::sort(multiarch);
+    dirs.insert(dirs.end(), multiarch.begin(), multiarch.end());
+    dirs.push_back(prefix / "lib64" / "pkgconfig");
+    dirs.push_back(prefix / "lib" / "pkgconfig");
+    dirs.push_back(prefix / "share" / "pkgconfig");
+  }
+  return dirs;
+}
+
+PkgConfig::PkgConfig() {
+  searchPath = splitSearchPath(std::getenv("PKG_CONFIG_PATH"));
+  std::vector<fs::path> libdirs =
+      std::getenv("PKG_CONFIG_LIBDIR") != nullptr
+          ? splitSearchPath(std::getenv("PKG_CONFIG_LIBDIR"))
+          : getDefaultSearchPath();
+  searchPath.insert(searchPath.end(), libdirs.begin(), libdirs.end());
+  std::erase_if(searchPath, [](const fs::path& dir) {
+    return !fs::is_directory(dir);
+  });
+}
+
+PkgConfig::PkgConfig(std::vector<fs::path> searchPath) noexcept
+    : searchPath(std::move(searchPath)) {}
+
+const PcFile*
+PkgConfig::find(const std::string& name) {
+  if (const auto itr = pcFiles.find(name); itr != pcFiles.end()) {
+    return itr->second.has_value() ? &itr->second.value() : nullptr;
+  }
+
+  std::optional<PcFile> found;
+  for (const fs::path& dir : searchPath) {
+    const fs::path path = dir / (name + ".pc");
+    if (!fs::exists(path)) {
+      continue;
+    }
+    try {
+      std::ifstream ifs(path);
+      const std::string contents(
+          (std::istreambuf_iterator<char>(ifs)),
+          std::istreambuf_iterator<char>()
+      );
+      found = PcFile::parse(contents, path);
+    } catch (const CabinError& e) {
+      logger::debug("{}", e.what());
+    }
+    break;
+  }
+
+  const auto [itr, inserted] = pcFiles.emplace(name, std::move(found));
+  return itr->second.has_value() ? &itr->second.value() : nullptr;
+}
+
+// pkg-config drops these since the compiler searches them anyway.
+static bool
+isSystemDirFlag(const std::string_view flag) noexcept {
+  if (flag == "-I/usr/include") {
+    return true;
+  }
+  for (const std::string_view libdir : { "-L/usr/lib", "-L/lib" }) {
+    if (!flag.starts_with(libdir)) {
+      continue;
+    }
+    const std::string_view rest = flag.substr(libdir.size());
+    // e.g., -L/usr/lib64 and -L/usr/lib/x86_64-linux-gnu
+    if (rest.empty() || rest == "64"
+        || (rest.starts_with('/') && rest.find("-linux-") != std::string::npos
+            && rest.find('/', 1) == std::string_view::npos)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Joins the flags of `pkgs` in order.  Like pkg-config, a repeated flag is
+// dropped, keeping the first occurrence if `keepLast` is false and the last
+// one otherwise; libraries must come after their users.  Returns
+// std::nullopt for quoted or escaped flags, which pkg-config tokenizes with
+// shell rules.
+static std::optional<std::string>
+joinFlags(
+    const std::vector<const PcFile*>& pkgs, std::string PcFile::* field,
+    const bool keepLast
+) {
+  std::vector<std::string> flags;
+  for (const PcFile* pkg : pkgs) {
+    const std::string& value = pkg->*field;
+    if (value.find_first_of("\"'\\") != std::string::npos) {
+      return std::nullopt;
+    }
+    for (std::string& flag : splitWhitespace(value)) {
+      if (!isSystemDirFlag(flag)) {
+        flags.push_back(std::move(flag));
+      }
+    }
+  }
+  if (keepLast) {
+    std::ranges::reverse(flags);
+  }
+
+  std::vector<std::string> deduped;
+  std::unordered_set<std::string> seen;
+  for (std::string& flag : flags) {
+    if (seen.insert(flag).second) {
+      deduped.push_back(std::move(flag));
+    }
+  }
+  if (keepLast) {
+    std::ranges::reverse(deduped);
+  }
+  return fmt::format("{}", fmt::join(deduped, " "));
+}
+
+bool
+PkgConfig::collect(
+    const PcFile* pkg, const bool withPrivate,
+    std::vector<const PcFile*>& stack, std::vector<const PcFile*>& preorder
+) {
+  if (std::ranges::find(stack, pkg) != stack.end()) {
+    return true;  // a cycle, which pkg-config ignores as well
+  }
+  if (preorder.size() >= MAX_EXPANDED_PKGS) {
+    logger::debug("{}: too many requirements", pkg->path.string());
+    return false;
+  }
+  preorder.push_back(pkg);
+  stack.push_back(pkg);
+
+  std::vector<const PcRequirement*> reqs;
+  for (const PcRequirement& req : pkg->required) {
+    reqs.push_back(&req);
+  }
+  if (withPrivate) {
+    for (const PcRequirement& req : pkg->requiredPrivate) {
+      reqs.push_back(&req);
+    }
+  }
+  for (const PcRequirement* req : reqs) {
+    const PcFile* found = find(req->name);
+    if (found == nullptr || !satisfies(found->version, *req)) {
+      logger::debug(
+          "{}: requirement `{} {} {}` not found", pkg->path.string(),
+          req->name, req->op, req->version
+      );
+      return false;
+    }
+    if (!collect(found, withPrivate, stack, preorder)) {
+      return false;
+    }
+  }
+  stack.pop_back();
+  return true;
+}
+
+std::optional<PkgConfigResult>
+PkgConfig::resolve(const std::string& name, const VersionReq& versionReq) {
+  if (std::getenv("PKG_CONFIG_SYSROOT_DIR") != nullptr) {
+    // pkg-config rewrites the flags then.
+    return std::nullopt;
+  }
+
+  const PcFile* root = find(name);
+  if (root == nullptr) {
+    return std::nullopt;
+  }
+  const std::optional<Version> version = toSemver(root->version);
+  if (!version.has_value() || !versionReq.satisfiedBy(version.value())) {
+    return std::nullopt;
+  }
+
+  // Every package followed by the packages it requires, recursively and
+  // in order, even if they have appeared before; deduplicating the libs
+  // then moves each library after all of its users.  Libs only follow
+  // Requires, while Cflags also follow Requires.private.
+  std::vector<const PcFile*> stack;
+  std::vector<const PcFile*> cflagsPkgs;
+  if (!collect(root, /*withPrivate=*/true, stack, cflagsPkgs)) {
+    return std::nullopt;
+  }
+  stack.clear();
+  std::vector<const PcFile*> libsPkgs;
+  if (!collect(root, /*withPrivate=*/false, stack, libsPkgs)) {
+    return std::nullopt;
+  }
+
+  const std::optional<std::string> cflags =
+      joinFlags(cflagsPkgs, &PcFile::cflags, /*keepLast=*/false);
+  const std::optional<std::string> libs =
+      joinFlags(libsPkgs, &PcFile::libs, /*keepLast=*/true);
+  if (!cflags.has_value() || !libs.has_value()) {
+    return std::nullopt;
+  }
+
+  PkgConfigResult result{ .cflags = cflags.value(),
+                          .libs = libs.value(),
+                          .pcFiles = {} };
+  std::unordered_set<const PcFile*> seen;
+  for (const PcFile* pkg : cflagsPkgs) {
+    if (seen.insert(pkg).second) {
+      result.pcFiles.push_back(pkg->path);
+    }
+  }
+  return result;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+static void
+testParse() {
+  const PcFile pcFile = PcFile::parse(
+      "# comment\n"
+      "prefix=/opt/foo\n"
+      "libdir=${prefix}/lib  # trailing comment\n"
+      "includedir=${prefix}/include\n"
+      "\n"
+      "Name: foo\n"
+      "Version: 1.2\n"
+      "Requires: bar >= 1.0, baz\n"
+      "Requires.private: qux<2\n"
+      "Cflags: -I${includedir} \\\n"
+      "  -DFOO\n"
+      "Libs: -L${libdir} -lfoo\n",
+      "/opt/foo/lib/pkgconfig/foo.pc"
+  );
+  assertEq(pcFile.name, "foo");
+  assertEq(pcFile.version, "1.2");
+  assertEq(pcFile.cflags, "-I/opt/foo/include   -DFOO");
+  assertEq(pcFile.libs, "-L/opt/foo/lib -lfoo");
+  assertEq(pcFile.required.size(), 2UL);
+  assertEq(pcFile.required[0].name, "bar");
+  assertEq(pcFile.required[0].op, ">=");
+  assertEq(pcFile.required[0].version, "1.0");
+  assertEq(pcFile.required[1].name, "baz");
+  assertEq(pcFile.required[1].op, "");
+  assertEq(pcFile.requiredPrivate.size(), 1UL);
+  assertEq(pcFile.requiredPrivate[0].name, "qux");
+  assertEq(pcFile.requiredPrivate[0].op, "<");
+  assertEq(pcFile.requiredPrivate[0].version, "2");
+
+  pass();
+}
+
+static void
+testParsePcfiledir() {
+  const PcFile pcFile = PcFile::parse(
+      "prefix=${pcfiledir}/../..\nCflags: -I${prefix}/include\n",
+      "/opt/foo/lib/pkgconfig/foo.pc"
+  );
+  assertEq(pcFile.cflags, "-I/opt/foo/lib/pkgconfig/../../include");
+
+  assertException<CabinError>(
+      [] { PcFile::parse("Cflags: -I${nope}\n", "/x/foo.pc"); },
+      "/x/foo.pc: undefined variable `nope`"
+  );
+
+  pass();
+}
+
+static void
+testComparePkgVersions() {
+  assertEq(comparePkgVersions("1.2.11", "1.2.11"), 0);
+  assertEq(comparePkgVersions("1.2.11", "1.2.3"), 1);
+  assertEq(comparePkgVersions("1.10", "1.9"), 1);
+  assertEq(comparePkgVersions("1.2", "1.2.0"), -1);
+  assertEq(comparePkgVersions("2.0a", "2.0b"), -1);
+  assertEq(comparePkgVersions("2.0", "2.0a"), -1);
+  assertEq(comparePkgVersions("1.01", "1.1"), 0);
+
+  pass();
+}
+
+static void
+testResolve() {
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-pkgconfig";
+  fs::create_directories(dir);
+  std::ofstream(dir / "foo.pc")
+      << "Name: foo\nVersion: 1.2.3\nRequires: bar >= 2\n"
+         "Requires.private: baz\nCflags: -I/opt/foo\nLibs: -lfoo -lm\n";
+  std::ofstream(dir / "bar.pc")
+      << "Name: bar\nVersion: 2.1\nCflags: -I/opt/bar -I/usr/include\n"
+         "Libs: -L/usr/lib -lbar -lm\n";
+  std::ofstream(dir / "baz.pc")
+      << "Name: baz\nVersion: 0.1\nCflags: -I/opt/baz\nLibs: -lbaz\n";
+  std::ofstream(dir / "old.pc") << "Name: old\nVersion: 0.9\nRequires: bar\n";
+  std::ofstream(dir / "broken.pc")
+      << "Name: broken\nVersion: 1.0\nRequires: nowhere\n";
+
+  PkgConfig pkgConfig({ dir });
+
+  const auto foo = pkgConfig.resolve("foo", VersionReq::parse(">=1.0.0"));
+  assertTrue(foo.has_value());
+  assertEq(foo->cflags, "-I/opt/foo -I/opt/bar -I/opt/baz");
+  assertEq(foo->libs, "-lfoo -lbar -lm");
+  assertEq(foo->pcFiles.size(), 3UL);
+
+  const VersionReq anyVersion = VersionReq::parse(">=0.0.0");
+  // Doesn't satisfy the version requirement.
+  assertFalse(
+      pkgConfig.resolve("old", VersionReq::parse(">=1.0.0")).has_value()
+  );
+  // Requires a missing package.
+  assertFalse(pkgConfig.resolve("broken", anyVersion).has_value());
+  assertFalse(pkgConfig.resolve("missing", anyVersion).has_value());
+
+  fs::remove_all(dir);
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testParse();
+  tests::testParsePcfiledir();
+  tests::testComparePkgVersions();
+  tests::testResolve();
+}
+
+#endif
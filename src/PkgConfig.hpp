@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+#include "VersionReq.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// An entry of `Requires` or `Requires.private`, e.g., `zlib >= 1.2`.
+struct PcRequirement {
+  std::string name;
+  std::string op;  // empty if no version is required
+  std::string version;
+};
+
+// A parsed .pc file with its variables expanded.
+struct PcFile {
+  fs::path path;
+  std::string name;
+  std::string version;
+  std::string cflags;
+  std::string libs;
+  std::vector<PcRequirement> required;
+  std::vector<PcRequirement> requiredPrivate;
+
+  /// Parse the contents of a .pc file located at `path`.  Throws CabinError
+  /// if it uses what we don't support, e.g., undefined variables.
+  static PcFile parse(std::string_view contents, const fs::path& path);
+};
+
+struct PkgConfigResult {
+  std::string cflags;
+  std::string libs;
+  // The .pc files the flags came from.
+  std::vector<fs::path> pcFiles;
+};
+
+// Resolves packages from .pc files in-process like `pkg-config --cflags` and
+// `pkg-config --libs` do, without spawning a process per query.  Parsed
+// files are shared across queries.  Not thread-safe.
+class PkgConfig {
+  // Bounds the expansion of deeply shared requirements; we fall back to
+  // pkg-config beyond this.
+  static constexpr std::size_t MAX_EXPANDED_PKGS = 10000;
+
+public:
+  /// Search $PKG_CONFIG_PATH, then $PKG_CONFIG_LIBDIR or, if unset, the
+  /// directories pkg-config in $PATH would search by default.
+  PkgConfig();
+  explicit PkgConfig(std::vector<fs::path> searchPath) noexcept;
+
+  const std::vector<fs::path>& getSearchPath() const noexcept {
+    return searchPath;
+  }
+
+  /// Returns std::nullopt whenever the answer might differ from what
+  /// pkg-config would say, e.g., when the package is not found, since
+  /// pkg-config may know more directories, or the version doesn't satisfy
+  /// `versionReq`.  The caller should fall back to pkg-config then.
+  std::optional<PkgConfigResult>
+  resolve(const std::string& name, const VersionReq& versionReq);
+
+private:
+  std::vector<fs::path> searchPath;
+  // std::nullopt for packages not found or not parsable.
+  std::unordered_map<std::string, std::optional<PcFile>> pcFiles;
+
+  const PcFile* find(const std::string& name);
+  /// Append `pkg` and the packages it requires in preorder.  Returns false
+  /// if a requirement is not found or doesn't satisfy its version.
+  bool collect(
+      const PcFile* pkg, bool withPrivate, std::vector<const PcFile*>& stack,
+      std::vector<const PcFile*>& preorder
+  );
+};
+
+/// Compare two versions the way pkg-config does (rpmvercmp): alternating
+/// runs of digits and letters are compared one by one, numerically for
+/// digits.  Returns a negative, zero, or positive value.
+int comparePkgVersions(std::string_view lhs, std::string_view rhs) noexcept;
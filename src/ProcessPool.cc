@@ -0,0 +1,645 @@
+#include "ProcessPool.hpp"
+
+#include "Command.hpp"
+#include "Exception.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#  include <sys/epoll.h>
+#  include <sys/syscall.h>
+#else
+#  include <poll.h>
+#endif
+
+// Large reads keep the number of wakeups low for verbose commands, e.g.,
+// the preprocessor.
+static constexpr size_t READ_SIZE = 65536;
+// How often to check for exited children where pidfds are unavailable.
+static constexpr int REAP_INTERVAL_MS = 10;
+// How long killed commands may take to exit before SIGKILL.
+static constexpr std::chrono::milliseconds KILL_GRACE_PERIOD{ 500 };
+
+namespace {
+
+// Waits until any of the added file descriptors is readable or hung up.
+#ifdef __linux__
+class Poller {
+public:
+  Poller() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epollFd == -1) {
+      throw CabinError("epoll_create1() failed");
+    }
+  }
+  ~Poller() {
+    close(epollFd);
+  }
+
+  Poller(const Poller&) = delete;
+  Poller& operator=(const Poller&) = delete;
+  Poller(Poller&&) = delete;
+  Poller& operator=(Poller&&) = delete;
+
+  void add(const int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+      throw CabinError("epoll_ctl() failed");
+    }
+  }
+  void remove(const int fd) noexcept {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  /// Returns the ready file descriptors, or none if interrupted by a signal
+  /// or after `timeoutMs` unless it is -1.
+  std::vector<int> wait(const int timeoutMs) {
+    std::array<epoll_event, 64> events{};
+    const int count = epoll_wait(
+        epollFd, events.data(), static_cast<int>(events.size()), timeoutMs
+    );
+    if (count == -1) {
+      if (errno == EINTR) {
+        return {};
+      }
+      throw CabinError("epoll_wait() failed");
+    }
+
+    std::vector<int> ready;
+    for (int i = 0; i < count; ++i) {
+      ready.push_back(events[static_cast<size_t>(i)].data.fd);
+    }
+    return ready;
+  }
+
+private:
+  int epollFd;
+};
+#else
+class Poller {
+public:
+  void add(const int fd) {
+    fds.push_back({ .fd = fd, .events = POLLIN, .revents = 0 });
+  }
+  void remove(const int fd) noexcept {
+    std::erase_if(fds, [fd](const pollfd& entry) { return entry.fd == fd; });
+  }
+
+  /// Returns the ready file descriptors, or none if interrupted by a signal
+  /// or after `timeoutMs` unless it is -1.
+  std::vector<int> wait(const int timeoutMs) {
+    if (poll(fds.data(), fds.size(), timeoutMs) == -1) {
+      if (errno == EINTR) {
+        return {};
+      }
+      throw CabinError("poll() failed");
+    }
+
+    std::vector<int> ready;
+    for (const pollfd& entry : fds) {
+      if (entry.revents != 0) {
+        ready.push_back(entry.fd);
+      }
+    }
+    return ready;
+  }
+
+private:
+  std::vector<pollfd> fds;
+};
+#endif
+
+// The write end of the pipe which SIGINT and SIGTERM are reported to.
+std::atomic<int> signalWriteFd = -1;
+
+void
+reportSignal(const int sig) {
+  const int fd = signalWriteFd.load();
+  if (fd != -1) {
+    const char byte = static_cast<char>(sig);
+    static_cast<void>(write(fd, &byte, 1));
+  }
+}
+
+// While alive, SIGINT and SIGTERM are written to a pipe instead of
+// terminating us.  If another pool is already waiting, e.g., on another
+// thread, that one handles them, and readFd() is -1.
+class SignalPipe {
+public:
+  SignalPipe() {
+    if (pipe(fds.data()) == -1) {
+      throw CabinError("pipe() failed");
+    }
+    for (const int fd : fds) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    int none = -1;
+    if (!signalWriteFd.compare_exchange_strong(none, fds[1])) {
+      closeFds();
+      return;
+    }
+    struct sigaction action {};
+    action.sa_handler = reportSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &oldIntAction);
+    sigaction(SIGTERM, &action, &oldTermAction);
+    isInstalled = true;
+  }
+  ~SignalPipe() {
+    restore();
+    closeFds();
+  }
+
+  SignalPipe(const SignalPipe&) = delete;
+  SignalPipe& operator=(const SignalPipe&) = delete;
+  SignalPipe(SignalPipe&&) = delete;
+  SignalPipe& operator=(SignalPipe&&) = delete;
+
+  int readFd() const noexcept {
+    return fds[0];
+  }
+
+  /// Restore the previous signal handlers.
+  void restore() noexcept {
+    if (!isInstalled) {
+      return;
+    }
+    sigaction(SIGINT, &oldIntAction, nullptr);
+    sigaction(SIGTERM, &oldTermAction, nullptr);
+    signalWriteFd = -1;
+    isInstalled = false;
+  }
+
+private:
+  std::array<int, 2> fds{ -1, -1 };
+  bool isInstalled = false;
+  struct sigaction oldIntAction {};
+  struct sigaction oldTermAction {};
+
+  void closeFds() noexcept {
+    for (int& fd : fds) {
+      if (fd != -1) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+};
+
+}  // namespace
+
+// A file descriptor which becomes readable once `pid` exits, or -1 if the
+// system lacks pidfds.
+static int
+openPidFd(const pid_t pid) noexcept {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  static_cast<void>(pid);
+  return -1;
+#endif
+}
+
+struct ProcessPool::Proc {
+  Callback onExit;
+  OutputSink onStdOut;
+  std::string command;
+  std::chrono::steady_clock::time_point startTime;
+  pid_t pid;
+  int stdOutFd;
+  int stdErrFd;
+  int pidFd;
+  CommandOutput output{};
+  std::optional<int> status = std::nullopt;
+
+  // Reaps the process, blocking unless `options` has WNOHANG.  Returns false
+  // if it has not exited yet.
+  bool reap(const int options) {
+    int exitStatus{};
+    struct rusage usage {};
+    if (wait4(pid, &exitStatus, options, &usage) <= 0) {
+      return false;
+    }
+    status = exitStatus;
+    output.elapsed = std::chrono::steady_clock::now() - startTime;
+    output.usage = ResourceUsage::from(usage);
+    recordUsage(command, output.usage);
+    return true;
+  }
+
+  bool isDone() const noexcept {
+    return status.has_value() && stdOutFd == -1 && stdErrFd == -1;
+  }
+  // Without a pidfd, the exit is noticed by polling waitpid().
+  bool needsReaping() const noexcept {
+    return !status.has_value() && pidFd == -1 && stdOutFd == -1
+           && stdErrFd == -1;
+  }
+};
+
+ProcessPool::ProcessPool(const size_t maxProcs)
+    : maxProcs(std::max<size_t>(maxProcs, 1)) {}
+
+ProcessPool::~ProcessPool() {
+  killAll(SIGTERM);
+}
+
+void
+ProcessPool::submit(Command cmd, Callback onExit, OutputSink onStdOut) {
+  cmd.setStdOutConfig(Command::IOConfig::Piped)
+      .setStdErrConfig(Command::IOConfig::Piped)
+      .setNewProcessGroup(true);
+  queue.push_back(
+      { .cmd = std::move(cmd),
+        .onExit = std::move(onExit),
+        .onStdOut = std::move(onStdOut) }
+  );
+}
+
+void
+ProcessPool::killAll(const int sig) noexcept {
+  for (const std::unique_ptr<Proc>& proc : running) {
+    kill(-proc->pid, sig);
+  }
+  // Give them a moment to clean up, e.g., temporary files, and then kill
+  // whatever is left, including those ignoring `sig`.
+  const auto deadline = std::chrono::steady_clock::now() + KILL_GRACE_PERIOD;
+  for (const std::unique_ptr<Proc>& proc : running) {
+    int status{};
+    while (!proc->status.has_value()) {
+      if (waitpid(proc->pid, &status, WNOHANG) != 0) {
+        proc->status = status;
+      } else if (std::chrono::steady_clock::now() >= deadline) {
+        kill(-proc->pid, SIGKILL);
+        waitpid(proc->pid, &status, 0);
+        proc->status = status;
+      } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(REAP_INTERVAL_MS)
+        );
+      }
+    }
+    // Children of the command may still be alive.
+    kill(-proc->pid, SIGKILL);
+    for (const int fd : { proc->stdOutFd, proc->stdErrFd, proc->pidFd }) {
+      if (fd != -1) {
+        close(fd);
+      }
+    }
+  }
+  running.clear();
+  queue.clear();
+}
+
+void
+ProcessPool::wait() {
+  Poller poller;
+  SignalPipe signalPipe;
+  if (signalPipe.readFd() != -1) {
+    poller.add(signalPipe.readFd());
+  }
+  std::vector<char> buffer(READ_SIZE);
+
+  const auto startNext = [&] {
+    Queued next = std::move(queue.front());
+    queue.pop_front();
+    logger::trace("Running `{}`", next.cmd.toString());
+    const Child child = next.cmd.spawn();
+    running.push_back(std::make_unique<Proc>(Proc{
+        .onExit = std::move(next.onExit),
+        .onStdOut = std::move(next.onStdOut),
+        .command = child.command,
+        .startTime = child.startTime,
+        .pid = child.pid,
+        .stdOutFd = child.stdOutFd,
+        .stdErrFd = child.stdErrFd,
+        .pidFd = openPidFd(child.pid),
+    }));
+    for (const int fd : { child.stdOutFd, child.stdErrFd,
+                          running.back()->pidFd }) {
+      if (fd != -1) {
+        poller.add(fd);
+      }
+    }
+  };
+
+  const auto handleReady = [&](const int fd) {
+    const auto itr = std::ranges::find_if(running, [fd](const auto& proc) {
+      return fd == proc->stdOutFd || fd == proc->stdErrFd || fd == proc->pidFd;
+    });
+    Proc& proc = **itr;
+    if (fd == proc.pidFd) {
+      proc.reap(0);
+      poller.remove(fd);
+      close(fd);
+      proc.pidFd = -1;
+      return;
+    }
+
+    const ssize_t count = read(fd, buffer.data(), buffer.size());
+    if (count == -1 && errno == EINTR) {
+      return;
+    }
+    if (count > 0) {
+      const std::string_view chunk(buffer.data(), static_cast<size_t>(count));
+      if (fd == proc.stdErrFd) {
+        proc.output.stdErr.append(chunk);
+        return;
+      }
+      if (!proc.onStdOut) {
+        proc.output.stdOut.append(chunk);
+        return;
+      }
+      if (proc.onStdOut(chunk)) {
+        return;
+      }
+    }
+    // EOF, an error, after which nothing more can be read either, or the
+    // sink wants no more.
+    poller.remove(fd);
+    close(fd);
+    (fd == proc.stdOutFd ? proc.stdOutFd : proc.stdErrFd) = -1;
+  };
+
+  try {
+    while (!queue.empty() || !running.empty()) {
+      while (!queue.empty() && running.size() < maxProcs) {
+        startNext();
+      }
+
+      const bool needsReaping = std::ranges::any_of(
+          running, [](const auto& proc) { return proc->needsReaping(); }
+      );
+      for (const int fd : poller.wait(needsReaping ? REAP_INTERVAL_MS : -1)) {
+        if (fd != signalPipe.readFd()) {
+          handleReady(fd);
+          continue;
+        }
+
+        char sig = 0;
+        static_cast<void>(read(fd, &sig, 1));
+        logger::debug("killing {} commands on signal {}", running.size(), +sig);
+        killAll(sig);
+        signalPipe.restore();
+        raise(sig);
+        throw CabinError("interrupted");
+      }
+
+      for (const std::unique_ptr<Proc>& proc : running) {
+        if (proc->needsReaping()) {
+          proc->reap(WNOHANG);
+        }
+      }
+
+      // Take the finished ones out first, so that the callbacks may submit
+      // more commands.
+      std::vector<std::unique_ptr<Proc>> finished;
+      for (std::unique_ptr<Proc>& proc : running) {
+        if (proc->isDone()) {
+          finished.push_back(std::move(proc));
+        }
+      }
+      std::erase(running, nullptr);
+      for (const std::unique_ptr<Proc>& proc : finished) {
+        proc->output.exitCode = toExitCode(proc->status.value());
+        proc->onExit(std::move(proc->output));
+      }
+    }
+  } catch (...) {
+    killAll(SIGTERM);
+    throw;
+  }
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Aliases.hpp"
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+static void
+testOutputs() {
+  ProcessPool pool(4);
+  std::vector<std::string> outputs(8);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    pool.submit(
+        Command("sh").addArg("-c").addArg(
+            "echo out " + std::to_string(i) + "; echo err >&2; exit "
+            + std::to_string(i % 2)
+        ),
+        [&outputs, i](const CommandOutput& output) {
+          outputs[i] = std::to_string(output.exitCode) + ' ' + output.stdOut
+                       + output.stdErr;
+        }
+    );
+  }
+  pool.wait();
+
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    assertEq(
+        outputs[i],
+        std::to_string(i % 2) + " out " + std::to_string(i) + "\nerr\n"
+    );
+  }
+
+  pass();
+}
+
+static void
+testLargeOutput() {
+  ProcessPool pool(2);
+  size_t size = 0;
+  // More than a pipe holds, on both pipes at once.
+  pool.submit(
+      Command("sh").addArg("-c").addArg(
+          "head -c 1000000 /dev/zero; head -c 1000000 /dev/zero >&2"
+      ),
+      [&size](const CommandOutput& output) {
+        size = output.stdOut.size() + output.stdErr.size();
+      }
+  );
+  pool.wait();
+  assertEq(size, 2000000UL);
+
+  pass();
+}
+
+static void
+testStreaming() {
+  ProcessPool pool(1);
+  size_t streamed = 0;
+  size_t buffered = 1;
+  pool.submit(
+      Command("head").addArg("-c").addArg("1000000").addArg("/dev/zero"),
+      [&buffered](const CommandOutput& output) {
+        buffered = output.stdOut.size();
+      },
+      [&streamed](const std::string_view chunk) {
+        streamed += chunk.size();
+        return true;
+      }
+  );
+  pool.wait();
+  assertEq(streamed, 1000000UL);
+  assertEq(buffered, 0UL);
+
+  pass();
+}
+
+static void
+testStopReading() {
+  ProcessPool pool(1);
+  int exitCode = 0;
+  // `yes` never stops writing by itself.
+  pool.submit(
+      Command("yes"),
+      [&exitCode](const CommandOutput& output) { exitCode = output.exitCode; },
+      [](std::string_view) { return false; }
+  );
+  pool.wait();
+  assertEq(exitCode, 128 + SIGPIPE);
+
+  pass();
+}
+
+static void
+testResourceUsage() {
+  ProcessPool pool(1);
+  ResourceUsage usage;
+  double elapsed = 0;
+  pool.submit(
+      Command("sh").addArg("-c").addArg(
+          "i=0; while [ $i -lt 100000 ]; do i=$((i + 1)); done"
+      ),
+      [&](const CommandOutput& output) {
+        usage = output.usage;
+        elapsed = output.elapsed.count();
+      }
+  );
+  pool.wait();
+  assertTrue(usage.cpuSec() > 0);
+  assertTrue(elapsed >= usage.userSec);
+  assertTrue(usage.maxRssKiB > 0);
+
+  const std::vector<CommandUsage> recorded = getRecordedUsages();
+  assertTrue(recorded.back().command.starts_with("sh -c i=0;"));
+  assertEq(recorded.back().usage.maxRssKiB, usage.maxRssKiB);
+
+  pass();
+}
+
+static void
+testSerial() {
+  // Each command holds a directory while it runs, so overlapping ones would
+  // fail to create it.
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-serial";
+  fs::remove_all(dir);
+  ProcessPool pool(1);
+  size_t numSucceeded = 0;
+  for (int i = 0; i < 4; ++i) {
+    pool.submit(
+        Command("sh").addArgs({ "-c",
+                                R"(mkdir "$0" && sleep 0.05 && rmdir "$0")",
+                                dir.string() }),
+        [&numSucceeded](const CommandOutput& output) {
+          if (output.exitCode == EXIT_SUCCESS) {
+            ++numSucceeded;
+          }
+        }
+    );
+  }
+  pool.wait();
+  assertEq(numSucceeded, 4UL);
+
+  pass();
+}
+
+static void
+testChaining() {
+  ProcessPool pool(1);
+  std::string order;
+  pool.submit(Command("echo").addArg("a"), [&](const CommandOutput& output) {
+    order += output.stdOut;
+    pool.submit(Command("echo").addArg("c"), [&](const CommandOutput& output) {
+      order += output.stdOut;
+    });
+  });
+  pool.submit(Command("echo").addArg("b"), [&](const CommandOutput& output) {
+    order += output.stdOut;
+  });
+  pool.wait();
+  assertEq(order, "a\nb\nc\n");
+
+  pass();
+}
+
+static void
+testSignaled() {
+  ProcessPool pool(1);
+  int exitCode = 0;
+  pool.submit(
+      Command("sh").addArg("-c").addArg("kill -TERM $$"),
+      [&exitCode](const CommandOutput& output) { exitCode = output.exitCode; }
+  );
+  pool.wait();
+  assertEq(exitCode, 128 + SIGTERM);
+
+  pass();
+}
+
+static void
+testThrowingCallbackKills() {
+  ProcessPool pool(2);
+  pool.submit(Command("true"), [](const CommandOutput&) {
+    throw CabinError("failed");
+  });
+  pool.submit(Command("sleep").addArg("10"), [](const CommandOutput&) {});
+
+  const auto start = std::chrono::steady_clock::now();
+  assertException<CabinError>([&pool] { pool.wait(); }, "failed");
+  assertTrue(
+      std::chrono::steady_clock::now() - start < std::chrono::seconds(5)
+  );
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testOutputs();
+  tests::testLargeOutput();
+  tests::testStreaming();
+  tests::testStopReading();
+  tests::testResourceUsage();
+  tests::testSerial();
+  tests::testChaining();
+  tests::testSignaled();
+  tests::testThrowingCallbackKills();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Command.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Runs commands concurrently from one event loop on the calling thread,
+// capturing their stdout and stderr, instead of blocking a thread on each
+// child.  On Linux, the loop waits on the pipes and pidfds of the children
+// with epoll; elsewhere, it polls the pipes and reaps children with
+// waitpid().
+//
+// Each child leads a process group of its own, which is killed together
+// with whatever the child spawned on Ctrl-C or if a callback throws.
+class ProcessPool {
+public:
+  using Callback = std::function<void(CommandOutput)>;
+
+  /// Run at most `maxProcs` commands at a time.
+  explicit ProcessPool(size_t maxProcs);
+  ~ProcessPool();
+
+  ProcessPool(const ProcessPool&) = delete;
+  ProcessPool& operator=(const ProcessPool&) = delete;
+  ProcessPool(ProcessPool&&) = delete;
+  ProcessPool& operator=(ProcessPool&&) = delete;
+
+  /// Queue `cmd`.  Once it exits, `onExit` is called from wait() with its
+  /// output, and may submit more commands.  If given, `onStdOut` receives
+  /// stdout as it is read instead of CommandOutput::stdOut.
+  void submit(Command cmd, Callback onExit, OutputSink onStdOut = nullptr);
+  /// Run the queued commands until all of them exit.  If a callback throws,
+  /// the other commands are killed and the exception is rethrown.  On
+  /// SIGINT or SIGTERM, the commands are killed with the same signal, which
+  /// is then raised again.
+  void wait();
+
+private:
+  struct Proc;
+
+  size_t maxProcs;
+  struct Queued {
+    Command cmd;
+    Callback onExit;
+    OutputSink onStdOut;
+  };
+  std::deque<Queued> queue;
+  std::vector<std::unique_ptr<Proc>> running;
+
+  void killAll(int sig) noexcept;
+};
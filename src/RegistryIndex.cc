@@ -0,0 +1,435 @@
+#include "RegistryIndex.hpp"
+
+#include "Algos.hpp"
+#include "Exception.hpp"
+#include "Logger.hpp"
+#include "Manifest.hpp"
+#include "Resolver.hpp"
+#include "Rustify.hpp"
+#include "SearchIndex.hpp"
+#include "Semver.hpp"
+#include "VersionReq.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <exception>
+#include <fmt/core.h>
+#include <fstream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+std::string
+getRegistryUrl() {
+  if (const char* envP = std::getenv("CABIN_REGISTRY_URL")) {
+    return envP;
+  }
+  return "https://cabin.hasura.app/v1/graphql";
+}
+
+RegistryIndex::RegistryIndex()
+    : RegistryIndex(getCacheDir() / "registry", getRegistryUrl()) {}
+
+RegistryIndex::RegistryIndex(fs::path dir, std::string url) noexcept
+    : dir(std::move(dir)), url(std::move(url)) {}
+
+struct HttpResponse {
+  long status = 0;
+  std::string body;
+  std::string etag;
+  std::string lastModified;
+};
+
+static size_t
+writeCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
+  userp->append(static_cast<char*>(contents), size * nmemb);
+  return size * nmemb;
+}
+
+static size_t
+headerCallback(char* buffer, size_t size, size_t nitems, HttpResponse* res) {
+  const std::string_view line(buffer, size * nitems);
+  const size_t colon = line.find(':');
+  if (colon != std::string_view::npos) {
+    const std::string name = toUpper(line.substr(0, colon));
+    std::string_view value = line.substr(colon + 1);
+    value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+    value = value.substr(0, value.find_last_not_of("\r\n") + 1);
+    if (name == "ETAG") {
+      res->etag = value;
+    } else if (name == "LAST-MODIFIED") {
+      res->lastModified = value;
+    }
+  }
+  return size * nitems;
+}
+
+// POSTs `body` to `url`, asking the server to answer 304 if the response is
+// still the one with `etag` or `lastModified`.  Returns std::nullopt if the
+// server is unreachable.
+static std::optional<HttpResponse>
+post(
+    const std::string& url, const std::string& body, const std::string& etag,
+    const std::string& lastModified
+) {
+  CURL* curl = curl_easy_init();
+  if (!curl) {
+    logger::debug("curl_easy_init() failed");
+    return std::nullopt;
+  }
+
+  curl_slist* headers = nullptr;
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+  if (!etag.empty()) {
+    headers = curl_slist_append(headers, ("If-None-Match: " + etag).c_str());
+  }
+  if (!lastModified.empty()) {
+    headers = curl_slist_append(
+        headers, ("If-Modified-Since: " + lastModified).c_str()
+    );
+  }
+
+  HttpResponse res;
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &res.body);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &res);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  const CURLcode code = curl_easy_perform(curl);
+  if (code == CURLE_OK) {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &res.status);
+  }
+  curl_slist_free_all(headers);
+  curl_easy_cleanup(curl);
+
+  if (code != CURLE_OK) {
+    logger::debug("{}: {}", url, curl_easy_strerror(code));
+    return std::nullopt;
+  }
+  return res;
+}
+
+static std::optional<nlohmann::json>
+readJson(const fs::path& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    return std::nullopt;
+  }
+  try {
+    return nlohmann::json::parse(ifs);
+  } catch (const std::exception& e) {
+    logger::debug("ignoring malformed {}: {}", path.string(), e.what());
+    return std::nullopt;
+  }
+}
+
+// Writes to a temporary file first so that a concurrent reader never sees
+// a partial file.
+static void
+writeJson(const fs::path& path, const nlohmann::json& json) {
+  fs::create_directories(path.parent_path());
+  // Each process has a temporary file of its own, so that two of them
+  // refreshing the same file never interleave their writes.
+  fs::path tmp = path;
+  tmp += fmt::format(".{}.tmp", getpid());
+  std::ofstream(tmp) << json.dump();
+  std::error_code ec;
+  fs::rename(tmp, path, ec);
+  if (ec) {
+    logger::debug("failed to write {}: {}", path.string(), ec.message());
+    fs::remove(tmp, ec);
+  }
+}
+
+// Sends the GraphQL request `req`, revalidating the response cached in
+// `cacheFile` if any, and returns its data.  A cached response younger than
+// `maxAge` is used without asking the registry.
+std::optional<nlohmann::json>
+RegistryIndex::fetch(
+    const fs::path& cacheFile, const nlohmann::json& req,
+    const std::chrono::seconds maxAge
+) {
+  std::optional<nlohmann::json> cached = readJson(cacheFile);
+  const bool hasCache = cached.has_value() && cached->contains("data");
+  std::error_code ec;
+  const fs::file_time_type mtime = fs::last_write_time(cacheFile, ec);
+  if (hasCache && !ec && fs::file_time_type::clock::now() - mtime < maxAge) {
+    return cached->at("data");
+  }
+  const std::string etag = hasCache ? cached->value("etag", "") : "";
+  const std::string lastModified =
+      hasCache ? cached->value("last-modified", "") : "";
+
+  const std::optional<HttpResponse> res =
+      post(url, req.dump(), etag, lastModified);
+  if (res.has_value() && res->status == 304 && hasCache) {
+    logger::debug("{} is up to date", cacheFile.string());
+    fs::last_write_time(cacheFile, fs::file_time_type::clock::now(), ec);
+    return cached->at("data");
+  }
+  if (res.has_value() && res->status == 200) {
+    nlohmann::json body;
+    try {
+      body = nlohmann::json::parse(res->body);
+    } catch (const std::exception& e) {
+      throw CabinError("invalid response from the registry: ", e.what());
+    }
+    if (body.contains("errors") || !body.contains("data")) {
+      throw CabinError("the registry returned an error: ", res->body);
+    }
+    writeJson(
+        cacheFile, { { "etag", res->etag },
+                     { "last-modified", res->lastModified },
+                     { "data", body["data"] } }
+    );
+    return body["data"];
+  }
+
+  if (res.has_value()) {
+    logger::debug("{}: HTTP {}", url, res->status);
+  }
+  if (hasCache) {
+    logger::warn("cannot reach the registry; using the cached index");
+    return cached->at("data");
+  }
+  return std::nullopt;
+}
+
+// Registry package names never contain path separators; check anyway since
+// they become file names.
+static bool
+isIndexableName(const std::string_view name) noexcept {
+  return !name.empty() && name.front() != '.'
+         && std::ranges::all_of(name, [](const char c) {
+              return std::isalnum(static_cast<unsigned char>(c)) || c == '-'
+                     || c == '_' || c == '.' || c == '+';
+            });
+}
+
+std::optional<nlohmann::json>
+RegistryIndex::getPackage(const std::string& name) {
+  if (const auto itr = packages.find(name); itr != packages.end()) {
+    return itr->second;
+  }
+  if (!isIndexableName(name)) {
+    return std::nullopt;
+  }
+
+  nlohmann::json req;
+  req["query"] =
+#include "GraphQL/GetPackageVersions.gql"
+      ;
+  req["variables"]["name"] = name;
+
+  std::optional<nlohmann::json> package;
+  const std::optional<nlohmann::json> data =
+      fetch(dir / "index" / (name + ".json"), req);
+  if (data.has_value() && !data->value("packages", nlohmann::json{}).empty()) {
+    package = data->at("packages");
+  }
+  packages.emplace(name, package);
+  return package;
+}
+
+std::vector<RegistryVersion>
+RegistryIndex::getVersions(const std::string& name) {
+  const std::optional<nlohmann::json> package = getPackage(name);
+  if (!package.has_value()) {
+    return {};
+  }
+
+  std::vector<RegistryVersion> versions;
+  for (const nlohmann::json& row : package.value()) {
+    try {
+      RegistryVersion version{ .version = Version::parse(
+                                   row.at("version").get<std::string>()
+                               ),
+                               .dependencies = {} };
+      // Only those with a version requirement are registry dependencies.
+      const nlohmann::json metadata = row.value("metadata", nlohmann::json{});
+      const nlohmann::json deps =
+          metadata.is_object()
+              ? metadata.value("dependencies", nlohmann::json{})
+              : nlohmann::json{};
+      for (const auto& [depName, req] : deps.items()) {
+        if (req.is_string()) {
+          version.dependencies.push_back(
+              { .name = depName,
+                .versionReq = VersionReq::parse(req.get<std::string>()) }
+          );
+        }
+      }
+      versions.push_back(std::move(version));
+    } catch (const std::exception& e) {
+      logger::debug("{}: skipping a malformed version: {}", name, e.what());
+    }
+  }
+  return versions;
+}
+
+using LatestVersions = std::map<std::string, std::pair<Version, SearchEntry>>;
+
+// Keeps the latest version of each package in `rows`.
+static void
+collectLatest(const nlohmann::json& rows, LatestVersions& latest) {
+  for (const nlohmann::json& row : rows) {
+    try {
+      const std::string name = row.at("name").get<std::string>();
+      const std::string version = row.at("version").get<std::string>();
+      const Version ver = Version::parse(version);
+      const auto itr = latest.find(name);
+      if (itr != latest.end() && !(itr->second.first < ver)) {
+        continue;
+      }
+      const nlohmann::json desc = row.value("description", nlohmann::json{});
+      SearchEntry entry{ .name = name,
+                         .version = version,
+                         .description =
+                             desc.is_string() ? desc.get<std::string>() : "" };
+      latest.insert_or_assign(name, std::pair{ ver, std::move(entry) });
+    } catch (const std::exception& e) {
+      logger::debug("skipping a malformed package: {}", e.what());
+    }
+  }
+}
+
+nlohmann::json
+RegistryIndex::search(
+    const std::string& name, const size_t perPage, const size_t page
+) {
+  nlohmann::json req;
+  req["query"] =
+#include "GraphQL/GetAllPackages.gql"
+      ;
+
+  LatestVersions latest;
+  if (const auto data = fetch(dir / "packages.json", req, LISTING_MAX_AGE);
+      data.has_value()) {
+    collectLatest(data->value("packages", nlohmann::json::array()), latest);
+  } else {
+    logger::warn("cannot reach the registry; searching the cached index");
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir / "index", ec)) {
+      if (entry.path().extension() != ".json") {
+        continue;
+      }
+      const std::optional<nlohmann::json> cached = readJson(entry.path());
+      if (cached.has_value() && cached->contains("data")) {
+        collectLatest(
+            cached->at("data").value("packages", nlohmann::json::array()),
+            latest
+        );
+      }
+    }
+  }
+
+  std::vector<SearchEntry> entries;
+  entries.reserve(latest.size());
+  for (auto& [pkgName, pkg] : latest) {
+    entries.push_back(std::move(pkg.second));
+  }
+  const SearchIndex index(std::move(entries));
+
+  nlohmann::json packages = nlohmann::json::array();
+  for (const SearchEntry* entry : index.search(name, perPage, page)) {
+    packages.push_back({ { "name", entry->name },
+                         { "version", entry->version },
+                         { "description", entry->description } });
+  }
+  return packages;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+// Nothing listens on port 1, so every request fails as if offline.
+static constexpr std::string_view UNREACHABLE = "http://127.0.0.1:1/graphql";
+
+static void
+testOffline() {
+  const fs::path dir = fs::temp_directory_path() / "cabin-test-registry";
+  fs::remove_all(dir);
+  const nlohmann::json rows = nlohmann::json::parse(R"([
+    { "name": "fmtlog", "version": "1.0.0", "description": "old",
+      "metadata": null },
+    { "name": "fmtlog", "version": "1.2.0", "description": "new",
+      "metadata": { "dependencies": {
+        "fmt": ">=10.0.0",
+        "spdlog": { "git": "https://example.com/spdlog.git" }
+      } } }
+  ])");
+  writeJson(
+      dir / "index" / "fmtlog.json",
+      { { "etag", "\"v1\"" }, { "data", { { "packages", rows } } } }
+  );
+
+  RegistryIndex index(dir, std::string(UNREACHABLE));
+  const std::vector<RegistryVersion> versions = index.getVersions("fmtlog");
+  assertEq(versions.size(), 2UL);
+  assertEq(versions[1].version.toString(), "1.2.0");
+  // The git dependency is not a registry dependency.
+  assertEq(versions[1].dependencies.size(), 1UL);
+  assertEq(versions[1].dependencies[0].name, "fmt");
+
+  assertTrue(index.getVersions("missing").empty());
+  assertTrue(index.getVersions("../escape").empty());
+
+  // Without the list of all packages, the packages cached so far are
+  // searched.
+  nlohmann::json found = index.search("LOG", 10, 1);
+  assertEq(found.size(), 1UL);
+  assertEq(found[0]["version"].get<std::string>(), "1.2.0");
+  assertEq(found[0]["description"].get<std::string>(), "new");
+  assertTrue(index.search("log", 10, 2).empty());
+  assertTrue(index.search("nothing", 10, 1).empty());
+
+  // A recent list is used without asking the registry, and so is a stale
+  // one when the registry is unreachable.
+  writeJson(
+      dir / "packages.json",
+      { { "data",
+          { { "packages",
+              nlohmann::json::parse(R"([
+                { "name": "spdlog", "version": "1.14.1",
+                  "description": null }
+              ])") } } } }
+  );
+  found = index.search("spdlgo", 10, 1);
+  assertEq(found.size(), 1UL);
+  assertEq(found[0]["name"].get<std::string>(), "spdlog");
+  assertEq(found[0]["description"].get<std::string>(), "");
+  fs::last_write_time(
+      dir / "packages.json",
+      fs::file_time_type::clock::now() - std::chrono::hours(1)
+  );
+  assertEq(index.search("spdlog", 10, 1).size(), 1UL);
+
+  fs::remove_all(dir);
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testOffline();
+}
+
+#endif
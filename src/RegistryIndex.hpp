@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Resolver.hpp"
+#include "Rustify/Aliases.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// The GraphQL endpoint of the registry: $CABIN_REGISTRY_URL if set, e.g.,
+/// a local stand-in server, or the hosted registry.
+std::string getRegistryUrl();
+
+// A local copy of what the registry told us, under CACHE_DIR/registry.  Each
+// package has its own metadata file, fetched when first needed and then
+// revalidated with ETag and Last-Modified, so an unchanged package costs a
+// 304 response.  Without network, the cached files are used as they are.
+class RegistryIndex {
+public:
+  RegistryIndex();
+  RegistryIndex(fs::path dir, std::string url) noexcept;
+
+  /// The rows of the package, one per version, or std::nullopt if the
+  /// package is neither in the registry nor cached.
+  std::optional<nlohmann::json> getPackage(const std::string& name);
+  /// The versions of the package with their registry dependencies, as
+  /// resolveVersions() expects.  Empty if the package is not found.
+  std::vector<RegistryVersion> getVersions(const std::string& name);
+  /// The latest version of each package matching `name`, as ranked by
+  /// SearchIndex.  The list of all packages is revalidated at most every
+  /// LISTING_MAX_AGE, so most searches never touch the network.  Falls back
+  /// to the cached packages when offline.
+  nlohmann::json
+  search(const std::string& name, size_t perPage, size_t page);
+
+private:
+  // Same as the TTL the registry caches the list for.
+  static constexpr std::chrono::minutes LISTING_MAX_AGE{ 10 };
+
+  fs::path dir;
+  std::string url;
+  // Packages already revalidated by this process.
+  std::unordered_map<std::string, std::optional<nlohmann::json>> packages;
+
+  std::optional<nlohmann::json> fetch(
+      const fs::path& cacheFile, const nlohmann::json& req,
+      std::chrono::seconds maxAge = std::chrono::seconds::zero()
+  );
+};
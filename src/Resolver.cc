@@ -0,0 +1,1050 @@
+#include "Resolver.hpp"
+
+#include "Semver.hpp"
+#include "VersionReq.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fmt/core.h>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// A subset of the candidate versions of a package, indexed in ascending
+// order of the versions.
+class VersionSet {
+  std::vector<uint64_t> words;
+  size_t numVersions = 0;
+
+  void clearUnused() noexcept {
+    if (numVersions % 64 != 0) {
+      words.back() &= (uint64_t{ 1 } << (numVersions % 64)) - 1;
+    }
+  }
+
+public:
+  VersionSet() noexcept = default;
+  explicit VersionSet(const size_t numVersions)
+      : words((numVersions + 63) / 64), numVersions(numVersions) {}
+
+  static VersionSet all(const size_t numVersions) {
+    VersionSet set(numVersions);
+    std::ranges::fill(set.words, ~uint64_t{ 0 });
+    set.clearUnused();
+    return set;
+  }
+
+  size_t size() const noexcept {
+    return numVersions;
+  }
+  bool contains(const size_t idx) const noexcept {
+    return (words[idx / 64] >> (idx % 64)) & 1;
+  }
+  void insert(const size_t idx) noexcept {
+    words[idx / 64] |= uint64_t{ 1 } << (idx % 64);
+  }
+  bool empty() const noexcept {
+    return std::ranges::all_of(words, [](const uint64_t w) { return w == 0; });
+  }
+  bool isAll() const noexcept {
+    return *this == all(numVersions);
+  }
+  size_t count() const noexcept {
+    size_t cnt = 0;
+    for (const uint64_t w : words) {
+      cnt += static_cast<size_t>(std::popcount(w));
+    }
+    return cnt;
+  }
+  // The highest version in the set, if any.
+  std::optional<size_t> last() const noexcept {
+    for (size_t i = words.size(); i-- > 0;) {
+      if (words[i] != 0) {
+        return i * 64 + 63 - static_cast<size_t>(std::countl_zero(words[i]));
+      }
+    }
+    return std::nullopt;
+  }
+
+  VersionSet operator~() const {
+    VersionSet set = *this;
+    for (uint64_t& w : set.words) {
+      w = ~w;
+    }
+    set.clearUnused();
+    return set;
+  }
+  VersionSet operator&(const VersionSet& other) const {
+    VersionSet set = *this;
+    for (size_t i = 0; i < words.size(); ++i) {
+      set.words[i] &= other.words[i];
+    }
+    return set;
+  }
+  VersionSet operator|(const VersionSet& other) const {
+    VersionSet set = *this;
+    for (size_t i = 0; i < words.size(); ++i) {
+      set.words[i] |= other.words[i];
+    }
+    return set;
+  }
+  bool operator==(const VersionSet& other) const noexcept = default;
+};
+
+// A statement about a package: a positive term says that one of `versions`
+// is selected, and a negative one says that none of them is, including
+// that the package is not selected at all.
+struct Term {
+  size_t pkg = 0;
+  bool positive = true;
+  VersionSet versions;
+
+  Term negate() const {
+    return { .pkg = pkg, .positive = !positive, .versions = versions };
+  }
+  // Holds for no selection.
+  bool isEmpty() const noexcept {
+    return positive && versions.empty();
+  }
+  // Holds for any selection, including none.
+  bool isAny() const noexcept {
+    return !positive && versions.empty();
+  }
+
+  Term intersect(const Term& other) const {
+    if (positive && other.positive) {
+      return { .pkg = pkg,
+               .positive = true,
+               .versions = versions & other.versions };
+    } else if (positive) {
+      return { .pkg = pkg,
+               .positive = true,
+               .versions = versions & ~other.versions };
+    } else if (other.positive) {
+      return { .pkg = pkg,
+               .positive = true,
+               .versions = other.versions & ~versions };
+    }
+    return { .pkg = pkg,
+             .positive = false,
+             .versions = versions | other.versions };
+  }
+  // Whenever this term holds, `other` holds as well.
+  bool satisfies(const Term& other) const {
+    return intersect(other.negate()).isEmpty();
+  }
+  bool isDisjointWith(const Term& other) const {
+    return intersect(other).isEmpty();
+  }
+};
+
+// A set of terms that must not all hold at once.
+struct Incompatibility {
+  enum class Cause : uint8_t {
+    Root,        // the root package is selected
+    NoVersions,  // no candidate matches the term
+    Dependency,  // a version depends on another package
+    Derived,     // derived from `lhs` and `rhs` during conflict resolution
+  };
+  using enum Cause;
+
+  std::vector<Term> terms;
+  Cause cause = Root;
+  size_t lhs = 0;
+  size_t rhs = 0;
+  // The dependency as written, for Dependency.
+  std::string depName;
+  std::string versionReq;
+};
+
+struct Assignment {
+  Term term;
+  size_t level = 0;
+  // The incompatibility which derived the term; std::nullopt for decisions.
+  std::optional<size_t> cause;
+};
+
+struct Package {
+  std::string name;
+  std::vector<RegistryVersion> candidates;  // in ascending order
+  // `name versionReq` of each dependency of each candidate, to find the
+  // adjacent candidates sharing a dependency without formatting it again.
+  std::vector<std::vector<std::string>> depKeys;
+
+  Package(std::string name, std::vector<RegistryVersion> candidates)
+      : name(std::move(name)), candidates(std::move(candidates)) {
+    for (const RegistryVersion& candidate : this->candidates) {
+      std::vector<std::string>& keys = depKeys.emplace_back();
+      for (const RegistryDep& dep : candidate.dependencies) {
+        keys.push_back(dep.name + ' ' + dep.versionReq.toString());
+      }
+    }
+  }
+};
+
+class Solver {
+  static constexpr size_t ROOT = 0;
+
+  const Registry& registry;
+  const std::unordered_map<std::string, Version>& locked;
+
+  // A deque so that references survive loading more packages.
+  std::deque<Package> packages;
+  std::unordered_map<std::string, size_t> packageIds;
+
+  std::vector<Incompatibility> incompatibilities;
+  // The incompatibilities that refer to each package.
+  std::vector<std::vector<size_t>> incompatibilitiesOf;
+  // Packages, versions, and dependencies whose incompatibilities were added.
+  std::unordered_set<std::string> addedDependencies;
+
+  // The partial solution.
+  std::vector<Assignment> assignments;
+  // The intersection of the assignments to each package.
+  std::vector<Term> accumulated;
+  std::vector<std::optional<size_t>> decisions;
+  size_t decisionLevel = 0;
+
+public:
+  Solver(
+      const std::string& rootName, const std::vector<RegistryDep>& deps,
+      const Registry& registry,
+      const std::unordered_map<std::string, Version>& locked
+  )
+      : registry(registry), locked(locked) {
+    packages.emplace_back(
+        rootName,
+        std::vector<RegistryVersion>{ { .version = {}, .dependencies = deps } }
+    );
+    packageIds.emplace(rootName, ROOT);
+    accumulated.push_back(anyTerm(ROOT));
+    decisions.emplace_back();
+    incompatibilitiesOf.emplace_back();
+  }
+
+  std::map<std::string, Version> solve() {
+    Incompatibility root;
+    root.terms.push_back(singleTerm(ROOT, 0).negate());
+    root.cause = Incompatibility::Root;
+    addIncompatibility(std::move(root));
+
+    std::optional<size_t> next = ROOT;
+    while (next.has_value()) {
+      propagate(next.value());
+      next = decide();
+    }
+
+    std::map<std::string, Version> solution;
+    for (size_t pkg = 0; pkg < packages.size(); ++pkg) {
+      if (pkg != ROOT && decisions[pkg].has_value()) {
+        solution.emplace(
+            packages[pkg].name,
+            packages[pkg].candidates[decisions[pkg].value()].version
+        );
+      }
+    }
+    return solution;
+  }
+
+private:
+  size_t getPackageId(const std::string& name) {
+    if (const auto itr = packageIds.find(name); itr != packageIds.end()) {
+      return itr->second;
+    }
+
+    std::vector<RegistryVersion> candidates = registry(name);
+    std::ranges::sort(candidates, [](const auto& lhs, const auto& rhs) {
+      return lhs.version < rhs.version;
+    });
+    const auto dups =
+        std::ranges::unique(candidates, [](const auto& lhs, const auto& rhs) {
+          return lhs.version == rhs.version;
+        });
+    candidates.erase(dups.begin(), dups.end());
+
+    const size_t id = packages.size();
+    packages.emplace_back(name, std::move(candidates));
+    packageIds.emplace(name, id);
+    accumulated.push_back(anyTerm(id));
+    decisions.emplace_back();
+    incompatibilitiesOf.emplace_back();
+    return id;
+  }
+
+  size_t numVersions(const size_t pkg) const noexcept {
+    return packages[pkg].candidates.size();
+  }
+  Term anyTerm(const size_t pkg) const {
+    return { .pkg = pkg,
+             .positive = false,
+             .versions = VersionSet(numVersions(pkg)) };
+  }
+  Term singleTerm(const size_t pkg, const size_t idx) const {
+    Term term{ .pkg = pkg,
+               .positive = true,
+               .versions = VersionSet(numVersions(pkg)) };
+    term.versions.insert(idx);
+    return term;
+  }
+
+  size_t addIncompatibility(Incompatibility incompat) {
+    const size_t idx = incompatibilities.size();
+    for (const Term& term : incompat.terms) {
+      incompatibilitiesOf[term.pkg].push_back(idx);
+    }
+    incompatibilities.push_back(std::move(incompat));
+    return idx;
+  }
+
+  enum class Relation : uint8_t {
+    Satisfied,
+    Contradicted,
+    AlmostSatisfied,
+    Inconclusive,
+  };
+
+  // Returns the relation and, if almost satisfied, the unsatisfied term.
+  std::pair<Relation, size_t> relation(const Incompatibility& incompat) const {
+    std::optional<size_t> unsatisfied;
+    for (size_t i = 0; i < incompat.terms.size(); ++i) {
+      const Term& term = incompat.terms[i];
+      const Term& current = accumulated[term.pkg];
+      if (current.satisfies(term)) {
+        continue;
+      }
+      if (current.isDisjointWith(term)) {
+        return { Relation::Contradicted, 0 };
+      }
+      if (unsatisfied.has_value()) {
+        return { Relation::Inconclusive, 0 };
+      }
+      unsatisfied = i;
+    }
+    if (unsatisfied.has_value()) {
+      return { Relation::AlmostSatisfied, unsatisfied.value() };
+    }
+    return { Relation::Satisfied, 0 };
+  }
+
+  void assign(Term term, const std::optional<size_t> cause) {
+    accumulated[term.pkg] = accumulated[term.pkg].intersect(term);
+    assignments.push_back(
+        { .term = std::move(term), .level = decisionLevel, .cause = cause }
+    );
+  }
+
+  void backtrack(const size_t level) {
+    while (!assignments.empty() && assignments.back().level > level) {
+      assignments.pop_back();
+    }
+    decisionLevel = level;
+
+    for (size_t pkg = 0; pkg < packages.size(); ++pkg) {
+      accumulated[pkg] = anyTerm(pkg);
+      decisions[pkg].reset();
+    }
+    for (const Assignment& assignment : assignments) {
+      const size_t pkg = assignment.term.pkg;
+      accumulated[pkg] = accumulated[pkg].intersect(assignment.term);
+      if (!assignment.cause.has_value()) {
+        decisions[pkg] = assignment.term.versions.last();
+      }
+    }
+  }
+
+  void propagate(const size_t pkg) {
+    std::vector<size_t> changed = { pkg };
+    while (!changed.empty()) {
+      const size_t current = changed.back();
+      changed.pop_back();
+
+      // Newer incompatibilities tend to be more specific; check them first.
+      // Indices are used since conflict resolution may add more.
+      for (size_t i = incompatibilitiesOf[current].size(); i-- > 0;) {
+        const size_t incompat = incompatibilitiesOf[current][i];
+        auto [rel, termIdx] = relation(incompatibilities[incompat]);
+        if (rel == Relation::Satisfied) {
+          const size_t rootCause = resolveConflict(incompat);
+          std::tie(rel, termIdx) = relation(incompatibilities[rootCause]);
+          const Term& term = incompatibilities[rootCause].terms[termIdx];
+          assign(term.negate(), rootCause);
+          changed = { term.pkg };
+          break;
+        }
+        if (rel == Relation::AlmostSatisfied) {
+          const Term& term = incompatibilities[incompat].terms[termIdx];
+          assign(term.negate(), incompat);
+          changed.push_back(term.pkg);
+        }
+      }
+    }
+  }
+
+  // The index of the earliest assignment with which the assignments to
+  // `term.pkg` so far, intersected with `initial`, satisfy `term`.
+  // std::nullopt if `initial` alone does.
+  std::optional<size_t>
+  findSatisfier(const Term& term, const Term& initial) const {
+    Term current = initial;
+    if (current.satisfies(term)) {
+      return std::nullopt;
+    }
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      if (assignments[i].term.pkg != term.pkg) {
+        continue;
+      }
+      current = current.intersect(assignments[i].term);
+      if (current.satisfies(term)) {
+        return i;
+      }
+    }
+    throw CabinError("resolver: unsatisfied term in a conflict");
+  }
+
+  bool isFailure(const Incompatibility& incompat) const noexcept {
+    return incompat.terms.empty()
+           || (incompat.terms.size() == 1 && incompat.terms[0].positive
+               && incompat.terms[0].pkg == ROOT);
+  }
+
+  // Learns why `conflict` is satisfied, backjumps to where the learned
+  // incompatibility is almost satisfied, and returns it.
+  size_t resolveConflict(size_t conflict) {
+    bool isNew = false;
+    while (true) {
+      const Incompatibility& incompat = incompatibilities[conflict];
+      if (isFailure(incompat)) {
+        throw ResolveError(explain(conflict));
+      }
+
+      size_t satisfier = 0;
+      size_t termIdx = 0;
+      std::vector<size_t> satisfiers;
+      for (size_t i = 0; i < incompat.terms.size(); ++i) {
+        const Term& term = incompat.terms[i];
+        satisfiers.push_back(
+            findSatisfier(term, anyTerm(term.pkg)).value_or(0)
+        );
+        if (i == 0 || satisfiers[i] > satisfier) {
+          satisfier = satisfiers[i];
+          termIdx = i;
+        }
+      }
+      const Term& term = incompat.terms[termIdx];
+      const Assignment& assignment = assignments[satisfier];
+
+      std::optional<size_t> prevSatisfier =
+          findSatisfier(term, assignment.term);
+      for (size_t i = 0; i < incompat.terms.size(); ++i) {
+        if (i != termIdx) {
+          prevSatisfier = std::max(prevSatisfier.value_or(0), satisfiers[i]);
+        }
+      }
+      const size_t prevLevel = std::max<size_t>(
+          1, prevSatisfier.has_value() ? assignments[*prevSatisfier].level : 1
+      );
+
+      const bool isDecision = !assignment.cause.has_value();
+      if (isDecision || prevLevel != assignment.level) {
+        if (isNew) {
+          for (const Term& t : incompat.terms) {
+            incompatibilitiesOf[t.pkg].push_back(conflict);
+          }
+        }
+        backtrack(prevLevel);
+        return conflict;
+      }
+
+      // Derive an incompatibility from this one and the cause of the
+      // satisfier, which no longer mentions the satisfier's package unless
+      // the satisfier is broader than `term`.
+      const Incompatibility& cause = incompatibilities[*assignment.cause];
+      std::map<size_t, Term> terms;
+      const auto addTerm = [&](const Term& t) {
+        if (t.pkg == term.pkg) {
+          return;
+        }
+        const auto [itr, inserted] = terms.try_emplace(t.pkg, t);
+        if (!inserted) {
+          itr->second = itr->second.intersect(t);
+        }
+      };
+      for (const Term& t : incompat.terms) {
+        addTerm(t);
+      }
+      for (const Term& t : cause.terms) {
+        addTerm(t);
+      }
+      if (!assignment.term.satisfies(term)) {
+        terms.emplace(
+            term.pkg, assignment.term.intersect(term.negate()).negate()
+        );
+      }
+
+      Incompatibility derived;
+      for (auto& [pkg, t] : terms) {
+        if (!t.isAny()) {
+          derived.terms.push_back(std::move(t));
+        }
+      }
+      derived.cause = Incompatibility::Derived;
+      derived.lhs = conflict;
+      derived.rhs = *assignment.cause;
+      conflict = incompatibilities.size();
+      incompatibilities.push_back(std::move(derived));
+      isNew = true;
+    }
+  }
+
+  // Adds the dependencies of `pkg` at `idx`.  A dependency shared by the
+  // adjacent versions is added for all of them at once, which keeps
+  // explanations short and lets one conflict rule out many versions.
+  // Returns the added incompatibilities.
+  std::vector<size_t> addDependencies(const size_t pkg, const size_t idx) {
+    const Package& package = packages[pkg];
+    const std::vector<RegistryVersion>& candidates = package.candidates;
+    const auto hasDependency = [&](const size_t i, const std::string& key) {
+      return std::ranges::find(package.depKeys[i], key)
+             != package.depKeys[i].end();
+    };
+
+    std::vector<size_t> added;
+    for (size_t d = 0; d < candidates[idx].dependencies.size(); ++d) {
+      const RegistryDep& dep = candidates[idx].dependencies[d];
+      const std::string& depKey = package.depKeys[idx][d];
+      size_t lo = idx;
+      while (lo > 0 && hasDependency(lo - 1, depKey)) {
+        --lo;
+      }
+      size_t hi = idx;
+      while (hi + 1 < candidates.size() && hasDependency(hi + 1, depKey)) {
+        ++hi;
+      }
+      const std::string key =
+          fmt::format("{}\t{}\t{}", package.name, lo, depKey);
+      if (!addedDependencies.insert(key).second) {
+        continue;
+      }
+
+      const size_t depPkg = getPackageId(dep.name);
+      Term depTerm{ .pkg = depPkg,
+                    .positive = true,
+                    .versions = VersionSet(numVersions(depPkg)) };
+      const std::vector<RegistryVersion>& depCandidates =
+          packages[depPkg].candidates;
+      for (size_t i = 0; i < depCandidates.size(); ++i) {
+        if (dep.versionReq.satisfiedBy(depCandidates[i].version)) {
+          depTerm.versions.insert(i);
+        }
+      }
+      Term pkgTerm{ .pkg = pkg,
+                    .positive = true,
+                    .versions = VersionSet(numVersions(pkg)) };
+      for (size_t i = lo; i <= hi; ++i) {
+        pkgTerm.versions.insert(i);
+      }
+
+      Incompatibility incompat;
+      incompat.terms.push_back(std::move(pkgTerm));
+      // Without a matching version, the versions of `pkg` are just
+      // forbidden; `not dep in {}` holds for any selection of `dep`.
+      if (!depTerm.versions.empty()) {
+        incompat.terms.push_back(depTerm.negate());
+      }
+      incompat.cause = Incompatibility::Dependency;
+      incompat.depName = dep.name;
+      incompat.versionReq = dep.versionReq.toString();
+      added.push_back(addIncompatibility(std::move(incompat)));
+    }
+    return added;
+  }
+
+  // Selects a version of the package with the fewest versions left, which
+  // finds conflicts early.  Returns the package to propagate from, or
+  // std::nullopt if every required package is selected.
+  std::optional<size_t> decide() {
+    std::optional<size_t> pkg;
+    size_t fewest = 0;
+    for (size_t i = 0; i < packages.size(); ++i) {
+      if (!accumulated[i].positive || decisions[i].has_value()) {
+        continue;
+      }
+      const size_t cnt = accumulated[i].versions.count();
+      if (!pkg.has_value() || cnt < fewest) {
+        pkg = i;
+        fewest = cnt;
+      }
+    }
+    if (!pkg.has_value()) {
+      return std::nullopt;
+    }
+
+    // Copied since adding dependencies may add packages.
+    const Term allowed = accumulated[*pkg];
+    std::optional<size_t> idx = allowed.versions.last();
+    if (!idx.has_value()) {
+      Incompatibility incompat;
+      incompat.terms.push_back(allowed);
+      incompat.cause = Incompatibility::NoVersions;
+      addIncompatibility(std::move(incompat));
+      return pkg;
+    }
+    if (const auto itr = locked.find(packages[*pkg].name);
+        itr != locked.end()) {
+      const std::vector<RegistryVersion>& candidates =
+          packages[*pkg].candidates;
+      for (size_t i = 0; i < candidates.size(); ++i) {
+        if (candidates[i].version == itr->second
+            && allowed.versions.contains(i)) {
+          idx = i;
+          break;
+        }
+      }
+    }
+
+    // Don't select the version if one of its dependencies already
+    // conflicts; propagating from the package will rule it out instead.
+    bool conflicts = false;
+    for (const size_t incompat : addDependencies(*pkg, *idx)) {
+      const std::vector<Term>& terms = incompatibilities[incompat].terms;
+      conflicts = conflicts || terms.size() == 1
+                  || accumulated[terms[1].pkg].satisfies(terms[1]);
+    }
+    if (!conflicts) {
+      ++decisionLevel;
+      assign(singleTerm(*pkg, *idx), std::nullopt);
+      decisions[*pkg] = *idx;
+    }
+    return pkg;
+  }
+
+  // Renders a set of versions of `pkg` as version requirements.
+  std::string toString(const size_t pkg, const VersionSet& versions) const {
+    const std::vector<RegistryVersion>& candidates = packages[pkg].candidates;
+    if (pkg == ROOT) {
+      return "";
+    }
+    if (versions.isAll() && candidates.size() > 1) {
+      return " *";
+    }
+
+    std::string str;
+    for (size_t lo = 0; lo < candidates.size(); ++lo) {
+      if (!versions.contains(lo)) {
+        continue;
+      }
+      size_t hi = lo;
+      while (hi + 1 < candidates.size() && versions.contains(hi + 1)) {
+        ++hi;
+      }
+
+      str += str.empty() ? " " : " || ";
+      const std::string low = candidates[lo].version.toString();
+      const std::string high = candidates[hi].version.toString();
+      if (lo == hi) {
+        str += low;
+      } else if (lo == 0) {
+        str += "<=" + high;
+      } else if (hi + 1 == candidates.size()) {
+        str += ">=" + low;
+      } else {
+        str += ">=" + low + " && <=" + high;
+      }
+      lo = hi;
+    }
+    return str;
+  }
+
+  std::string toString(const Term& term) const {
+    return packages[term.pkg].name + toString(term.pkg, term.versions);
+  }
+
+  std::string describe(const Incompatibility& incompat) const {
+    const std::vector<Term>& terms = incompat.terms;
+    switch (incompat.cause) {
+      case Incompatibility::Root:
+        return fmt::format("{} is required", packages[ROOT].name);
+      case Incompatibility::NoVersions:
+        if (numVersions(terms[0].pkg) == 0) {
+          return fmt::format("{} is not found", packages[terms[0].pkg].name);
+        }
+        return fmt::format("no versions of {} match", toString(terms[0]));
+      case Incompatibility::Dependency: {
+        std::string str = fmt::format(
+            "{} depends on {} {}", toString(terms[0]), incompat.depName,
+            incompat.versionReq
+        );
+        if (terms.size() == 1) {
+          const bool isFound =
+              numVersions(packageIds.at(incompat.depName)) > 0;
+          str += isFound ? ", which matches no versions"
+                         : ", which is not found";
+        }
+        return str;
+      }
+      case Incompatibility::Derived:
+        break;
+    }
+
+    if (isFailure(incompat)) {
+      return "version solving failed";
+    }
+    if (terms.size() == 1) {
+      return fmt::format(
+          "{} is {}", toString(terms[0]),
+          terms[0].positive ? "forbidden" : "required"
+      );
+    }
+    if (terms.size() == 2 && terms[0].positive && terms[1].positive) {
+      return fmt::format(
+          "{} is incompatible with {}", toString(terms[0]), toString(terms[1])
+      );
+    }
+    if (terms.size() == 2 && terms[0].positive != terms[1].positive) {
+      const Term& pos = terms[0].positive ? terms[0] : terms[1];
+      const Term& neg = terms[0].positive ? terms[1] : terms[0];
+      return fmt::format("{} requires {}", toString(pos), toString(neg));
+    }
+
+    std::string str;
+    for (size_t i = 0; i < terms.size(); ++i) {
+      if (i > 0) {
+        str += i + 1 == terms.size() ? " and " : ", ";
+      }
+      str += terms[i].positive ? "" : "not ";
+      str += toString(terms[i]);
+    }
+    return str + " are incompatible";
+  }
+
+  // Refers to `idx` in an explanation, explaining it first if derived.
+  std::string refer(
+      const size_t idx, std::vector<std::string>& lines,
+      std::unordered_map<size_t, size_t>& lineOf
+  ) const {
+    const Incompatibility& incompat = incompatibilities[idx];
+    if (incompat.cause != Incompatibility::Derived) {
+      return describe(incompat);
+    }
+    if (!lineOf.contains(idx)) {
+      const std::string lhs = refer(incompat.lhs, lines, lineOf);
+      const std::string rhs = refer(incompat.rhs, lines, lineOf);
+      lines.push_back(
+          fmt::format("Because {} and {}, {}.", lhs, rhs, describe(incompat))
+      );
+      lineOf[idx] = lines.size();
+    }
+    return fmt::format("{} ({})", describe(incompat), lineOf[idx]);
+  }
+
+  std::string explain(const size_t failure) const {
+    std::vector<std::string> lines;
+    std::unordered_map<size_t, size_t> lineOf;
+    const std::string failed = refer(failure, lines, lineOf);
+    if (lines.empty()) {
+      return failed;
+    }
+
+    std::string explanation;
+    for (size_t i = 0; i < lines.size(); ++i) {
+      if (i > 0) {
+        explanation += '\n';
+      }
+      explanation += fmt::format("({}) {}", i + 1, lines[i]);
+    }
+    return explanation;
+  }
+};
+
+std::map<std::string, Version>
+resolveVersions(
+    const std::string& rootName, const std::vector<RegistryDep>& deps,
+    const Registry& registry,
+    const std::unordered_map<std::string, Version>& locked
+) {
+  return Solver(rootName, deps, registry, locked).solve();
+}
+
+#if defined(CABIN_TEST) || defined(CABIN_BENCH)
+
+using RegistryMap = std::map<std::string, std::vector<RegistryVersion>>;
+
+static Registry
+toRegistry(RegistryMap packages) {
+  return [packages = std::move(packages)](const std::string& name) {
+    const auto itr = packages.find(name);
+    return itr == packages.end() ? std::vector<RegistryVersion>{}
+                                 : itr->second;
+  };
+}
+
+#endif
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+// Adds `name` at `version` depending on `deps`, e.g., { "bar", ">=1.0.0" }.
+static void
+publish(
+    RegistryMap& packages, const std::string& name, const std::string& version,
+    const std::vector<std::pair<std::string, std::string>>& deps = {}
+) {
+  RegistryVersion ver{ .version = Version::parse(version), .dependencies = {} };
+  for (const auto& [depName, req] : deps) {
+    ver.dependencies.push_back(
+        { .name = depName, .versionReq = VersionReq::parse(req) }
+    );
+  }
+  packages[name].push_back(std::move(ver));
+}
+
+static RegistryDep
+dep(const std::string& name, const std::string& req) {
+  return { .name = name, .versionReq = VersionReq::parse(req) };
+}
+
+static void
+testHighestVersions() {
+  RegistryMap packages;
+  publish(packages, "foo", "1.0.0", { { "bar", "1.0.0" } });
+  publish(packages, "foo", "1.1.0", { { "bar", "1.1.0" } });
+  publish(packages, "bar", "1.0.0");
+  publish(packages, "bar", "1.2.0");
+  publish(packages, "bar", "2.0.0");
+
+  const auto solution =
+      resolveVersions("root", { dep("foo", "1.0.0") }, toRegistry(packages));
+  assertEq(solution.size(), 2UL);
+  assertEq(solution.at("foo").toString(), "1.1.0");
+  assertEq(solution.at("bar").toString(), "1.2.0");
+
+  pass();
+}
+
+static void
+testConflictResolution() {
+  // foo 2.0.0 requires bar, which requires foo 1.x.
+  RegistryMap packages;
+  publish(packages, "foo", "1.0.0");
+  publish(packages, "foo", "2.0.0", { { "bar", "1.0.0" } });
+  publish(packages, "bar", "1.0.0", { { "foo", "1.0.0" } });
+
+  const auto solution =
+      resolveVersions("root", { dep("foo", ">=1.0.0") }, toRegistry(packages));
+  assertEq(solution.size(), 1UL);
+  assertEq(solution.at("foo").toString(), "1.0.0");
+
+  pass();
+}
+
+static void
+testBacktracking() {
+  // The highest versions of foo all depend on a missing version of baz.
+  RegistryMap packages;
+  for (const std::string version : { "1.0.0", "1.1.0", "1.2.0", "1.3.0" }) {
+    const std::string bazReq = version == "1.0.0" ? "1.0.0" : "2.0.0";
+    publish(packages, "foo", version, { { "baz", bazReq } });
+  }
+  publish(packages, "baz", "1.0.0");
+  publish(packages, "bar", "1.0.0", { { "foo", ">=1.0.0" } });
+
+  const auto solution =
+      resolveVersions("root", { dep("bar", "1.0.0") }, toRegistry(packages));
+  assertEq(solution.at("foo").toString(), "1.0.0");
+  assertEq(solution.at("baz").toString(), "1.0.0");
+
+  pass();
+}
+
+static void
+testLocked() {
+  RegistryMap packages;
+  publish(packages, "foo", "1.0.0");
+  publish(packages, "foo", "1.1.0");
+  publish(packages, "foo", "2.0.0");
+  const Registry registry = toRegistry(packages);
+
+  const std::unordered_map<std::string, Version> locked = {
+    { "foo", Version::parse("1.0.0") },
+  };
+  auto solution =
+      resolveVersions("root", { dep("foo", "1.0.0") }, registry, locked);
+  assertEq(solution.at("foo").toString(), "1.0.0");
+
+  // The locked version no longer satisfies the requirement.
+  solution = resolveVersions("root", { dep("foo", "2.0.0") }, registry, locked);
+  assertEq(solution.at("foo").toString(), "2.0.0");
+
+  pass();
+}
+
+static void
+testNoSolution() {
+  RegistryMap packages;
+  publish(packages, "foo", "1.0.0", { { "shared", ">=2.0.0" } });
+  publish(packages, "bar", "1.0.0", { { "shared", "<2.0.0" } });
+  publish(packages, "shared", "1.0.0");
+  publish(packages, "shared", "2.0.0");
+
+  assertException<ResolveError>(
+      [&] {
+        resolveVersions(
+            "root", { dep("foo", "1.0.0"), dep("bar", "1.0.0") },
+            toRegistry(packages)
+        );
+      },
+      "failed to resolve dependencies:\n"
+      "(1) Because foo 1.0.0 depends on shared >=2.0.0 and bar 1.0.0 depends "
+      "on shared <2.0.0, foo 1.0.0 is incompatible with bar 1.0.0.\n"
+      "(2) Because foo 1.0.0 is incompatible with bar 1.0.0 (1) and root "
+      "depends on foo 1.0.0, root is incompatible with bar 1.0.0.\n"
+      "(3) Because root is incompatible with bar 1.0.0 (2) and root depends "
+      "on bar 1.0.0, version solving failed."
+  );
+
+  pass();
+}
+
+static void
+testNotFound() {
+  assertException<ResolveError>(
+      [] { resolveVersions("root", { dep("foo", "1.0.0") }, toRegistry({})); },
+      "failed to resolve dependencies:\n"
+      "root depends on foo 1.0.0, which is not found"
+  );
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testHighestVersions();
+  tests::testConflictResolution();
+  tests::testBacktracking();
+  tests::testLocked();
+  tests::testNoSolution();
+  tests::testNotFound();
+}
+
+#endif
+
+#ifdef CABIN_BENCH
+
+#  include <chrono>
+#  include <cstdio>
+#  include <random>
+
+namespace bench {
+
+// A synthetic registry of `numPackages` packages with `numVersions` versions
+// each.  Every version depends on up to `maxDeps` packages of higher indices
+// so that the graph is acyclic, requiring a random major version.
+static RegistryMap
+generate(
+    const size_t numPackages, const size_t numVersions, const size_t maxDeps,
+    const uint64_t seed
+) {
+  std::mt19937_64 rng(seed);
+  RegistryMap packages;
+  for (size_t pkg = 0; pkg < numPackages; ++pkg) {
+    std::vector<RegistryVersion>& versions =
+        packages[fmt::format("pkg{}", pkg)];
+    for (size_t ver = 0; ver < numVersions; ++ver) {
+      RegistryVersion version{ .version = Version::parse(fmt::format(
+                                   "{}.{}.0", ver / 10 + 1, ver % 10
+                               )),
+                               .dependencies = {} };
+      for (size_t i = 0; i < maxDeps && pkg + 1 < numPackages; ++i) {
+        const size_t dep = pkg + 1 + rng() % (numPackages - pkg - 1);
+        const uint64_t major = rng() % ((numVersions + 9) / 10) + 1;
+        version.dependencies.push_back(
+            { .name = fmt::format("pkg{}", dep),
+              .versionReq = VersionReq::parse(fmt::format(">={}.0.0", major)) }
+        );
+      }
+      versions.push_back(std::move(version));
+    }
+  }
+  return packages;
+}
+
+static void
+run(
+    const std::string_view name, const RegistryMap& packages,
+    const std::vector<RegistryDep>& deps
+) {
+  const Registry registry = toRegistry(packages);
+  const auto start = std::chrono::steady_clock::now();
+  std::string result;
+  try {
+    result = fmt::format(
+        "{} packages", resolveVersions("root", deps, registry).size()
+    );
+  } catch (const ResolveError&) {
+    result = "no solution";
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf(
+      "bench %s ... %.2f ms (%s)\n", std::string(name).c_str(),
+      elapsed.count(), result.c_str()
+  );
+}
+
+}  // namespace bench
+
+int
+main() {
+  // Many packages with a few versions each.
+  bench::run(
+      "wide", bench::generate(2000, 10, 3, 1),
+      { { .name = "pkg0", .versionReq = VersionReq::parse(">=1.0.0") } }
+  );
+  // A few packages with thousands of versions each.
+  bench::run(
+      "deep", bench::generate(20, 2000, 2, 2),
+      { { .name = "pkg0", .versionReq = VersionReq::parse(">=1.0.0") } }
+  );
+
+  // The newest versions all depend on a version of `shared` the root
+  // forbids, so each package has to back off to its oldest version.
+  RegistryMap packages;
+  std::vector<RegistryDep> deps = {
+    { .name = "shared", .versionReq = VersionReq::parse("1.0.0") },
+  };
+  packages["shared"].push_back(
+      { .version = Version::parse("1.0.0"), .dependencies = {} }
+  );
+  packages["shared"].push_back(
+      { .version = Version::parse("2.0.0"), .dependencies = {} }
+  );
+  for (size_t pkg = 0; pkg < 200; ++pkg) {
+    const std::string name = fmt::format("pkg{}", pkg);
+    for (size_t ver = 0; ver < 100; ++ver) {
+      packages[name].push_back(
+          { .version = Version::parse(fmt::format("1.{}.0", ver)),
+            .dependencies = { { .name = "shared",
+                                .versionReq = VersionReq::parse(
+                                    ver == 0 ? "1.0.0" : "2.0.0"
+                                ) } } }
+      );
+    }
+    deps.push_back({ .name = name, .versionReq = VersionReq::parse("1.0.0") });
+  }
+  bench::run("backtracking", packages, deps);
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Version resolver for registry packages based on PubGrub:
+// https://github.com/dart-lang/pub/blob/master/doc/solver.md
+//
+// Every package has a finite list of candidate versions in the registry, so
+// a set of versions is a bitset over that list rather than a union of
+// ranges.  This keeps set operations cheap and handles prerelease rules of
+// VersionReq::satisfiedBy as they are.
+//
+// Nothing in cabin calls the resolver yet; only its tests and `make bench`
+// do.  cabin.toml has no registry dependency kind, so cabin.lock records no
+// registry versions to pass as `locked` either.  Both are to be wired up
+// together with that dependency kind, as RegistryIndex and Downloader are.
+#pragma once
+
+#include "Exception.hpp"
+#include "Semver.hpp"
+#include "VersionReq.hpp"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct ResolveError : public CabinError {
+  explicit ResolveError(auto&&... args)
+      : CabinError(
+            "failed to resolve dependencies:\n",
+            std::forward<decltype(args)>(args)...
+        ) {}
+};
+
+struct RegistryDep {
+  std::string name;
+  VersionReq versionReq;
+};
+
+struct RegistryVersion {
+  Version version;
+  std::vector<RegistryDep> dependencies;
+};
+
+// Returns every published version of a package, or an empty list if the
+// package does not exist.  Called at most once per package.
+using Registry =
+    std::function<std::vector<RegistryVersion>(const std::string&)>;
+
+/// Select a version of every package `deps` require, transitively, from
+/// `registry`.  The highest allowed version is selected unless `locked` has
+/// one that is still allowed, so a previous resolution is kept as much as
+/// possible.  Throws ResolveError explaining why if no selection exists.
+std::map<std::string, Version> resolveVersions(
+    const std::string& rootName, const std::vector<RegistryDep>& deps,
+    const Registry& registry,
+    const std::unordered_map<std::string, Version>& locked = {}
+);
@@ -0,0 +1,342 @@
+#include "SearchIndex.hpp"
+
+#include "Algos.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// The distinct trigrams of `str`, padded like pg_trgm does so that short
+// strings and word boundaries have trigrams of their own.
+static std::vector<uint32_t>
+trigrams(const std::string_view str) {
+  const std::string padded = "  " + std::string(str) + " ";
+  std::vector<uint32_t> result;
+  result.reserve(padded.size() - 2);
+  for (size_t i = 0; i + 2 < padded.size(); ++i) {
+    result.push_back(
+        static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16
+        | static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8
+        | static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 2]))
+    );
+  }
+  std::ranges::sort(result);
+  const auto [first, last] = std::ranges::unique(result);
+  result.erase(first, last);
+  return result;
+}
+
+SearchIndex::SearchIndex(std::vector<SearchEntry> entries)
+    : entries(std::move(entries)) {
+  names.reserve(this->entries.size());
+  descriptions.reserve(this->entries.size());
+  numNameTrigrams.reserve(this->entries.size());
+  for (uint32_t id = 0; id < this->entries.size(); ++id) {
+    names.push_back(toUpper(this->entries[id].name));
+    descriptions.push_back(toUpper(this->entries[id].description));
+
+    const std::vector<uint32_t> nameTrigrams = trigrams(names.back());
+    numNameTrigrams.push_back(static_cast<uint32_t>(nameTrigrams.size()));
+    for (const uint32_t trigram : nameTrigrams) {
+      postings[trigram].push_back(id);
+    }
+  }
+}
+
+namespace {
+
+// In the order of relevance.
+enum class Rank : uint8_t {
+  Exact,
+  Prefix,
+  Substring,
+  Typo,
+  Description,
+  Similar,
+};
+
+struct Hit {
+  Rank rank;
+  // Lower is better among hits of the same rank.
+  double distance;
+  uint32_t id;
+};
+
+}  // namespace
+
+// Names sharing at least this fraction of trigrams with the query are
+// similar; the default threshold of pg_trgm.
+static constexpr double SIMILARITY_THRESHOLD = 0.3;
+
+std::vector<const SearchEntry*>
+SearchIndex::search(
+    const std::string_view query, const size_t perPage, const size_t page
+) const {
+  const std::string needle = toUpper(query);
+  if (needle.empty() || perPage == 0 || page == 0) {
+    return {};
+  }
+
+  // A name containing the query has every unpadded trigram of it, and names
+  // a few edits away usually share a trigram or two, so only names sharing
+  // a trigram with the query can match.  Queries shorter than a trigram are
+  // checked against every name instead.
+  const std::vector<uint32_t> needleTrigrams = trigrams(needle);
+  std::vector<uint32_t> sharedTrigrams(entries.size());
+  std::vector<uint32_t> candidates;
+  if (needle.size() < 3) {
+    candidates.resize(entries.size());
+    for (uint32_t id = 0; id < entries.size(); ++id) {
+      candidates[id] = id;
+    }
+  }
+  for (const uint32_t trigram : needleTrigrams) {
+    if (const auto itr = postings.find(trigram); itr != postings.end()) {
+      for (const uint32_t id : itr->second) {
+        if (sharedTrigrams[id]++ == 0 && needle.size() >= 3) {
+          candidates.push_back(id);
+        }
+      }
+    }
+  }
+
+  // Same as findSimilarStr().
+  const size_t maxDist =
+      needle.size() < 3 ? needle.size() - 1 : needle.size() / 3;
+  // levDistance() between the query and the name if it may be at most
+  // maxDist, or maxDist + 1.  Each edit changes at most three trigrams, so
+  // names sharing fewer trigrams than that, or of too different lengths,
+  // are skipped.
+  const auto typoDistance = [&](const uint32_t id) {
+    const std::string& name = names[id];
+    const size_t lenDiff = std::max(name.size(), needle.size())
+                           - std::min(name.size(), needle.size());
+    if (lenDiff > maxDist
+        || sharedTrigrams[id] + 3 * maxDist < needleTrigrams.size()) {
+      return maxDist + 1;
+    }
+    return levDistance(needle, name);
+  };
+
+  std::vector<Hit> hits;
+  std::vector<bool> nameMatched(entries.size());
+  for (const uint32_t id : candidates) {
+    const std::string& name = names[id];
+    const auto nameLen = static_cast<double>(name.size());
+    if (name == needle) {
+      hits.push_back({ .rank = Rank::Exact, .distance = 0, .id = id });
+    } else if (name.starts_with(needle)) {
+      hits.push_back({ .rank = Rank::Prefix, .distance = nameLen, .id = id });
+    } else if (name.find(needle) != std::string::npos) {
+      hits.push_back(
+          { .rank = Rank::Substring, .distance = nameLen, .id = id }
+      );
+    } else if (const size_t dist = typoDistance(id); dist <= maxDist) {
+      hits.push_back({ .rank = Rank::Typo,
+                       .distance = static_cast<double>(dist),
+                       .id = id });
+    } else {
+      continue;
+    }
+    nameMatched[id] = true;
+  }
+
+  // Descriptions are short enough to scan; indexing their trigrams would
+  // cost more to build than it saves.
+  for (uint32_t id = 0; id < entries.size(); ++id) {
+    if (nameMatched[id]) {
+      continue;
+    }
+    if (descriptions[id].find(needle) != std::string::npos) {
+      hits.push_back({ .rank = Rank::Description, .distance = 0, .id = id });
+    } else if (sharedTrigrams[id] > 0) {
+      const double shared = sharedTrigrams[id];
+      const double similarity =
+          shared / (needleTrigrams.size() + numNameTrigrams[id] - shared);
+      if (similarity >= SIMILARITY_THRESHOLD) {
+        hits.push_back(
+            { .rank = Rank::Similar, .distance = 1 - similarity, .id = id }
+        );
+      }
+    }
+  }
+
+  const size_t first = (page - 1) * perPage;
+  if (first >= hits.size()) {
+    return {};
+  }
+  const size_t last = std::min(first + perPage, hits.size());
+  const auto byRelevance = [&](const Hit& lhs, const Hit& rhs) {
+    return std::tie(lhs.rank, lhs.distance, entries[lhs.id].name)
+           < std::tie(rhs.rank, rhs.distance, entries[rhs.id].name);
+  };
+  std::partial_sort(
+      hits.begin(), hits.begin() + static_cast<std::ptrdiff_t>(last),
+      hits.end(), byRelevance
+  );
+
+  std::vector<const SearchEntry*> result;
+  result.reserve(last - first);
+  for (size_t i = first; i < last; ++i) {
+    result.push_back(&entries[hits[i].id]);
+  }
+  return result;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+// The names of the entries found, separated by ", ".
+static std::string
+searchNames(
+    const SearchIndex& index, const std::string_view query,
+    const size_t perPage = 10, const size_t page = 1
+) {
+  std::string names;
+  for (const SearchEntry* entry : index.search(query, perPage, page)) {
+    if (!names.empty()) {
+      names += ", ";
+    }
+    names += entry->name;
+  }
+  return names;
+}
+
+static SearchIndex
+sampleIndex() {
+  return SearchIndex({
+      { .name = "fmt", .version = "11.0.2", .description = "Formatting" },
+      { .name = "fmtlog", .version = "2.2.1", .description = "A fast logger" },
+      { .name = "spdlog", .version = "1.14.1", .description = "Fast logging" },
+      { .name = "toml11", .version = "4.2.0", .description = "TOML parser" },
+      { .name = "libfmt-extra", .version = "0.1.0", .description = "" },
+      { .name = "zlib", .version = "1.3.1", .description = "Compression" },
+  });
+}
+
+static void
+testRanking() {
+  const SearchIndex index = sampleIndex();
+  assertEq(searchNames(index, "fmt"), "fmt, fmtlog, libfmt-extra");
+  assertEq(searchNames(index, "LOG"), "fmtlog, spdlog");
+  // Names come before descriptions.
+  assertEq(searchNames(index, "fast"), "fmtlog, spdlog");
+  assertEq(searchNames(index, "parser"), "toml11");
+  assertEq(searchNames(index, ""), "");
+  assertEq(searchNames(index, "nothing"), "");
+
+  pass();
+}
+
+static void
+testTypos() {
+  const SearchIndex index = sampleIndex();
+  assertEq(searchNames(index, "spdlgo"), "spdlog");
+  assertEq(searchNames(index, "tmol11"), "toml11");
+  assertEq(searchNames(index, "zlb"), "zlib");
+  assertEq(searchNames(index, "fmtlogger"), "fmtlog");
+
+  pass();
+}
+
+static void
+testPaging() {
+  const SearchIndex index = sampleIndex();
+  assertEq(searchNames(index, "fmt", 2, 1), "fmt, fmtlog");
+  assertEq(searchNames(index, "fmt", 2, 2), "libfmt-extra");
+  assertEq(searchNames(index, "fmt", 2, 3), "");
+  assertEq(searchNames(index, "fmt", 0, 1), "");
+  assertEq(searchNames(index, "fmt", 2, 0), "");
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testRanking();
+  tests::testTypos();
+  tests::testPaging();
+}
+
+#endif
+
+#ifdef CABIN_BENCH
+
+#  include <chrono>
+#  include <cstdio>
+#  include <fmt/core.h>
+#  include <random>
+
+namespace bench {
+
+// `numPackages` packages named after a few random syllables, with
+// descriptions of random words.
+static std::vector<SearchEntry>
+generate(const size_t numPackages, const uint64_t seed) {
+  static constexpr std::string_view SYLLABLES[] = {
+    "fmt", "log", "json", "xml", "net", "http", "ssl", "zip", "io", "fs",
+    "re", "cpp", "lib", "core", "ui", "gl", "sql", "db", "ml", "math",
+  };
+  std::mt19937_64 rng(seed);
+  const auto syllable = [&] { return SYLLABLES[rng() % std::size(SYLLABLES)]; };
+
+  std::vector<SearchEntry> entries;
+  for (size_t i = 0; i < numPackages; ++i) {
+    SearchEntry entry{ .name = fmt::format("{}{}{}", syllable(), syllable(), i),
+                       .version = "1.0.0",
+                       .description = "" };
+    for (size_t word = 0; word < 8; ++word) {
+      entry.description += fmt::format("{}{} ", syllable(), syllable());
+    }
+    entries.push_back(std::move(entry));
+  }
+  return entries;
+}
+
+static void
+run(
+    const std::string_view name, const SearchIndex& index,
+    const std::string_view query
+) {
+  const auto start = std::chrono::steady_clock::now();
+  const size_t found = index.search(query, 10, 1).size();
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf(
+      "bench %s ... %.2f ms (%zu results)\n", std::string(name).c_str(),
+      elapsed.count(), found
+  );
+}
+
+}  // namespace bench
+
+int
+main() {
+  std::vector<SearchEntry> entries = bench::generate(20000, 1);
+  // A name in the index with two letters swapped.
+  std::string typo = entries[1234].name;
+  std::swap(typo[1], typo[2]);
+
+  const auto start = std::chrono::steady_clock::now();
+  const SearchIndex index(std::move(entries));
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf("bench build ... %.2f ms (20000 packages)\n", elapsed.count());
+
+  bench::run("substring", index, "jsonhttp");
+  bench::run("typo", index, typo);
+  bench::run("short", index, "io");
+  bench::run("common", index, "lib");
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct SearchEntry {
+  std::string name;
+  std::string version;
+  std::string description;
+};
+
+// A trigram index over package names, so that `cabin search` is answered
+// locally.  Matching ignores case and tolerates typos in names the way
+// findSimilarStr() does.
+class SearchIndex {
+public:
+  explicit SearchIndex(std::vector<SearchEntry> entries);
+
+  /// The entries matching `query`, best first, on the `page`th page of
+  /// `perPage` entries.  Exact names rank first, followed by names starting
+  /// with the query, names containing it, names a few edits away from it,
+  /// descriptions containing it, and names sharing many trigrams with it.
+  std::vector<const SearchEntry*>
+  search(std::string_view query, size_t perPage, size_t page) const;
+
+private:
+  std::vector<SearchEntry> entries;
+  // Upper-cased names and descriptions of `entries`.
+  std::vector<std::string> names;
+  std::vector<std::string> descriptions;
+  std::vector<uint32_t> numNameTrigrams;
+  // Trigram to the entries whose name contains it, in ascending order.
+  std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+};
@@ -0,0 +1,219 @@
+#include "Sha256.hpp"
+
+#include "Exception.hpp"
+#include "Rustify/Aliases.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+static constexpr std::array<uint32_t, 64> ROUND_CONSTANTS = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+Sha256::Sha256() noexcept
+    : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 } {}
+
+void
+Sha256::compress(const unsigned char* block) noexcept {
+  std::array<uint32_t, 64> words{};
+  for (size_t i = 0; i < 16; ++i) {
+    words[i] = static_cast<uint32_t>(block[i * 4]) << 24
+               | static_cast<uint32_t>(block[i * 4 + 1]) << 16
+               | static_cast<uint32_t>(block[i * 4 + 2]) << 8
+               | static_cast<uint32_t>(block[i * 4 + 3]);
+  }
+  for (size_t i = 16; i < 64; ++i) {
+    const uint32_t s0 = std::rotr(words[i - 15], 7)
+                        ^ std::rotr(words[i - 15], 18) ^ (words[i - 15] >> 3);
+    const uint32_t s1 = std::rotr(words[i - 2], 17)
+                        ^ std::rotr(words[i - 2], 19) ^ (words[i - 2] >> 10);
+    words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+  }
+
+  auto [a, b, c, d, e, f, g, h] = state;
+  for (size_t i = 0; i < 64; ++i) {
+    const uint32_t s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+    const uint32_t ch = (e & f) ^ (~e & g);
+    const uint32_t temp1 = h + s1 + ch + ROUND_CONSTANTS[i] + words[i];
+    const uint32_t s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+    const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t temp2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void
+Sha256::update(std::string_view data) noexcept {
+  totalLen += data.size();
+  if (bufferLen > 0) {
+    const size_t len = std::min(buffer.size() - bufferLen, data.size());
+    std::memcpy(buffer.data() + bufferLen, data.data(), len);
+    bufferLen += len;
+    data.remove_prefix(len);
+    if (bufferLen < buffer.size()) {
+      return;
+    }
+    compress(buffer.data());
+    bufferLen = 0;
+  }
+  while (data.size() >= buffer.size()) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    compress(reinterpret_cast<const unsigned char*>(data.data()));
+    data.remove_prefix(buffer.size());
+  }
+  std::memcpy(buffer.data(), data.data(), data.size());
+  bufferLen = data.size();
+}
+
+std::string
+Sha256::hexDigest() noexcept {
+  // Pad with 0x80, zeros, and the message length in bits so that the
+  // length ends a block.
+  const uint64_t bitLen = totalLen * 8;
+  std::array<unsigned char, 72> padding{};
+  padding[0] = 0x80;
+  const size_t padLen =
+      (bufferLen < 56 ? 56 - bufferLen : 120 - bufferLen) + sizeof(bitLen);
+  for (size_t i = 0; i < sizeof(bitLen); ++i) {
+    padding[padLen - 1 - i] = static_cast<unsigned char>(bitLen >> (i * 8));
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  update({ reinterpret_cast<const char*>(padding.data()), padLen });
+
+  std::string digest;
+  digest.reserve(state.size() * 8);
+  for (const uint32_t word : state) {
+    digest += fmt::format("{:08x}", word);
+  }
+  return digest;
+}
+
+std::string
+Sha256::hash(const std::string_view data) noexcept {
+  Sha256 hasher;
+  hasher.update(data);
+  return hasher.hexDigest();
+}
+
+std::string
+Sha256::hashFile(const fs::path& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    throw CabinError("failed to open ", path.string());
+  }
+  Sha256 hasher;
+  std::array<char, 65536> chunk{};
+  while (ifs.read(chunk.data(), chunk.size()) || ifs.gcount() > 0) {
+    hasher.update({ chunk.data(), static_cast<size_t>(ifs.gcount()) });
+  }
+  if (ifs.bad()) {
+    throw CabinError("failed to read ", path.string());
+  }
+  return hasher.hexDigest();
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+// Test vectors from FIPS 180-4 examples and NIST CAVP.
+static void
+testHash() {
+  assertEq(
+      Sha256::hash(""),
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+  );
+  assertEq(
+      Sha256::hash("abc"),
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+  );
+  assertEq(
+      Sha256::hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+  );
+  assertEq(
+      Sha256::hash(std::string(1000000, 'a')),
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+  );
+
+  pass();
+}
+
+static void
+testIncremental() {
+  const std::string data(1000, 'x');
+  const std::string expected = Sha256::hash(data);
+  // Feed chunks of every size around the block size.
+  for (size_t chunkLen = 1; chunkLen <= 130; ++chunkLen) {
+    Sha256 hasher;
+    for (size_t pos = 0; pos < data.size(); pos += chunkLen) {
+      hasher.update(std::string_view(data).substr(pos, chunkLen));
+    }
+    assertEq(hasher.hexDigest(), expected);
+  }
+
+  pass();
+}
+
+static void
+testHashFile() {
+  const fs::path path = fs::temp_directory_path() / "cabin-test-sha256";
+  std::ofstream(path, std::ios::binary) << std::string(100000, 'a');
+  assertEq(Sha256::hashFile(path), Sha256::hash(std::string(100000, 'a')));
+  fs::remove(path);
+
+  assertException<CabinError>(
+      [&] { Sha256::hashFile(path); }, "failed to open " + path.string()
+  );
+
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testHash();
+  tests::testIncremental();
+  tests::testHashFile();
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// SHA-256 (FIPS 180-4), fed incrementally so that data can be hashed while
+// it is streamed, e.g., downloaded.
+class Sha256 {
+public:
+  Sha256() noexcept;
+
+  void update(std::string_view data) noexcept;
+  /// The digest in lowercase hex.  Call at most once; no update() after it.
+  std::string hexDigest() noexcept;
+
+  static std::string hash(std::string_view data) noexcept;
+  /// Throws CabinError if the file cannot be read.
+  static std::string hashFile(const fs::path& path);
+
+private:
+  std::array<uint32_t, 8> state;
+  std::array<unsigned char, 64> buffer{};
+  size_t bufferLen = 0;
+  uint64_t totalLen = 0;
+
+  void compress(const unsigned char* block) noexcept;
+};
@@ -0,0 +1,383 @@
+#include "Toolchain.hpp"
+
+#include "Algos.hpp"
+#include "Command.hpp"
+#include "Exception.hpp"
+#include "Logger.hpp"
+#include "ProcessPool.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <fmt/core.h>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Bump when what we cache changes.
+static constexpr int CACHE_VERSION = 3;
+
+static constexpr std::array<std::string_view, 4> PROBED_FLAGS{
+  Toolchain::COLOR_FLAG,
+  Toolchain::TIME_TRACE_FLAG,
+  Toolchain::SPLIT_DWARF_FLAG,
+  Toolchain::MODULES_FLAG,
+};
+
+static std::string
+getEnv(const char* name) {
+  const char* value = std::getenv(name);
+  return value ? value : "";
+}
+
+// The CXX make uses by default, e.g., g++ on Linux.
+static std::string
+getMakeDefaultCxx() {
+  const std::string output = Command("make")
+                                 .addArg("--print-data-base")
+                                 .addArg("--question")
+                                 .addArg("-f")
+                                 .addArg("/dev/null")
+                                 .setStdErrConfig(Command::IOConfig::Null)
+                                 .output()
+                                 .stdOut;
+  std::istringstream iss(output);
+  std::string line;
+  while (std::getline(iss, line)) {
+    if (line.starts_with("CXX = ")) {
+      return line.substr(std::string_view("CXX = ").size());
+    }
+  }
+  throw CabinError("failed to get CXX from make");
+}
+
+// Finds out the kind and version of the compiler from its predefined
+// macros, i.e., the output of `-E -dM`.
+static void
+parseMacros(const std::string& macros, Toolchain& toolchain) {
+  std::unordered_map<std::string, std::string> defines;
+  std::istringstream iss(macros);
+  std::string line;
+  while (std::getline(iss, line)) {
+    constexpr std::string_view prefix = "#define ";
+    if (!line.starts_with(prefix)) {
+      continue;
+    }
+    line.erase(0, prefix.size());
+    const size_t space = line.find(' ');
+    if (space == std::string::npos) {
+      defines.emplace(line, "");
+    } else {
+      defines.emplace(line.substr(0, space), line.substr(space + 1));
+    }
+  }
+
+  const auto version = [&defines](
+                           const std::string& major, const std::string& minor,
+                           const std::string& patch
+                       ) {
+    return fmt::format(
+        "{}.{}.{}", defines[major], defines[minor], defines[patch]
+    );
+  };
+  if (const auto itr = defines.find("__VERSION__"); itr != defines.end()) {
+    std::string_view build = itr->second;
+    if (build.size() >= 2 && build.front() == '"' && build.back() == '"') {
+      build = build.substr(1, build.size() - 2);
+    }
+    toolchain.compilerBuild = build;
+  }
+  if (defines.contains("__clang__")) {
+    toolchain.compilerKind =
+        defines.contains("__apple_build_version__") ? "apple-clang" : "clang";
+    toolchain.compilerVersion = version(
+        "__clang_major__", "__clang_minor__", "__clang_patchlevel__"
+    );
+  } else if (defines.contains("__GNUC__")) {
+    toolchain.compilerKind = "gcc";
+    toolchain.compilerVersion =
+        version("__GNUC__", "__GNUC_MINOR__", "__GNUC_PATCHLEVEL__");
+  }
+}
+
+// Finds out the default library directories from the output of
+// `-print-search-dirs`, which both GCC and Clang print as
+// "libraries: =dir1:dir2:...".
+static void
+parseSearchDirs(const std::string& output, Toolchain& toolchain) {
+  std::istringstream iss(output);
+  std::string line;
+  while (std::getline(iss, line)) {
+    constexpr std::string_view prefix = "libraries: =";
+    if (!line.starts_with(prefix)) {
+      continue;
+    }
+    std::string_view dirs = std::string_view(line).substr(prefix.size());
+    while (!dirs.empty()) {
+      const size_t colon = dirs.find(':');
+      const std::string_view dir = dirs.substr(0, colon);
+      if (!dir.empty()) {
+        toolchain.libraryDirs.push_back(fs::path(dir).lexically_normal());
+      }
+      if (colon == std::string_view::npos) {
+        break;
+      }
+      dirs.remove_prefix(colon + 1);
+    }
+    return;
+  }
+}
+
+// Runs the compiler to learn about it, all probes at once.
+static Toolchain
+probe(const std::string& cxx) {
+  Toolchain toolchain;
+  toolchain.cxx = cxx;
+  const std::optional<fs::path> cxxPath = findProgram(cxx);
+  if (!cxxPath.has_value()) {
+    logger::debug("`{}` not found in PATH", cxx);
+    return toolchain;
+  }
+  toolchain.cxxPath = cxxPath.value();
+  logger::debug("Probing `{}`", cxx);
+
+  ProcessPool pool(PROBED_FLAGS.size() + 2);
+  pool.submit(
+      Command(cxx).addArgs({ "-x", "c++", "-E", "-dM", "/dev/null" }),
+      [&toolchain](const CommandOutput& output) {
+        if (output.exitCode == EXIT_SUCCESS) {
+          parseMacros(output.stdOut, toolchain);
+        }
+      }
+  );
+  pool.submit(
+      Command(cxx).addArg("-print-search-dirs"),
+      [&toolchain](const CommandOutput& output) {
+        if (output.exitCode == EXIT_SUCCESS) {
+          parseSearchDirs(output.stdOut, toolchain);
+        }
+      }
+  );
+
+  // Each flag is tried by compiling an empty file, where -Werror makes the
+  // flags Clang ignores with a warning fail.  Objects, and .dwo files with
+  // -gsplit-dwarf, go to a directory of our own.
+  const fs::path tmpDir =
+      fs::temp_directory_path() / fmt::format("cabin-probe-{}", getpid());
+  fs::create_directories(tmpDir);
+  for (const std::string_view flag : PROBED_FLAGS) {
+    const Command command =
+        Command(cxx)
+            .addArgs({ "-std=c++20", "-Werror", std::string(flag), "-x", "c++",
+                       "-c", "/dev/null", "-o",
+                       std::string(flag.substr(1)) + ".o" })
+            .setWorkingDirectory(tmpDir);
+    pool.submit(command, [&toolchain, flag](const CommandOutput& output) {
+      if (output.exitCode == EXIT_SUCCESS) {
+        toolchain.supportedFlags.emplace(flag);
+      }
+    });
+  }
+
+  std::error_code ec;
+  try {
+    pool.wait();
+  } catch (...) {
+    fs::remove_all(tmpDir, ec);
+    throw;
+  }
+  fs::remove_all(tmpDir, ec);
+  return toolchain;
+}
+
+static std::optional<Toolchain>
+loadCache(const fs::path& cachePath, const std::string& key) {
+  std::ifstream ifs(cachePath);
+  if (!ifs) {
+    return std::nullopt;
+  }
+  try {
+    const nlohmann::json json = nlohmann::json::parse(ifs);
+    if (json.at("key").get<std::string>() != key) {
+      return std::nullopt;  // a hash collision
+    }
+    Toolchain toolchain;
+    toolchain.cxx = json.at("cxx").get<std::string>();
+    toolchain.cxxPath = json.at("cxxPath").get<std::string>();
+    if (json.at("cxxStamp").get<std::string>()
+        != fileStamp(toolchain.cxxPath)) {
+      logger::debug("`{}` has changed", toolchain.cxxPath.string());
+      return std::nullopt;
+    }
+    toolchain.compilerKind = json.at("compilerKind").get<std::string>();
+    toolchain.compilerVersion = json.at("compilerVersion").get<std::string>();
+    toolchain.compilerBuild = json.at("compilerBuild").get<std::string>();
+    for (const nlohmann::json& flag : json.at("supportedFlags")) {
+      toolchain.supportedFlags.emplace(flag.get<std::string>());
+    }
+    for (const nlohmann::json& dir : json.at("libraryDirs")) {
+      toolchain.libraryDirs.emplace_back(dir.get<std::string>());
+    }
+    return toolchain;
+  } catch (const std::exception& e) {
+    logger::debug("ignoring {}: {}", cachePath.string(), e.what());
+    return std::nullopt;
+  }
+}
+
+static void
+saveCache(
+    const fs::path& cachePath, const std::string& key,
+    const Toolchain& toolchain
+) {
+  std::vector<std::string> libraryDirs;
+  for (const fs::path& dir : toolchain.libraryDirs) {
+    libraryDirs.push_back(dir.string());
+  }
+  const nlohmann::json json{
+    { "key", key },
+    { "cxx", toolchain.cxx },
+    { "cxxPath", toolchain.cxxPath.string() },
+    { "cxxStamp", fileStamp(toolchain.cxxPath) },
+    { "compilerKind", toolchain.compilerKind },
+    { "compilerVersion", toolchain.compilerVersion },
+    { "compilerBuild", toolchain.compilerBuild },
+    { "supportedFlags", toolchain.supportedFlags },
+    { "libraryDirs", libraryDirs },
+  };
+
+  // Failing to cache only costs probing again next time.
+  std::error_code ec;
+  fs::create_directories(cachePath.parent_path(), ec);
+  fs::path tmp = cachePath;
+  tmp += fmt::format(".{}.tmp", getpid());
+  std::ofstream(tmp) << json.dump();
+  fs::rename(tmp, cachePath, ec);
+  if (ec) {
+    logger::debug("cannot cache {}: {}", cachePath.string(), ec.message());
+    fs::remove(tmp, ec);
+  }
+}
+
+Toolchain
+Toolchain::detect(const fs::path& cacheDir) {
+  const std::string envCxx = getEnv("CXX");
+  std::string key =
+      fmt::format("{}\n{}\n{}", CACHE_VERSION, getEnv("PATH"), envCxx);
+  if (envCxx.empty()) {
+    // The compiler is what make defaults to.
+    const std::optional<fs::path> make = findProgram("make");
+    if (make.has_value()) {
+      key += fmt::format("\n{} {}", make->string(), fileStamp(make.value()));
+    }
+  }
+  const fs::path cachePath =
+      cacheDir / fmt::format("{:016x}.json", fnv1aHash(key));
+
+  if (std::optional<Toolchain> toolchain = loadCache(cachePath, key)) {
+    logger::trace("Using the toolchain cached in {}", cachePath.string());
+    return std::move(toolchain.value());
+  }
+
+  Toolchain toolchain = probe(envCxx.empty() ? getMakeDefaultCxx() : envCxx);
+  // A missing compiler may be installed in PATH later.
+  if (!toolchain.cxxPath.empty()) {
+    saveCache(cachePath, key, toolchain);
+  }
+  return toolchain;
+}
+
+#ifdef CABIN_TEST
+
+#  include "Rustify/Tests.hpp"
+
+namespace tests {
+
+static void
+testParseMacros() {
+  Toolchain gcc;
+  parseMacros(
+      "#define __GNUC__ 14\n#define __GNUC_MINOR__ 2\n"
+      "#define __GNUC_PATCHLEVEL__ 1\n#define __cplusplus 201703L\n"
+      "#define __VERSION__ \"14.2.1 20240910\"\n",
+      gcc
+  );
+  assertEq(gcc.compilerKind, "gcc");
+  assertEq(gcc.compilerVersion, "14.2.1");
+  assertEq(gcc.compilerBuild, "14.2.1 20240910");
+
+  // Clang defines __GNUC__ too.
+  Toolchain clang;
+  parseMacros(
+      "#define __GNUC__ 4\n#define __clang__ 1\n#define __clang_major__ 18\n"
+      "#define __clang_minor__ 1\n#define __clang_patchlevel__ 8\n",
+      clang
+  );
+  assertEq(clang.compilerKind, "clang");
+  assertEq(clang.compilerVersion, "18.1.8");
+
+  pass();
+}
+
+static void
+testParseSearchDirs() {
+  Toolchain toolchain;
+  parseSearchDirs(
+      "install: /usr/lib/gcc/x86_64-linux-gnu/12/\n"
+      "programs: =/usr/libexec/gcc/x86_64-linux-gnu/12/\n"
+      "libraries: =/usr/lib/gcc/x86_64-linux-gnu/12/:"
+      "/usr/lib/gcc/x86_64-linux-gnu/12/../../../x86_64-linux-gnu/::/lib/\n",
+      toolchain
+  );
+  assertTrue(
+      toolchain.libraryDirs
+      == std::vector<fs::path>{ "/usr/lib/gcc/x86_64-linux-gnu/12/",
+                                "/usr/lib/x86_64-linux-gnu/", "/lib/" }
+  );
+
+  pass();
+}
+
+static void
+testDetectCaches() {
+  const fs::path tmp = fs::temp_directory_path() / "cabin-test-toolchain";
+  fs::remove_all(tmp);
+
+  const Toolchain probed = Toolchain::detect(tmp);
+  assertFalse(probed.cxxPath.empty());
+  assertFalse(probed.compilerVersion.empty());
+
+  // Nothing is run once cached.
+  const size_t numRun = getRecordedUsages().size();
+  const Toolchain cached = Toolchain::detect(tmp);
+  assertEq(getRecordedUsages().size(), numRun);
+  assertEq(cached.cxxPath, probed.cxxPath);
+  assertEq(cached.compilerKind, probed.compilerKind);
+  assertEq(cached.compilerVersion, probed.compilerVersion);
+  assertEq(cached.compilerBuild, probed.compilerBuild);
+  assertTrue(cached.supportedFlags == probed.supportedFlags);
+  assertFalse(cached.libraryDirs.empty());
+  assertTrue(cached.libraryDirs == probed.libraryDirs);
+
+  fs::remove_all(tmp);
+  pass();
+}
+
+}  // namespace tests
+
+int
+main() {
+  tests::testParseMacros();
+  tests::testParseSearchDirs();
+  tests::testDetectCaches();
+}
+
+#endif
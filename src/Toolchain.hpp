@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Rustify/Aliases.hpp"
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// What we know about the compiler by running it.  Probing takes a few
+// processes, so the result is cached in `cacheDir`, keyed by PATH, CXX and
+// the inode and mtime of make and of the compiler.  Once cached, detecting
+// the toolchain only stats those binaries.
+struct Toolchain {
+  // Flags whose support is probed.
+  static constexpr std::string_view COLOR_FLAG = "-fdiagnostics-color";
+  static constexpr std::string_view TIME_TRACE_FLAG = "-ftime-trace";
+  static constexpr std::string_view SPLIT_DWARF_FLAG = "-gsplit-dwarf";
+  static constexpr std::string_view MODULES_FLAG = "-fmodules-ts";
+
+  // CXX, or the default of make.
+  std::string cxx;
+  // Where `cxx` is in PATH; empty if it is not found, when nothing is
+  // probed.
+  fs::path cxxPath;
+  // "gcc", "clang", "apple-clang" or "unknown".
+  std::string compilerKind = "unknown";
+  std::string compilerVersion;
+  // __VERSION__, which also tells apart vendor builds of the same version,
+  // e.g., "Apple LLVM 15.0.0 (clang-1500.0.40.1)".
+  std::string compilerBuild;
+  std::unordered_set<std::string> supportedFlags;
+  // Where the compiler looks for `-l` libraries by default, in order.
+  std::vector<fs::path> libraryDirs;
+
+  /// Load the toolchain from `cacheDir`, or probe and cache it.
+  static Toolchain detect(const fs::path& cacheDir);
+
+  bool supports(const std::string_view flag) const {
+    return supportedFlags.contains(std::string(flag));
+  }
+};
@@ -45,6 +45,7 @@ getCli() noexcept {
                       .setHidden(true))
           .addSubcmd(ADD_CMD)
           .addSubcmd(BUILD_CMD)
+          .addSubcmd(CACHE_CMD)
           .addSubcmd(CLEAN_CMD)
           .addSubcmd(FMT_CMD)
           .addSubcmd(HELP_CMD)
@@ -55,6 +56,8 @@ getCli() noexcept {
           .addSubcmd(SEARCH_CMD)
           .addSubcmd(TEST_CMD)
           .addSubcmd(TIDY_CMD)
+          .addSubcmd(UPDATE_CMD)
+          .addSubcmd(VENDOR_CMD)
           .addSubcmd(VERSION_CMD);
   return cli;
 }
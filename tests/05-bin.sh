@@ -0,0 +1,48 @@
+#!/bin/sh
+
+WHEREAMI=$(dirname "$(realpath "$0")")
+export CABIN_TERM_COLOR='never'
+
+test_description='Test multiple binaries in src/bin'
+
+. $WHEREAMI/sharness.sh
+
+test_expect_success 'cabin run --bin' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        mkdir src/bin &&
+        echo "const char* greet() { return \"hi\"; }" >src/greet.cc &&
+        echo "const char* greet();" >src/greet.hpp &&
+        cat >src/bin/hello.cc <<-EOF &&
+#include "../greet.hpp"
+#include <cstdio>
+int main() { std::puts(greet()); }
+EOF
+        "$WHEREAMI"/../build/cabin run --bin hello >actual &&
+        echo hi >expected &&
+        test_cmp expected actual &&
+        test -x cabin-out/debug/pkg &&
+        test -x cabin-out/debug/hello &&
+        test $(find cabin-out/debug -name greet.o | wc -l) -eq 1
+    )
+'
+
+test_expect_success 'cabin run without --bin' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        mkdir src/bin &&
+        echo "int main() {}" >src/bin/other.cc &&
+        test_must_fail "$WHEREAMI"/../build/cabin run 2>actual &&
+        grep "use the \`--bin\` option" actual
+    )
+'
+
+test_done
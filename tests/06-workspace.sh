@@ -0,0 +1,84 @@
+#!/bin/sh
+
+WHEREAMI=$(dirname "$(realpath "$0")")
+export CABIN_TERM_COLOR='never'
+
+test_description='Test workspaces'
+
+. $WHEREAMI/sharness.sh
+
+test_expect_success 'cabin build workspace' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    mkdir ws &&
+    cd ws &&
+    (
+        cat >cabin.toml <<-EOF &&
+[workspace]
+members = ["app", "libs/*"]
+EOF
+        mkdir -p libs/greet/include libs/greet/src &&
+        cat >libs/greet/cabin.toml <<-EOF &&
+[package]
+name = "greet"
+version = "0.1.0"
+edition = "20"
+EOF
+        echo "const char* greet();" >libs/greet/include/greet.hpp &&
+        echo "const char* greet() { return \"hi\"; }" >libs/greet/src/lib.cc &&
+        "$WHEREAMI"/../build/cabin new app &&
+        cat >>app/cabin.toml <<-EOF &&
+
+[dependencies]
+greet = { path = "../libs/greet" }
+EOF
+        cat >app/src/main.cc <<-EOF &&
+#include <cstdio>
+#include <greet.hpp>
+int main() { std::puts(greet()); }
+EOF
+        "$WHEREAMI"/../build/cabin build &&
+        test -f libs/greet/cabin-out/debug/libgreet.a &&
+        app/cabin-out/debug/app >actual &&
+        echo hi >expected &&
+        test_cmp expected actual
+    )
+'
+
+test_expect_success 'cabin build relinks against a rebuilt path dependency' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    (
+        mkdir -p greet/include greet/src &&
+        cat >greet/cabin.toml <<-EOF &&
+[package]
+name = "greet"
+version = "0.1.0"
+edition = "20"
+EOF
+        echo "const char* greet();" >greet/include/greet.hpp &&
+        echo "const char* greet() { return \"hi\"; }" >greet/src/lib.cc &&
+        "$WHEREAMI"/../build/cabin new app &&
+        cat >>app/cabin.toml <<-EOF &&
+
+[dependencies]
+greet = { path = "../greet" }
+EOF
+        cat >app/src/main.cc <<-EOF &&
+#include <cstdio>
+#include <greet.hpp>
+int main() { std::puts(greet()); }
+EOF
+        (cd app && "$WHEREAMI"/../build/cabin build) &&
+        echo "const char* greet() { return \"hello\"; }" >greet/src/lib.cc &&
+        (cd greet && "$WHEREAMI"/../build/cabin build) &&
+        (cd app && "$WHEREAMI"/../build/cabin build) &&
+        app/cabin-out/debug/app >actual &&
+        echo hello >expected &&
+        test_cmp expected actual
+    )
+'
+
+test_done
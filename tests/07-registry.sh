@@ -0,0 +1,51 @@
+#!/bin/sh
+
+WHEREAMI=$(dirname "$(realpath "$0")")
+export CABIN_TERM_COLOR='never'
+
+test_description='Test the local registry index'
+
+. $WHEREAMI/sharness.sh
+
+command -v python3 >/dev/null && test_set_prereq PYTHON3
+
+test_expect_success PYTHON3 'cabin search revalidates and works offline' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    export XDG_CACHE_HOME=$OUT/cache &&
+    LISTING=$OUT/cache/cabin/registry/packages.json &&
+    { python3 "$WHEREAMI"/registry-server.py $OUT/port 2>$OUT/log & } &&
+    SERVER=$! &&
+    test_when_finished "kill $SERVER 2>/dev/null" &&
+    for i in $(seq 50); do test -s $OUT/port && break; sleep 0.1; done &&
+    test -s $OUT/port &&
+    export CABIN_REGISTRY_URL=http://127.0.0.1:$(cat $OUT/port)/graphql &&
+    "$WHEREAMI"/../build/cabin search log >actual &&
+    grep fmtlog actual &&
+    grep spdlog actual &&
+    "$WHEREAMI"/../build/cabin search spdlgo >actual &&
+    grep spdlog actual &&
+    test_line_count = 1 $OUT/log &&
+    touch -d "1 hour ago" $LISTING &&
+    "$WHEREAMI"/../build/cabin search log >actual &&
+    grep fmtlog actual &&
+    grep 304 $OUT/log &&
+    (
+        cd $OUT &&
+        "$WHEREAMI"/../build/cabin new proj &&
+        cd proj &&
+        test_must_fail "$WHEREAMI"/../build/cabin add fmtlog 2>actual &&
+        grep "registry package" actual
+    ) &&
+    { kill $SERVER && wait $SERVER || true; } &&
+    touch -d "1 hour ago" $LISTING &&
+    "$WHEREAMI"/../build/cabin search log >actual 2>&1 &&
+    grep "using the cached index" actual &&
+    grep fmtlog actual &&
+    rm $LISTING &&
+    "$WHEREAMI"/../build/cabin search fmt >actual 2>&1 &&
+    grep "searching the cached index" actual &&
+    grep fmtlog actual
+'
+
+test_done
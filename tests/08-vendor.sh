@@ -0,0 +1,68 @@
+#!/bin/sh
+
+WHEREAMI=$(dirname "$(realpath "$0")")
+export CABIN_TERM_COLOR='never'
+
+test_description='Test building from vendored dependencies'
+
+. $WHEREAMI/sharness.sh
+
+test_expect_success 'cabin build reads vendored git dependencies offline' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    export XDG_CACHE_HOME=$OUT/cache &&
+    git init -q $OUT/dep &&
+    mkdir $OUT/dep/include &&
+    echo "inline int answer() { return 42; }" >$OUT/dep/include/dep.hpp &&
+    git -C $OUT/dep add . &&
+    git -C $OUT/dep -c user.name=a -c user.email=a@a commit -q -m init &&
+    REV=$(git -C $OUT/dep rev-parse HEAD) &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        cat >>cabin.toml <<-EOF &&
+
+[dependencies]
+dep = { git = "file://$OUT/dep" }
+EOF
+        cat >src/main.cc <<-EOF &&
+#include <dep.hpp>
+int main() { return answer() == 42 ? 0 : 1; }
+EOF
+        "$WHEREAMI"/../build/cabin vendor >actual &&
+        grep "\[vendor\]" actual &&
+        test -f vendor/dep/include/dep.hpp &&
+        grep $REV vendor/vendor.lock &&
+        cat >>cabin.toml <<-EOF &&
+
+[vendor]
+directory = "vendor"
+EOF
+        rm -rf $OUT/dep $OUT/cache &&
+        "$WHEREAMI"/../build/cabin run &&
+        test_path_is_missing $OUT/cache/cabin/git
+    )
+'
+
+test_expect_success 'cabin build requires dependencies to be vendored' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    export XDG_CACHE_HOME=$OUT/cache &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        cat >>cabin.toml <<-EOF &&
+
+[dependencies]
+dep = { git = "file://$OUT/dep" }
+
+[vendor]
+EOF
+        test_must_fail "$WHEREAMI"/../build/cabin build 2>actual &&
+        grep "run \`cabin vendor\`" actual
+    )
+'
+
+test_done
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+WHEREAMI=$(dirname "$(realpath "$0")")
+export CABIN_TERM_COLOR='never'
+
+test_description='Test the cache of test results'
+
+. $WHEREAMI/sharness.sh
+
+test_expect_success 'cabin test does not rerun passing tests' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        cat >src/greet.cc <<-EOF &&
+const char* greet() { return "hi"; }
+#ifdef CABIN_TEST
+int main() {}
+#endif
+EOF
+        "$WHEREAMI"/../build/cabin test >actual 2>&1 &&
+        grep "Passed unittests src/greet.cc in" actual &&
+        "$WHEREAMI"/../build/cabin test >actual 2>&1 &&
+        grep "Passed unittests src/greet.cc (cached)" actual &&
+        (
+            cd src &&
+            "$WHEREAMI"/../build/cabin test >../actual 2>&1
+        ) &&
+        grep "Passed unittests src/greet.cc (cached)" actual &&
+        "$WHEREAMI"/../build/cabin test --no-cache >actual 2>&1 &&
+        grep "Passed unittests src/greet.cc in" actual &&
+        CABIN_TEST_VAR=1 "$WHEREAMI"/../build/cabin test >actual 2>&1 &&
+        grep "Passed unittests src/greet.cc in" actual
+    )
+'
+
+test_expect_success 'cabin test reruns failing tests' '
+    OUT=$(mktemp -d) &&
+    test_when_finished "rm -rf $OUT" &&
+    cd $OUT &&
+    "$WHEREAMI"/../build/cabin new pkg &&
+    cd pkg &&
+    (
+        cat >src/fail.cc <<-EOF &&
+#ifdef CABIN_TEST
+int main() { return 1; }
+#endif
+EOF
+        test_must_fail "$WHEREAMI"/../build/cabin test 2>actual &&
+        grep "unittests src/fail.cc failed" actual &&
+        test_must_fail "$WHEREAMI"/../build/cabin test 2>actual &&
+        grep "unittests src/fail.cc failed" actual
+    )
+'
+
+test_done
@@ -0,0 +1,43 @@
+# A stand-in for the registry's GraphQL endpoint, answering the queries
+# cabin sends with fixed packages.  Writes the port to argv[1] and logs the
+# status of each response to stderr.
+import json, sys
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+PACKAGES = [
+    {"name": "fmtlog", "version": "1.0.0", "description": "A logger",
+     "metadata": {"dependencies": {"fmt": ">=10.0.0"}}},
+    {"name": "fmtlog", "version": "1.1.0", "description": "A logger",
+     "metadata": {"dependencies": {"fmt": ">=10.0.0"}}},
+    {"name": "spdlog", "version": "1.14.1", "description": "Fast logging",
+     "metadata": None},
+]
+ETAG = '"v1"'
+
+class Handler(BaseHTTPRequestHandler):
+    def do_POST(self):
+        req = json.loads(self.rfile.read(int(self.headers["Content-Length"])))
+        if self.headers.get("If-None-Match") == ETAG:
+            self.send_response(304)
+            self.end_headers()
+            return
+        if "getPackageVersions" in req["query"]:
+            name = req["variables"]["name"]
+            rows = [p for p in PACKAGES if p["name"] == name]
+        else:
+            rows = PACKAGES
+        body = json.dumps({"data": {"packages": rows}}).encode()
+        self.send_response(200)
+        self.send_header("ETag", ETAG)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        sys.stderr.write("%s\n" % (args[1],))
+        sys.stderr.flush()
+
+server = HTTPServer(("127.0.0.1", 0), Handler)
+with open(sys.argv[1], "w") as f:
+    f.write(str(server.server_address[1]))
+server.serve_forever()